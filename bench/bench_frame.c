@@ -0,0 +1,354 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sodium.h>
+#include <pcap.h>
+#include <fec.h>
+
+#include "compat.h"
+
+#include "wfb_params.h"
+#include "frame_ieee80211.h"
+#include "frame_wfb.h"
+#include "crypto_wfb.h"
+#include "util_msg.h"
+
+#include "bench_frame.h"
+
+#define BENCH_CHANNEL_ID	0x00000100 // link 1, port 0
+#define BENCH_FCS_LEN		4
+
+/*
+ * the same layout as RTL8812AU. TSFT, flags(with FCS), rate, channel,
+ * dBm and rx flags, then dBm and antenna of the two antennas.
+ */
+static const uint8_t bench_radiotap[] = {
+	0x00, 0x00, 0x26, 0x00,			// version, pad, it_len
+	0x2f, 0x40, 0x00, 0xa0,			// it_present[0]
+	0x20, 0x08, 0x00, 0xa0,			// it_present[1]
+	0x20, 0x08, 0x00, 0x00,			// it_present[2]
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // TSFT
+	0x10,					// flags
+	0x0c,					// rate
+	0xad, 0x16, 0x40, 0x01,			// channel 5805MHz
+	0xd8,					// dBm
+	0x00,					// pad
+	0x00, 0x00,				// rx flags
+	0xd7, 0x00,				// dBm, antenna 0
+	0xd9, 0x01,				// dBm, antenna 1
+};
+
+static uint8_t bench_80211[IEEE80211_DATA_HDRLEN];
+
+static size_t
+bench_frame_header(uint8_t *p)
+{
+	memcpy(p, bench_radiotap, sizeof(bench_radiotap));
+	memcpy(p + sizeof(bench_radiotap), bench_80211, sizeof(bench_80211));
+
+	return sizeof(bench_radiotap) + sizeof(bench_80211);
+}
+
+static int
+bench_session_frame(struct bench_frame *f, const uint8_t *session_key,
+    int k, int n, const uint8_t *pk, const uint8_t *sk)
+{
+	struct wfb_session_hdr hdr;
+	struct wfb_ng_hdr *wfb;
+	size_t off;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.epoch = htobe64(1);
+	hdr.channel_id = htobe32(BENCH_CHANNEL_ID);
+	hdr.fec_type = WFB_FEC_VDM_RS;
+	hdr.fec_k = k;
+	hdr.fec_n = n;
+	memcpy(hdr.session_key, session_key, sizeof(hdr.session_key));
+
+	off = bench_frame_header(f->data);
+	wfb = (struct wfb_ng_hdr *)(f->data + off);
+	wfb->packet_type = WFB_PACKET_SESSION;
+	randombytes_buf(wfb->u.session.nonce, sizeof(wfb->u.session.nonce));
+	if (crypto_box_easy(f->data + off + WFB_SESSION_BLOCK_HDRLEN,
+	    (uint8_t *)&hdr, sizeof(hdr), wfb->u.session.nonce, pk, sk) != 0)
+		return -1;
+	off += WFB_SESSION_BLOCK_HDRLEN + sizeof(hdr) + crypto_box_MACBYTES;
+	memset(f->data + off, 0, BENCH_FCS_LEN);
+	f->size = off + BENCH_FCS_LEN;
+
+	return 0;
+}
+
+static void
+bench_data_frame(struct bench_frame *f, const uint8_t *session_key,
+    uint64_t block_idx, int fragment_idx, const uint8_t *plain,
+    size_t plain_len)
+{
+	struct wfb_ng_hdr *wfb;
+	unsigned long long cipherlen;
+	uint64_t nonce;
+	size_t off;
+
+	off = bench_frame_header(f->data);
+	wfb = (struct wfb_ng_hdr *)(f->data + off);
+	wfb->packet_type = WFB_PACKET_DATA;
+	nonce = htobe64(block_idx << 8 | fragment_idx);
+	memcpy(wfb->u.data.nonce, &nonce, sizeof(nonce));
+	crypto_aead_chacha20poly1305_encrypt(
+	    f->data + off + WFB_DATA_BLOCK_HDRLEN, &cipherlen,
+	    plain, plain_len, (uint8_t *)wfb, WFB_DATA_BLOCK_HDRLEN,
+	    NULL, wfb->u.data.nonce, session_key);
+	off += WFB_DATA_BLOCK_HDRLEN + cipherlen;
+	memset(f->data + off, 0, BENCH_FCS_LEN);
+	f->size = off + BENCH_FCS_LEN;
+}
+
+/*
+ * the key file of the receiver, which has the secret key of the
+ * receiver and the public key of the transmitter.
+ */
+static int
+bench_keypair(const uint8_t *rx_sk, const uint8_t *tx_pk)
+{
+	char path[] = "/tmp/bench_key.XXXXXX";
+	FILE *fp;
+	int fd, r;
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		p_err("mkstemp() failed: %s\n", strerror(errno));
+		return -1;
+	}
+	fp = fdopen(fd, "w");
+	if (fp == NULL) {
+		close(fd);
+		unlink(path);
+		return -1;
+	}
+	if (fwrite(rx_sk, crypto_box_SECRETKEYBYTES, 1, fp) != 1 ||
+	    fwrite(tx_pk, crypto_box_PUBLICKEYBYTES, 1, fp) != 1) {
+		fclose(fp);
+		unlink(path);
+		return -1;
+	}
+	fclose(fp);
+
+	r = crypto_wfb_init(path);
+	unlink(path);
+
+	return r;
+}
+
+/*
+ * a session frame and n_block blocks of data and parity fragments. a
+ * data fragment is lost in loss[%] of blocks, so FEC recovers it.
+ */
+int
+bench_frames_synth(struct bench_frames *frames, size_t n_block,
+    int k, int n, size_t payload, int loss)
+{
+	uint8_t rx_pk[crypto_box_PUBLICKEYBYTES];
+	uint8_t rx_sk[crypto_box_SECRETKEYBYTES];
+	uint8_t tx_pk[crypto_box_PUBLICKEYBYTES];
+	uint8_t tx_sk[crypto_box_SECRETKEYBYTES];
+	uint8_t session_key[crypto_aead_chacha20poly1305_KEYBYTES];
+	uint8_t src[ETH_ADDR_LEN], dst[ETH_ADDR_LEN];
+	struct ieee80211_tx_context tx;
+	struct wfb_data_hdr *dhdr;
+	const uint8_t **plain = NULL;
+	uint8_t *block = NULL;
+	uint32_t channel_id;
+	uint16_t sig;
+	unsigned *block_nums = NULL;
+	fec_t *code = NULL;
+	size_t plain_len, nf, i;
+	int j, lost;
+
+	memset(frames, 0, sizeof(*frames));
+	if (k < 1 || k > n || n > MAX_FEC_N || payload == 0 ||
+	    payload > MAX_PAYLOAD_SIZE)
+		return -1;
+	if (sodium_init() < 0)
+		return -1;
+	fec_init();
+
+	crypto_box_keypair(rx_pk, rx_sk);
+	crypto_box_keypair(tx_pk, tx_sk);
+	if (bench_keypair(rx_sk, tx_pk) < 0)
+		return -1;
+	randombytes_buf(session_key, sizeof(session_key));
+
+	sig = htobe16(WFB_SIG);
+	channel_id = htobe32(BENCH_CHANNEL_ID);
+	memcpy(&src[0], &sig, sizeof(sig));
+	memcpy(&src[2], &channel_id, sizeof(channel_id));
+	memset(dst, 0xff, sizeof(dst));
+	ieee80211_tx_context_initialize(&tx, dst, src, src);
+	memcpy(bench_80211, &tx.hdr, sizeof(bench_80211));
+
+	plain_len = WFB_DATA_HDRLEN + payload;
+	frames->max_size = sizeof(bench_radiotap) + sizeof(bench_80211) +
+	    WFB_DATA_BLOCK_HDRLEN + plain_len +
+	    crypto_aead_chacha20poly1305_ABYTES + BENCH_FCS_LEN;
+	if (frames->max_size < sizeof(bench_radiotap) + sizeof(bench_80211) +
+	    WFB_SESSION_BLOCK_HDRLEN + WFB_SESSION_HDRLEN +
+	    crypto_box_MACBYTES + BENCH_FCS_LEN)
+		return -1;
+
+	nf = 1 + n_block * n;
+	frames->frame = calloc(nf, sizeof(struct bench_frame));
+	frames->buf = malloc(nf * frames->max_size);
+	block = malloc(n * plain_len);
+	plain = calloc(n, sizeof(uint8_t *));
+	block_nums = calloc(n, sizeof(unsigned));
+	code = fec_new(k, n);
+	if (frames->frame == NULL || frames->buf == NULL || block == NULL ||
+	    plain == NULL || block_nums == NULL || code == NULL)
+		goto err;
+	for (i = 0; i < nf; i++)
+		frames->frame[i].data = frames->buf + i * frames->max_size;
+
+	if (bench_session_frame(&frames->frame[frames->n_frame++],
+	    session_key, k, n, rx_pk, tx_sk) < 0)
+		goto err;
+
+	for (j = 0; j < n; j++) {
+		plain[j] = block + j * plain_len;
+		block_nums[j] = j;
+	}
+	for (i = 0; i < n_block; i++) {
+		for (j = 0; j < k; j++) {
+			dhdr = (struct wfb_data_hdr *)plain[j];
+			dhdr->flags = 0;
+			dhdr->packet_size = htobe16(payload);
+			randombytes_buf((uint8_t *)plain[j] + WFB_DATA_HDRLEN,
+			    payload);
+		}
+		if (n > k) {
+			fec_encode(code, plain, (uint8_t **)&plain[k],
+			    &block_nums[k], n - k, plain_len);
+		}
+
+		lost = (n > k && rand() % 100 < loss) ? rand() % k : -1;
+		for (j = 0; j < n; j++) {
+			if (j == lost)
+				continue;
+			bench_data_frame(&frames->frame[frames->n_frame++],
+			    session_key, i, j, plain[j], plain_len);
+		}
+	}
+
+	fec_free(code);
+	free(block_nums);
+	free(plain);
+	free(block);
+	return 0;
+err:
+	if (code)
+		fec_free(code);
+	free(block_nums);
+	free(plain);
+	free(block);
+	bench_frames_free(frames);
+	return -1;
+}
+
+/*
+ * frames captured by libpcap(e.g. tcpdump -i wlan0 -w file). the link
+ * type must be radiotap. truncated frames are skipped.
+ */
+int
+bench_frames_load(struct bench_frames *frames, const char *file)
+{
+	char errbuf[PCAP_ERRBUF_SIZE];
+	struct pcap_pkthdr *hdr;
+	const u_char *data;
+	struct bench_frame *frame;
+	size_t *offset = NULL, *o;
+	size_t buf_size = 0, used = 0, max_frame = 0, i;
+	uint8_t *buf;
+	pcap_t *pcap;
+	int r;
+
+	memset(frames, 0, sizeof(*frames));
+
+	pcap = pcap_open_offline(file, errbuf);
+	if (pcap == NULL) {
+		p_err("pcap_open_offline() failed: %s\n", errbuf);
+		return -1;
+	}
+	if (pcap_datalink(pcap) != DLT_IEEE802_11_RADIO) {
+		p_err("%s is not a radiotap capture.\n", file);
+		goto err;
+	}
+
+	while ((r = pcap_next_ex(pcap, &hdr, &data)) == 1) {
+		if (hdr->caplen < hdr->len || hdr->caplen > PCAP_MTU)
+			continue;
+		if (frames->n_frame == max_frame) {
+			max_frame = max_frame ? max_frame * 2 : 1024;
+			frame = realloc(frames->frame,
+			    max_frame * sizeof(struct bench_frame));
+			o = realloc(offset, max_frame * sizeof(size_t));
+			if (frame)
+				frames->frame = frame;
+			if (o)
+				offset = o;
+			if (frame == NULL || o == NULL)
+				goto err;
+		}
+		if (used + hdr->caplen > buf_size) {
+			buf_size = buf_size ? buf_size * 2 : (1 << 20);
+			buf = realloc(frames->buf, buf_size);
+			if (buf == NULL)
+				goto err;
+			frames->buf = buf;
+		}
+		memcpy(frames->buf + used, data, hdr->caplen);
+		offset[frames->n_frame] = used;
+		frames->frame[frames->n_frame].size = hdr->caplen;
+		frames->n_frame++;
+		used += hdr->caplen;
+		if (frames->max_size < hdr->caplen)
+			frames->max_size = hdr->caplen;
+	}
+	if (r == -1) {
+		p_err("pcap_next_ex() failed: %s\n", pcap_geterr(pcap));
+		goto err;
+	}
+
+	// the buffer doesn't move any more.
+	for (i = 0; i < frames->n_frame; i++)
+		frames->frame[i].data = frames->buf + offset[i];
+
+	free(offset);
+	pcap_close(pcap);
+	return 0;
+err:
+	free(offset);
+	pcap_close(pcap);
+	bench_frames_free(frames);
+	return -1;
+}
+
+void
+bench_frames_free(struct bench_frames *frames)
+{
+	if (frames == NULL)
+		return;
+
+	free(frames->frame);
+	free(frames->buf);
+	memset(frames, 0, sizeof(*frames));
+}
+
+double
+bench_elapsed(const struct timespec *t0, const struct timespec *t1)
+{
+	return (t1->tv_sec - t0->tv_sec) +
+	    (t1->tv_nsec - t0->tv_nsec) / 1e9;
+}
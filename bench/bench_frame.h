@@ -0,0 +1,30 @@
+#ifndef __BENCH_FRAME_H__
+#define __BENCH_FRAME_H__
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+/*
+ * captured frames for benchmarks. each frame starts from the radiotap
+ * header, as rx_frame_pcap() receives it.
+ */
+struct bench_frame {
+	uint8_t *data;
+	size_t size;
+};
+
+struct bench_frames {
+	struct bench_frame *frame;
+	size_t n_frame;
+	size_t max_size;
+
+	uint8_t *buf;
+};
+
+extern int bench_frames_synth(struct bench_frames *frames, size_t n_block,
+    int k, int n, size_t payload, int loss);
+extern int bench_frames_load(struct bench_frames *frames, const char *file);
+extern void bench_frames_free(struct bench_frames *frames);
+extern double bench_elapsed(const struct timespec *t0,
+    const struct timespec *t1);
+#endif /* __BENCH_FRAME_H__ */
@@ -0,0 +1,229 @@
+/*
+ * load time benchmark of the log analyzer.
+ *
+ * A synthetic version 1 log is written and loaded by load_log(). Each
+ * block has INET6 records of received fragments, and DECODE records of
+ * its data fragments appear after the next blocks are received, as FEC
+ * recovered frames do. Keys are not in order, so the key index and the
+ * sort after loading are exercised.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "compat.h"
+
+#include "wfb_params.h"
+#include "rx_log.h"
+#include "log_analysis/log_raw.h"
+
+struct wfb_opt wfb_options;
+
+#define BENCH_RECORDS	(50 * 1000 * 1000)
+#define BENCH_FEC_K	8
+#define BENCH_FEC_N	12
+#define BENCH_LAG	2 // blocks until the decoded frames are logged
+#define BENCH_LOSS	10 // [%] of fragments
+#define BENCH_PAYLOAD	16 // bytes of a decoded frame
+#define BENCH_BLOCK_NS	1000000 // [ns] per block
+#define BENCH_FILE	"bench_log_load.log"
+
+static double
+elapsed(struct timespec *t0, struct timespec *t1)
+{
+	return (t1->tv_sec - t0->tv_sec) +
+	    (t1->tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+static int
+put_record(FILE *fp, uint64_t block_idx, uint8_t fragment_idx,
+    uint8_t type, uint64_t ts)
+{
+	struct rx_log_frame_header hd;
+	uint8_t payload[BENCH_PAYLOAD];
+
+	memset(&hd, 0, sizeof(hd));
+	hd.tv_sec = htole64(ts / 1000000000);
+	hd.tv_nsec = htole64(ts % 1000000000);
+	hd.seq = htole64(block_idx * BENCH_FEC_N + fragment_idx);
+	hd.block_idx = htole64(block_idx);
+	hd.fragment_idx = fragment_idx;
+	hd.type = type;
+	if (type == FRAME_TYPE_INET6) {
+		hd.size = htole32(1446);
+		hd.freq = 5805;
+		hd.dbm = -40 - (block_idx % 20);
+		hd.rx_src[0] = 0xfe;
+		hd.rx_src[1] = 0x80;
+		hd.rx_src[15] = 1 + fragment_idx % 2;
+	}
+	else {
+		hd.size = htole32(sizeof(payload));
+		hd.dbm = DBM_INVAL;
+		memset(payload, fragment_idx, sizeof(payload));
+	}
+
+	if (fwrite(&hd, sizeof(hd), 1, fp) != 1)
+		return -1;
+	if (type == FRAME_TYPE_DECODE &&
+	    fwrite(payload, sizeof(payload), 1, fp) != 1)
+		return -1;
+
+	return 0;
+}
+
+static int
+write_log(const char *file, size_t n_records)
+{
+	struct rx_log_file_header fh;
+	uint64_t block_idx, ts;
+	size_t n = 0;
+	FILE *fp;
+	int f;
+
+	fp = fopen(file, "w");
+	if (fp == NULL) {
+		perror(file);
+		return -1;
+	}
+	setvbuf(fp, NULL, _IOFBF, 1 << 20);
+
+	memset(&fh, 0, sizeof(fh));
+	fh.version = RX_LOG_VERSION;
+	fh.fec_type = 1;
+	fh.fec_k = BENCH_FEC_K;
+	fh.fec_n = BENCH_FEC_N;
+	fh.channel_id = htole32(0x00000100);
+	fh.signature = htole32(RX_LOG_SIGNATURE);
+	if (fwrite(&fh, sizeof(fh), 1, fp) != 1)
+		goto err;
+
+	for (block_idx = 0; n < n_records; block_idx++) {
+		ts = block_idx * BENCH_BLOCK_NS;
+		for (f = 0; f < BENCH_FEC_N && n < n_records; f++) {
+			if (rand() % 100 < BENCH_LOSS)
+				continue;
+			if (put_record(fp, block_idx, f,
+			    FRAME_TYPE_INET6, ts + f) < 0)
+				goto err;
+			n++;
+		}
+		if (block_idx < BENCH_LAG)
+			continue;
+		for (f = 0; f < BENCH_FEC_K && n < n_records; f++) {
+			if (put_record(fp, block_idx - BENCH_LAG, f,
+			    FRAME_TYPE_DECODE, ts + BENCH_FEC_N + f) < 0)
+				goto err;
+			n++;
+		}
+	}
+
+	if (fclose(fp) != 0) {
+		perror(file);
+		return -1;
+	}
+	return 0;
+err:
+	perror(file);
+	fclose(fp);
+	return -1;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "bench_log_load -- log load time benchmark\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Synopsis:\n");
+	fprintf(stderr, "\tbench_log_load [-n <records>] [-o <file>] "
+	    "[-k] [-h]\n");
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "\t-n <records> ... specify number of records. "
+	    "default: %d\n", BENCH_RECORDS);
+	fprintf(stderr, "\t-o <file> ... specify the log file. "
+	    "default: %s\n", BENCH_FILE);
+	fprintf(stderr, "\t-k ... keep the log file, and load it if exists.\n");
+	fprintf(stderr, "\t-h ... print help(this).\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct log_store *ls;
+	struct timespec t0, t1, t2;
+	struct rusage ru;
+	const char *file = BENCH_FILE;
+	size_t n_records = BENCH_RECORDS;
+	bool keep = false;
+	FILE *fp;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "n:o:kh")) != -1) {
+		switch (ch) {
+			case 'n':
+				n_records = strtoul(optarg, NULL, 10);
+				break;
+			case 'o':
+				file = optarg;
+				break;
+			case 'k':
+				keep = true;
+				break;
+			case 'h':
+			default:
+				usage();
+				exit(EXIT_SUCCESS);
+		}
+	}
+	if (n_records == 0) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	if (!keep || access(file, R_OK) != 0) {
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		if (write_log(file, n_records) < 0) {
+			unlink(file);
+			exit(EXIT_FAILURE);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		printf("write %zu records: %.2f sec\n", n_records,
+		    elapsed(&t0, &t1));
+	}
+
+	fp = fopen(file, "r");
+	if (fp == NULL) {
+		perror(file);
+		exit(EXIT_FAILURE);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	ls = load_log(fp);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	fclose(fp);
+	if (ls == NULL) {
+		fprintf(stderr, "Cannot load %s\n", file);
+		exit(EXIT_FAILURE);
+	}
+	getrusage(RUSAGE_SELF, &ru);
+
+	printf("load %zu rows (%zu seq keys, %zu block keys): %.2f sec, "
+	    "%.2f Mrecords/s, max RSS %ld MiB\n", ls->col.n,
+	    ls->kvi.n_keys, ls->block_kvi.n_keys, elapsed(&t0, &t1),
+	    ls->col.n / elapsed(&t0, &t1) / 1e6, ru.ru_maxrss / 1024);
+	printf("packets %" PRIu32 ", H.265 frames %" PRIu32 "\n",
+	    ls->n_pkts, ls->n_frames);
+
+	free_log(ls);
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+	printf("free: %.2f sec\n", elapsed(&t1, &t2));
+
+	if (!keep)
+		unlink(file);
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,165 @@
+/*
+ * micro benchmark of the radiotap and 802.11 header parsers.
+ *
+ * Captured frames are parsed by radiotap_frame_parse(),
+ * ieee80211_frame_parse() and wfb_frame_parse() as rx_frame_pcap() does.
+ * The full path drops the radiotap layout cache and the 802.11 header
+ * prediction before every frame, so the generic radiotap iterator and
+ * the header validation run each time. The fast path keeps them.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wfb_params.h"
+#include "frame_radiotap.h"
+#include "frame_ieee80211.h"
+#include "frame_wfb.h"
+#include "fec_wfb.h"
+#include "bench_frame.h"
+
+struct wfb_opt wfb_options;
+struct wfb_statistics wfb_stats;
+
+#define BENCH_PARSE	(10 * 1000 * 1000) // frames to parse
+#define BENCH_FEC_K	8
+#define BENCH_FEC_N	12
+#define BENCH_BLOCKS	1000
+#define BENCH_PAYLOAD	1024
+
+struct bench_parser {
+	struct radiotap_context radiotap;
+	struct ieee80211_context ieee80211;
+	struct wfb_context wfb;
+};
+
+static int
+bench_parse(struct bench_parser *p, uint8_t *data, size_t size)
+{
+	ssize_t parsed;
+
+	parsed = radiotap_frame_parse(data, size, &p->radiotap);
+	if (parsed < 0 || p->radiotap.bad_fcs)
+		return -1;
+	data += parsed;
+	size -= parsed;
+	if (p->radiotap.has_fcs)
+		size -= 4;
+
+	parsed = ieee80211_frame_parse(data, size, &p->ieee80211);
+	if (parsed < 0)
+		return -1;
+	data += parsed;
+	size -= parsed;
+
+	parsed = wfb_frame_parse(data, size, &p->wfb);
+	if (parsed < 0)
+		return -1;
+
+	return 0;
+}
+
+static void
+bench_run(const char *name, struct bench_frames *frames, size_t n_parse,
+    bool fast)
+{
+	struct bench_parser p;
+	struct timespec t0, t1;
+	size_t i, error = 0;
+	double sec;
+
+	memset(&p, 0, sizeof(p));
+	memset(&wfb_stats, 0, sizeof(wfb_stats));
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < n_parse; i++) {
+		struct bench_frame *f = &frames->frame[i % frames->n_frame];
+
+		if (!fast) {
+			memset(p.radiotap.layout, 0, sizeof(p.radiotap.layout));
+			p.radiotap.layout_next = 0;
+			p.ieee80211.has_predict = false;
+		}
+		if (bench_parse(&p, f->data, f->size) < 0)
+			error++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	sec = bench_elapsed(&t0, &t1);
+
+	printf("%-5s %9zu frames %7.1f ns/frame %7.2f Mframes/s "
+	    "(error %zu, radiotap hit %" PRIu64 "/miss %" PRIu64
+	    ", 802.11 predict %" PRIu64 ")\n", name, n_parse,
+	    sec * 1e9 / n_parse, n_parse / sec / 1e6, error,
+	    wfb_stats.pcap_radiotap_cache_hit,
+	    wfb_stats.pcap_radiotap_cache_miss,
+	    wfb_stats.pcap_80211_predict_hit);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "bench_radiotap -- header parser micro benchmark\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Synopsis:\n");
+	fprintf(stderr, "\tbench_radiotap [-f <file>] [-n <frames>] [-h]\n");
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "\t-f <file> ... specify captured frames(pcap, "
+	    "radiotap). default: synthesized RTL8812AU frames\n");
+	fprintf(stderr, "\t-n <frames> ... specify number of frames to "
+	    "parse. default: %d\n", BENCH_PARSE);
+	fprintf(stderr, "\t-h ... print help(this).\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct bench_frames frames;
+	const char *file = NULL;
+	size_t n_parse = BENCH_PARSE;
+	int ch, r;
+
+	while ((ch = getopt(argc, argv, "f:n:h")) != -1) {
+		switch (ch) {
+			case 'f':
+				file = optarg;
+				break;
+			case 'n':
+				n_parse = strtoul(optarg, NULL, 10);
+				break;
+			case 'h':
+			default:
+				usage();
+				exit(EXIT_SUCCESS);
+		}
+	}
+	if (n_parse == 0) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	if (file) {
+		r = bench_frames_load(&frames, file);
+	}
+	else {
+		fec_wfb_init();
+		r = bench_frames_synth(&frames, BENCH_BLOCKS,
+		    BENCH_FEC_K, BENCH_FEC_N, BENCH_PAYLOAD, 0);
+	}
+	if (r < 0 || frames.n_frame == 0) {
+		fprintf(stderr, "No frames to parse\n");
+		exit(EXIT_FAILURE);
+	}
+	printf("%zu frames from %s\n", frames.n_frame,
+	    file ? file : "synthesizer");
+
+	bench_run("full", &frames, n_parse, false);
+	bench_run("fast", &frames, n_parse, true);
+
+	bench_frames_free(&frames);
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,397 @@
+/*
+ * micro benchmark of the Rx ring.
+ *
+ * The slab ring in util_rbuf.c is compared with the previous ring, which
+ * scans the live blocks for every fragment and has separately allocated
+ * fragments. Fragments are stored in the same way as rx_data(), and a
+ * block is released when k fragments are received.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wfb_params.h"
+#include "util_rbuf.h"
+
+struct wfb_opt wfb_options;
+
+#define BENCH_FEC_K		8
+#define BENCH_FEC_N		12
+#define BENCH_FRAG_SIZE		1446
+#define BENCH_FRAGMENTS		(10 * 1000 * 1000)
+#define BENCH_REORDER		(2 * BENCH_FEC_N) // max distance of swap
+#define BENCH_LOSS		20 // [%]
+
+struct fragment {
+	uint64_t block_idx;
+	int fragment_idx;
+};
+
+/*
+ * the previous ring. live blocks are scanned from ring_front.
+ */
+struct legacy_rbuf;
+
+struct legacy_rbuf_block {
+	uint64_t index;
+	size_t fragment_used;
+	uint8_t **fragment;
+	int8_t *rssi;
+	size_t *fragment_len;
+
+	struct legacy_rbuf *rbuf;
+};
+
+struct legacy_rbuf {
+	size_t ring_size;
+	size_t ring_front;
+	size_t ring_alloc;
+
+	size_t fragment_nof;
+	size_t fragment_size;
+
+	uint64_t last_block;
+
+	struct legacy_rbuf_block *blocks;
+};
+
+static void
+legacy_rbuf_free(struct legacy_rbuf *rbuf)
+{
+	int i, j;
+
+	if (rbuf == NULL)
+		return;
+
+	if (rbuf->blocks) {
+		for (i = 0; i < rbuf->ring_size; i++) {
+			struct legacy_rbuf_block *blk = &rbuf->blocks[i];
+
+			if (blk->fragment) {
+				for (j = 0; j < rbuf->fragment_nof; j++)
+					free(blk->fragment[j]);
+				free(blk->fragment);
+			}
+			free(blk->fragment_len);
+			free(blk->rssi);
+		}
+		free(rbuf->blocks);
+	}
+	free(rbuf);
+}
+
+static struct legacy_rbuf *
+legacy_rbuf_alloc(size_t ring_size, size_t frag_size, size_t nfrag)
+{
+	struct legacy_rbuf *rbuf;
+	int i, j;
+
+	rbuf = (struct legacy_rbuf *)calloc(1, sizeof(*rbuf));
+	if (rbuf == NULL)
+		return NULL;
+	rbuf->ring_size = ring_size;
+	rbuf->fragment_nof = nfrag;
+	rbuf->fragment_size = frag_size;
+	rbuf->last_block = BLOCK_INVAL;
+
+	rbuf->blocks = (struct legacy_rbuf_block *)
+	    calloc(ring_size, sizeof(struct legacy_rbuf_block));
+	if (rbuf->blocks == NULL)
+		goto err;
+	for (i = 0; i < ring_size; i++) {
+		struct legacy_rbuf_block *blk = &rbuf->blocks[i];
+
+		blk->index = BLOCK_INVAL;
+		blk->fragment = (uint8_t **)calloc(nfrag, sizeof(uint8_t *));
+		if (blk->fragment == NULL)
+			goto err;
+		for (j = 0; j < nfrag; j++) {
+			blk->fragment[j] = (uint8_t *)malloc(frag_size);
+			if (blk->fragment[j] == NULL)
+				goto err;
+		}
+		blk->fragment_len = (size_t *)calloc(nfrag, sizeof(size_t));
+		if (blk->fragment_len == NULL)
+			goto err;
+		blk->rssi = (int8_t *)malloc(nfrag);
+		if (blk->rssi == NULL)
+			goto err;
+		memset(blk->rssi, INT8_MIN, nfrag);
+		blk->rbuf = rbuf;
+	}
+
+	return rbuf;
+err:
+	legacy_rbuf_free(rbuf);
+	return NULL;
+}
+
+static void
+legacy_rbuf_free_block(struct legacy_rbuf_block *block)
+{
+	struct legacy_rbuf *rbuf = block->rbuf;
+
+	block->index = BLOCK_INVAL;
+	while (rbuf->blocks[rbuf->ring_front].index == BLOCK_INVAL) {
+		rbuf->ring_alloc--;
+		if (rbuf->ring_alloc == 0)
+			break;
+		rbuf->ring_front = (rbuf->ring_front + 1) % rbuf->ring_size;
+	}
+}
+
+static struct legacy_rbuf_block *
+legacy_rbuf_get_block(struct legacy_rbuf *rbuf, uint64_t block_idx)
+{
+	uint64_t new_blocks, allocate_start;
+	size_t idx = 0;
+	int i;
+
+	for (i = 0; i < rbuf->ring_alloc; i++) {
+		idx = (rbuf->ring_front + i) % rbuf->ring_size;
+		if (rbuf->blocks[idx].index == block_idx)
+			return &rbuf->blocks[idx];
+	}
+	if (rbuf->last_block != BLOCK_INVAL && block_idx <= rbuf->last_block)
+		return NULL;
+
+	new_blocks = (rbuf->last_block == BLOCK_INVAL) ?
+	    1 : block_idx - rbuf->last_block;
+	if (new_blocks > rbuf->ring_size)
+		new_blocks = rbuf->ring_size;
+	allocate_start = block_idx - new_blocks + 1;
+
+	for (i = 0; i < new_blocks; i++) {
+		struct legacy_rbuf_block *blk;
+
+		idx = (rbuf->ring_front + rbuf->ring_alloc + i) %
+		    rbuf->ring_size;
+		blk = &rbuf->blocks[idx];
+		if (blk->index != BLOCK_INVAL)
+			legacy_rbuf_free_block(blk);
+
+		blk->index = allocate_start + i;
+		blk->fragment_used = 0;
+		memset(blk->fragment_len, 0,
+		    sizeof(size_t) * rbuf->fragment_nof);
+		memset(blk->rssi, INT8_MIN, rbuf->fragment_nof);
+		rbuf->ring_alloc++;
+	}
+
+	rbuf->last_block = block_idx;
+	return &rbuf->blocks[idx];
+}
+
+/*
+ * input patterns
+ */
+static size_t
+gen_inorder(struct fragment *v, size_t nv, unsigned *seed)
+{
+	size_t i;
+
+	for (i = 0; i < nv; i++) {
+		v[i].block_idx = i / BENCH_FEC_N;
+		v[i].fragment_idx = i % BENCH_FEC_N;
+	}
+
+	return nv;
+}
+
+static size_t
+gen_reorder(struct fragment *v, size_t nv, unsigned *seed)
+{
+	struct fragment t;
+	size_t i, j;
+
+	gen_inorder(v, nv, seed);
+	for (i = 0; i < nv; i++) {
+		if (rand_r(seed) % 4 != 0)
+			continue;
+		j = i + 1 + rand_r(seed) % BENCH_REORDER;
+		if (j >= nv)
+			continue;
+		t = v[i];
+		v[i] = v[j];
+		v[j] = t;
+	}
+
+	return nv;
+}
+
+static size_t
+gen_lossy(struct fragment *v, size_t nv, unsigned *seed)
+{
+	size_t i, n;
+
+	for (i = 0, n = 0; i < nv; i++) {
+		if (rand_r(seed) % 100 < BENCH_LOSS)
+			continue;
+		v[n].block_idx = i / BENCH_FEC_N;
+		v[n].fragment_idx = i % BENCH_FEC_N;
+		n++;
+	}
+
+	return n;
+}
+
+static const struct {
+	const char *name;
+	size_t (*gen)(struct fragment *, size_t, unsigned *);
+} patterns[] = {
+	{ "in-order", gen_inorder },
+	{ "reordered", gen_reorder },
+	{ "lossy", gen_lossy },
+};
+
+/*
+ * store a fragment in the same way as rx_data().
+ */
+#define BENCH_STORE(blk, f, payload, delivered, release) do {		\
+	if ((blk) == NULL || (blk)->fragment_len[(f)] != 0)		\
+		break;							\
+	memcpy((blk)->fragment[(f)], (payload), BENCH_FRAG_SIZE);	\
+	(blk)->fragment_len[(f)] = BENCH_FRAG_SIZE;			\
+	(blk)->rssi[(f)] = -40;						\
+	(blk)->fragment_used++;						\
+	if ((blk)->fragment_used == BENCH_FEC_K) {			\
+		(delivered)++;						\
+		release(blk);						\
+	}								\
+} while (0)
+
+static double
+elapsed(struct timespec *t0, struct timespec *t1)
+{
+	return (t1->tv_sec - t0->tv_sec) +
+	    (t1->tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+static void
+report(const char *ring, const char *pattern, size_t n, size_t delivered,
+    double sec)
+{
+	printf("%-8s %-10s %10zu frags %9zu blocks %8.1f ns/frag "
+	    "%7.2f Mfrags/s\n", ring, pattern, n, delivered,
+	    sec * 1e9 / n, n / sec / 1e6);
+}
+
+static int
+bench_slab(const char *name, const struct fragment *v, size_t n,
+    const uint8_t *payload)
+{
+	struct rbuf *rbuf;
+	struct rbuf_block *blk;
+	struct timespec t0, t1;
+	size_t i, delivered = 0;
+
+	rbuf = rbuf_alloc(RX_RING_SIZE, BENCH_FRAG_SIZE, BENCH_FEC_N, false);
+	if (rbuf == NULL) {
+		fprintf(stderr, "rbuf_alloc() failed\n");
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < n; i++) {
+		blk = rbuf_get_block(rbuf, v[i].block_idx);
+		BENCH_STORE(blk, v[i].fragment_idx, payload, delivered,
+		    rbuf_free_block);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	report("slab", name, n, delivered, elapsed(&t0, &t1));
+
+	rbuf_free(rbuf);
+	return 0;
+}
+
+static int
+bench_legacy(const char *name, const struct fragment *v, size_t n,
+    const uint8_t *payload)
+{
+	struct legacy_rbuf *rbuf;
+	struct legacy_rbuf_block *blk;
+	struct timespec t0, t1;
+	size_t i, delivered = 0;
+
+	rbuf = legacy_rbuf_alloc(RX_RING_SIZE, BENCH_FRAG_SIZE, BENCH_FEC_N);
+	if (rbuf == NULL) {
+		fprintf(stderr, "legacy_rbuf_alloc() failed\n");
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < n; i++) {
+		blk = legacy_rbuf_get_block(rbuf, v[i].block_idx);
+		BENCH_STORE(blk, v[i].fragment_idx, payload, delivered,
+		    legacy_rbuf_free_block);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	report("legacy", name, n, delivered, elapsed(&t0, &t1));
+
+	legacy_rbuf_free(rbuf);
+	return 0;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "bench_rbuf -- Rx ring micro benchmark\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Synopsis:\n");
+	fprintf(stderr, "\tbench_rbuf [-n <frags>] [-h]\n");
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "\t-n <frags> ... specify number of fragments. "
+	    "default: %d\n", BENCH_FRAGMENTS);
+	fprintf(stderr, "\t-h ... print help(this).\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct fragment *v;
+	uint8_t payload[BENCH_FRAG_SIZE];
+	size_t nv = BENCH_FRAGMENTS, n;
+	unsigned seed = 5742;
+	int ch, i, r = 0;
+
+	while ((ch = getopt(argc, argv, "n:h")) != -1) {
+		switch (ch) {
+			case 'n':
+				nv = strtoul(optarg, NULL, 10);
+				break;
+			case 'h':
+			default:
+				usage();
+				exit(EXIT_SUCCESS);
+		}
+	}
+	if (nv == 0) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	v = (struct fragment *)malloc(sizeof(*v) * nv);
+	if (v == NULL) {
+		fprintf(stderr, "Cannot allocate fragments\n");
+		exit(EXIT_FAILURE);
+	}
+	memset(payload, 0x5a, sizeof(payload));
+
+	printf("ring size %d, k %d, n %d, fragment %d bytes\n",
+	    RX_RING_SIZE, BENCH_FEC_K, BENCH_FEC_N, BENCH_FRAG_SIZE);
+	for (i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+		n = patterns[i].gen(v, nv, &seed);
+		if (bench_legacy(patterns[i].name, v, n, payload) < 0 ||
+		    bench_slab(patterns[i].name, v, n, payload) < 0) {
+			r = -1;
+			break;
+		}
+	}
+
+	free(v);
+	exit(r < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+}
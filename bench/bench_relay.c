@@ -0,0 +1,142 @@
+/*
+ * micro benchmark of the relay(mirror only) path.
+ *
+ * Synthesized frames are passed to rx_frame_pcap() with a mirror handler
+ * which sends nothing. The full path parses the WFB header, decrypts data
+ * fragments and recovers lost ones by FEC, as before the relay mode. The
+ * relay path stops right after rx_mirror_frame().
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "wfb_params.h"
+#include "rx_core.h"
+#include "fec_wfb.h"
+#include "bench_frame.h"
+
+struct wfb_opt wfb_options;
+struct wfb_statistics wfb_stats;
+
+#define BENCH_FEC_K	8
+#define BENCH_FEC_N	12
+#define BENCH_BLOCKS	5000
+#define BENCH_PAYLOAD	1024
+#define BENCH_LOSS	5 // [%] of blocks
+
+static void
+bench_mirror(struct iovec *iov, int iovcnt, void *arg)
+{
+	size_t *mirrored = arg;
+
+	(*mirrored)++;
+}
+
+static int
+bench_run(const char *name, struct bench_frames *frames, bool relay)
+{
+	struct rx_context ctx;
+	struct timespec t0, t1;
+	uint8_t *rxbuf;
+	size_t mirrored = 0, i;
+	double sec;
+
+	rxbuf = malloc(frames->max_size);
+	if (rxbuf == NULL)
+		return -1;
+
+	rx_context_initialize(&ctx, 0);
+	if (rx_context_set_mirror(&ctx, bench_mirror, &mirrored) < 0 ||
+	    rx_context_set_relay(&ctx, relay) < 0) {
+		free(rxbuf);
+		return -1;
+	}
+	memset(&wfb_stats, 0, sizeof(wfb_stats));
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < frames->n_frame; i++) {
+		// as the capture hands a frame. the path may modify it.
+		memcpy(rxbuf, frames->frame[i].data, frames->frame[i].size);
+		rx_frame_pcap(&ctx, rxbuf, frames->frame[i].size);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	sec = bench_elapsed(&t0, &t1);
+
+	printf("%-6s %8zu frames %8zu mirrored %8.1f ns/frame "
+	    "%7.3f Mframes/s (accept %" PRIu64 ", relayed %" PRIu64
+	    ", FEC %" PRIu64 ")\n", name, frames->n_frame, mirrored,
+	    sec * 1e9 / frames->n_frame, frames->n_frame / sec / 1e6,
+	    wfb_stats.pcap_accept, wfb_stats.pcap_relayed,
+	    wfb_stats.fec_decode_cache_hit + wfb_stats.fec_decode_cache_miss);
+
+	rx_context_deinitialize(&ctx);
+	free(rxbuf);
+	return 0;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "bench_relay -- relay path micro benchmark\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Synopsis:\n");
+	fprintf(stderr, "\tbench_relay [-b <blocks>] [-p <bytes>] "
+	    "[-l <percent>] [-h]\n");
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "\t-b <blocks> ... specify number of FEC blocks. "
+	    "default: %d\n", BENCH_BLOCKS);
+	fprintf(stderr, "\t-p <bytes> ... specify payload size. "
+	    "default: %d\n", BENCH_PAYLOAD);
+	fprintf(stderr, "\t-l <percent> ... specify blocks losing a "
+	    "fragment. default: %d\n", BENCH_LOSS);
+	fprintf(stderr, "\t-h ... print help(this).\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct bench_frames frames;
+	size_t n_block = BENCH_BLOCKS, payload = BENCH_PAYLOAD;
+	int loss = BENCH_LOSS;
+	int ch, r;
+
+	while ((ch = getopt(argc, argv, "b:p:l:h")) != -1) {
+		switch (ch) {
+			case 'b':
+				n_block = strtoul(optarg, NULL, 10);
+				break;
+			case 'p':
+				payload = strtoul(optarg, NULL, 10);
+				break;
+			case 'l':
+				loss = atoi(optarg);
+				break;
+			case 'h':
+			default:
+				usage();
+				exit(EXIT_SUCCESS);
+		}
+	}
+
+	fec_wfb_init();
+	if (bench_frames_synth(&frames, n_block,
+	    BENCH_FEC_K, BENCH_FEC_N, payload, loss) < 0) {
+		fprintf(stderr, "Cannot synthesize frames\n");
+		exit(EXIT_FAILURE);
+	}
+	printf("k %d, n %d, payload %zu bytes, %d%% blocks lose a "
+	    "fragment\n", BENCH_FEC_K, BENCH_FEC_N, payload, loss);
+
+	r = bench_run("full", &frames, false);
+	if (r == 0)
+		r = bench_run("relay", &frames, true);
+
+	bench_frames_free(&frames);
+	exit(r < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -10,19 +10,21 @@
 #include "crypto_wfb.h"
 #include "util_msg.h"
 
-struct crypto_wfb_context ctx = {
+static struct crypto_wfb_keypair {
+	bool initialized;
+	uint8_t secret_key[crypto_box_SECRETKEYBYTES];
+	uint8_t public_key[crypto_box_PUBLICKEYBYTES];
+	uint8_t shared_key[crypto_box_BEFORENMBYTES];
+} kp = {
 	.initialized = false
-}; // singleton at this time;
-   
-static uint8_t _plain[MAX_DATA_PACKET_SIZE];
-static unsigned long long _plain_len;
+};
 
 int
 crypto_wfb_init(const char *keypair)
 {
 	FILE *fp = NULL;
 
-	if (ctx.initialized)
+	if (kp.initialized)
 		return 0;
 
 	if (!keypair) {
@@ -34,11 +36,11 @@ crypto_wfb_init(const char *keypair)
 		p_err("Cannot open %s: %s\n", keypair, strerror(errno));
 		goto err;
 	}
-	if (fread(ctx.secret_key, sizeof(ctx.secret_key), 1, fp) != 1) {
+	if (fread(kp.secret_key, sizeof(kp.secret_key), 1, fp) != 1) {
 		p_err("Cannot read secret key: %s\n", strerror(errno));
 		goto err;
 	}
-	if (fread(ctx.public_key, sizeof(ctx.public_key), 1, fp) != 1) {
+	if (fread(kp.public_key, sizeof(kp.public_key), 1, fp) != 1) {
 		p_err("Cannot read public key: %s\n", strerror(errno));
 		goto err;
 	}
@@ -49,11 +51,14 @@ crypto_wfb_init(const char *keypair)
 		p_err("Cannot initialize libsodium.\n");
 		goto err;
 	}
+	// the keypair is static. no need to do X25519 for each session.
+	if (crypto_box_beforenm(kp.shared_key,
+	    kp.public_key, kp.secret_key) != 0) {
+		p_err("Cannot compute shared key. Check your keypair.\n");
+		goto err;
+	}
 
-	ctx.has_secret_key = true;
-	ctx.has_public_key = true;
-	ctx.has_session_key = false;
-	ctx.initialized = true;
+	kp.initialized = true;
 	return 0;
 err:
 	if (fp)
@@ -62,17 +67,29 @@ err:
 }
 
 int
-crypto_wfb_session_key_set(const uint8_t *key, size_t klen)
+crypto_wfb_session_key_set(struct crypto_wfb_context *ctx,
+    const uint8_t *key, size_t klen, bool keep_prev)
 {
+	assert(ctx);
 	assert(key);
 	assert(klen);
 
-	ctx.has_session_key = false;
-	if (klen != sizeof(ctx.session_key))
+	/*
+	 * frames of the previous session may still be in the air. the
+	 * session may be invalidated while rekeying, but its key is kept.
+	 */
+	ctx->has_prev_session_key = keep_prev;
+	if (ctx->has_prev_session_key) {
+		memcpy(ctx->prev_session_key, ctx->session_key,
+		    sizeof(ctx->prev_session_key));
+	}
+
+	ctx->has_session_key = false;
+	if (klen != sizeof(ctx->session_key))
 		return -1;
 
-	memcpy(ctx.session_key, key, klen);
-	ctx.has_session_key = true;
+	memcpy(ctx->session_key, key, klen);
+	ctx->has_session_key = true;
 	return 0;
 }
 
@@ -87,11 +104,10 @@ crypto_wfb_session_decrypt(uint8_t *dst, const uint8_t *src, uint64_t len,
 	assert(len);
 	assert(nonce);
 
-	if (!ctx.initialized || !ctx.has_secret_key || !ctx.has_public_key)
+	if (!kp.initialized)
 		return -1;
 
-	r = crypto_box_open_easy(dst, src, len, nonce,
-	    ctx.public_key, ctx.secret_key);
+	r = crypto_box_open_easy_afternm(dst, src, len, nonce, kp.shared_key);
 	if (r != 0) {
 		p_err("Failed to decrypt session. Check your keypair.\n");
 		return -1;
@@ -101,50 +117,101 @@ crypto_wfb_session_decrypt(uint8_t *dst, const uint8_t *src, uint64_t len,
 }
 
 int
-crypto_wfb_data_decrypt(uint8_t *dst, unsigned long long *dstlen,
-    const uint8_t *src, uint64_t srclen, uint64_t hdrlen, uint8_t *nonce)
+crypto_wfb_data_verify(const struct crypto_wfb_context *ctx,
+    const uint8_t *ad, size_t adlen,
+    const uint8_t *cipher, size_t cipherlen, const uint8_t *nonce)
 {
-	int r;
-	const uint8_t *srcp;
-	uint8_t *dstp;
-	unsigned long long *dstlenp;
+	const uint8_t *mac;
+	size_t mlen;
 
-	assert(dst);
-	assert(src);
-	assert(srclen);
-	assert(hdrlen < srclen);
+	assert(ctx);
+	assert(ad);
+	assert(cipher);
 	assert(nonce);
 
-	if (!ctx.initialized || !ctx.has_session_key)
+	if (!kp.initialized || !ctx->has_session_key)
+		return -1;
+	if (cipherlen < crypto_aead_chacha20poly1305_ABYTES)
 		return -1;
+	mlen = cipherlen - crypto_aead_chacha20poly1305_ABYTES;
+	mac = cipher + mlen;
 
-	srcp = src + hdrlen;
-	srclen -= hdrlen;
+	if (crypto_aead_chacha20poly1305_decrypt_detached(NULL, NULL,
+	    cipher, mlen, mac, ad, adlen, nonce, ctx->session_key) == 0)
+		return 0;
+	if (ctx->has_prev_session_key &&
+	    crypto_aead_chacha20poly1305_decrypt_detached(NULL, NULL,
+	    cipher, mlen, mac, ad, adlen, nonce, ctx->prev_session_key) == 0)
+		return 1;
+
+	return -1;
+}
+
+int
+crypto_wfb_data_decrypt(const struct crypto_wfb_context *ctx,
+    uint8_t *dst, unsigned long long *dstlen,
+    const uint8_t *ad, size_t adlen,
+    const uint8_t *cipher, size_t cipherlen, const uint8_t *nonce)
+{
+	uint8_t tmp[MAX_DATA_PACKET_SIZE];
+	uint8_t *out;
+	const uint8_t *mac;
+	size_t mlen;
+	int r;
+	int prev = 0;
 
-	if (srcp == dst) {
-		_plain_len = sizeof(_plain);
-		dstp = _plain;
-		dstlenp = &_plain_len;
+	assert(ctx);
+	assert(dst);
+	assert(dstlen);
+	assert(ad);
+	assert(cipher);
+	assert(nonce);
+
+	if (!kp.initialized || !ctx->has_session_key)
+		return -1;
+	if (cipherlen < crypto_aead_chacha20poly1305_ABYTES) {
+		p_err("Frame too short\n");
+		return -1;
+	}
+	if (cipherlen - crypto_aead_chacha20poly1305_ABYTES > *dstlen) {
+		p_err("Buffer exhausted.\n");
+		return -1;
 	}
-	else {
-		dstp = dst;
-		dstlenp = dstlen;
+	// libsodium can decrypt in place, but not into other overlaps.
+	assert(dst == cipher || dst + *dstlen <= cipher ||
+	    dst >= cipher + cipherlen);
+
+	mlen = cipherlen - crypto_aead_chacha20poly1305_ABYTES;
+	mac = cipher + mlen;
+
+	/*
+	 * try the current key first. libsodium clears the output if the
+	 * MAC doesn't match, so in place decryption is done out of place
+	 * while the previous key may be needed.
+	 */
+	out = dst;
+	if (ctx->has_prev_session_key && dst == cipher) {
+		if (mlen > sizeof(tmp)) {
+			p_err("Frame too long\n");
+			return -1;
+		}
+		out = tmp;
+	}
+	r = crypto_aead_chacha20poly1305_decrypt_detached(out, NULL,
+			cipher, mlen, mac, ad, adlen, nonce, ctx->session_key);
+	if (r != 0 && ctx->has_prev_session_key) {
+		r = crypto_aead_chacha20poly1305_decrypt_detached(out, NULL,
+				cipher, mlen, mac, ad, adlen, nonce,
+				ctx->prev_session_key);
+		prev = 1;
 	}
-	r = crypto_aead_chacha20poly1305_decrypt(dstp, dstlenp, NULL,
-			srcp, srclen, src, hdrlen, nonce, ctx.session_key);
 	if (r != 0) {
 		p_err("Falied to decrypt data. Stale session key?\n");
 		return -1;
 	}
-	if (srcp != dst)
-		return 0;
+	if (out != dst)
+		memcpy(dst, out, mlen);
+	*dstlen = mlen;
 
-	if (_plain_len > *dstlen) {
-		p_err("Buffer exhausted.\n");
-		return -1;
-	}
-	memcpy(dst, _plain, _plain_len);
-	*dstlen = _plain_len;
-
-	return 0;
+	return prev;
 }
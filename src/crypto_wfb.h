@@ -3,20 +3,37 @@
 #include <stdbool.h>
 #include <sodium.h>
 
+/*
+ * session keys of a Rx context. data decryption only reads the context,
+ * so it can be called from several threads at once. the keys must not
+ * be changed while decryption is running.
+ */
 struct crypto_wfb_context {
-	bool initialized;
-	bool has_secret_key;
-	bool has_public_key;
 	bool has_session_key;
-	uint8_t secret_key[crypto_box_SECRETKEYBYTES];
-	uint8_t public_key[crypto_box_PUBLICKEYBYTES];
+	bool has_prev_session_key;
 	uint8_t session_key[crypto_aead_chacha20poly1305_KEYBYTES];
+	uint8_t prev_session_key[crypto_aead_chacha20poly1305_KEYBYTES];
 };
 
+/* the keypair is shared by all contexts, and read only after init. */
 extern int crypto_wfb_init(const char *keypair);
-extern int crypto_wfb_session_key_set(const uint8_t *key, size_t klen);
+extern int crypto_wfb_session_key_set(struct crypto_wfb_context *ctx,
+    const uint8_t *key, size_t klen, bool keep_prev);
 extern int crypto_wfb_session_decrypt(uint8_t *dst, const uint8_t *src,
     uint64_t len, uint8_t *nonce);
-extern int crypto_wfb_data_decrypt(uint8_t *dst, unsigned long long *dstlen,
-    const uint8_t *src, uint64_t srclen, uint64_t hdrlen, uint8_t *nonce);
+/*
+ * check the MAC only. returns 0 for the current key, 1 for the previous
+ * key, -1 if neither matches.
+ */
+extern int crypto_wfb_data_verify(const struct crypto_wfb_context *ctx,
+    const uint8_t *ad, size_t adlen,
+    const uint8_t *cipher, size_t cipherlen, const uint8_t *nonce);
+/*
+ * dst may be the cipher text itself(in place). returns 1 if the frame
+ * is decrypted by the previous session key.
+ */
+extern int crypto_wfb_data_decrypt(const struct crypto_wfb_context *ctx,
+    uint8_t *dst, unsigned long long *dstlen,
+    const uint8_t *ad, size_t adlen,
+    const uint8_t *cipher, size_t cipherlen, const uint8_t *nonce);
 #endif /* __CRYPTO_WFB__ */
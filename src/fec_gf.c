@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FEC_GF_X86
+#endif
+
+#include "fec_gf.h"
+#include "util_attribute.h"
+#include "util_msg.h"
+
+#define GF_POLY	0x11d
+
+static uint8_t gf_exp[510];
+static int gf_log[256];
+static uint8_t gf_mul_table[256][256];
+static uint8_t gf_inverse[256];
+
+/* c * x for the low and high nibble of x, for PSHUFB. */
+static uint8_t gf_nibble_lo[256][16] __aligned(16);
+static uint8_t gf_nibble_hi[256][16] __aligned(16);
+
+static void gf_addmul_scalar(uint8_t *dst, const uint8_t *src, uint8_t c,
+    size_t size);
+
+static struct {
+	const char *name;
+	void (*addmul)(uint8_t *dst, const uint8_t *src, uint8_t c,
+	    size_t size);
+} gf_kernel = { "scalar", gf_addmul_scalar };
+
+static void
+gf_addmul_scalar(uint8_t *dst, const uint8_t *src, uint8_t c, size_t size)
+{
+	const uint8_t *mul = gf_mul_table[c];
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		dst[i] ^= mul[src[i]];
+}
+
+#ifdef FEC_GF_X86
+__attribute__((target("ssse3")))
+static void
+gf_addmul_ssse3(uint8_t *dst, const uint8_t *src, uint8_t c, size_t size)
+{
+	__m128i lo, hi, mask, s, d;
+	size_t i;
+
+	lo = _mm_load_si128((const __m128i *)gf_nibble_lo[c]);
+	hi = _mm_load_si128((const __m128i *)gf_nibble_hi[c]);
+	mask = _mm_set1_epi8(0x0f);
+	for (i = 0; i + 16 <= size; i += 16) {
+		s = _mm_loadu_si128((const __m128i *)(src + i));
+		d = _mm_loadu_si128((const __m128i *)(dst + i));
+		d = _mm_xor_si128(d,
+		    _mm_shuffle_epi8(lo, _mm_and_si128(s, mask)));
+		d = _mm_xor_si128(d, _mm_shuffle_epi8(hi,
+		    _mm_and_si128(_mm_srli_epi64(s, 4), mask)));
+		_mm_storeu_si128((__m128i *)(dst + i), d);
+	}
+	gf_addmul_scalar(dst + i, src + i, c, size - i);
+}
+
+__attribute__((target("avx2")))
+static void
+gf_addmul_avx2(uint8_t *dst, const uint8_t *src, uint8_t c, size_t size)
+{
+	__m256i lo, hi, mask, s, d;
+	size_t i;
+
+	lo = _mm256_broadcastsi128_si256(
+	    _mm_load_si128((const __m128i *)gf_nibble_lo[c]));
+	hi = _mm256_broadcastsi128_si256(
+	    _mm_load_si128((const __m128i *)gf_nibble_hi[c]));
+	mask = _mm256_set1_epi8(0x0f);
+	for (i = 0; i + 32 <= size; i += 32) {
+		s = _mm256_loadu_si256((const __m256i *)(src + i));
+		d = _mm256_loadu_si256((const __m256i *)(dst + i));
+		d = _mm256_xor_si256(d,
+		    _mm256_shuffle_epi8(lo, _mm256_and_si256(s, mask)));
+		d = _mm256_xor_si256(d, _mm256_shuffle_epi8(hi,
+		    _mm256_and_si256(_mm256_srli_epi64(s, 4), mask)));
+		_mm256_storeu_si256((__m256i *)(dst + i), d);
+	}
+	gf_addmul_scalar(dst + i, src + i, c, size - i);
+}
+#endif
+
+void
+fec_gf_init(void)
+{
+	int i, j, x;
+
+	for (i = 0, x = 1; i < 255; i++) {
+		gf_exp[i] = x;
+		gf_exp[i + 255] = x;
+		gf_log[x] = i;
+		x <<= 1;
+		if (x & 0x100)
+			x ^= GF_POLY;
+	}
+	gf_log[0] = 255; // never used
+
+	for (i = 0; i < 256; i++) {
+		for (j = 0; j < 256; j++) {
+			if (i == 0 || j == 0)
+				gf_mul_table[i][j] = 0;
+			else
+				gf_mul_table[i][j] =
+				    gf_exp[gf_log[i] + gf_log[j]];
+		}
+		for (j = 0; j < 16; j++) {
+			gf_nibble_lo[i][j] = gf_mul_table[i][j];
+			gf_nibble_hi[i][j] = gf_mul_table[i][j << 4];
+		}
+	}
+	gf_inverse[0] = 0;
+	for (i = 1; i < 256; i++)
+		gf_inverse[i] = gf_exp[255 - gf_log[i]];
+
+	if (fec_gf_set_kernel("avx2") < 0 && fec_gf_set_kernel("ssse3") < 0)
+		fec_gf_set_kernel("scalar");
+	p_debug("GF(2^8) kernel: %s\n", gf_kernel.name);
+}
+
+/*
+ * select the kernel by name. returns -1 if the CPU doesn't support it.
+ * fec_gf_init() selects the fastest one.
+ */
+int
+fec_gf_set_kernel(const char *name)
+{
+	assert(name);
+
+	if (strcmp(name, "scalar") == 0) {
+		gf_kernel.name = "scalar";
+		gf_kernel.addmul = gf_addmul_scalar;
+		return 0;
+	}
+#ifdef FEC_GF_X86
+	__builtin_cpu_init();
+	if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+		gf_kernel.name = "avx2";
+		gf_kernel.addmul = gf_addmul_avx2;
+		return 0;
+	}
+	if (strcmp(name, "ssse3") == 0 && __builtin_cpu_supports("ssse3")) {
+		gf_kernel.name = "ssse3";
+		gf_kernel.addmul = gf_addmul_ssse3;
+		return 0;
+	}
+#endif
+
+	return -1;
+}
+
+const char *
+fec_gf_kernel(void)
+{
+	return gf_kernel.name;
+}
+
+uint8_t
+fec_gf_mul(uint8_t a, uint8_t b)
+{
+	return gf_mul_table[a][b];
+}
+
+void
+fec_gf_addmul(uint8_t *dst, const uint8_t *src, uint8_t c, size_t size)
+{
+	size_t i;
+
+	if (c == 0)
+		return;
+	if (c == 1) {
+		for (i = 0; i < size; i++)
+			dst[i] ^= src[i];
+		return;
+	}
+	gf_kernel.addmul(dst, src, c, size);
+}
+
+/* Gauss-Jordan elimination. returns -1 if the matrix is singular. */
+int
+fec_gf_invert_matrix(uint8_t *m, uint8_t *inv, int k)
+{
+	int row, col, i;
+	uint8_t c;
+
+	memset(inv, 0, k * k);
+	for (i = 0; i < k; i++)
+		inv[i * k + i] = 1;
+
+	for (col = 0; col < k; col++) {
+		for (row = col; row < k; row++) {
+			if (m[row * k + col])
+				break;
+		}
+		if (row == k)
+			return -1;
+		if (row != col) {
+			for (i = 0; i < k; i++) {
+				c = m[row * k + i];
+				m[row * k + i] = m[col * k + i];
+				m[col * k + i] = c;
+				c = inv[row * k + i];
+				inv[row * k + i] = inv[col * k + i];
+				inv[col * k + i] = c;
+			}
+		}
+		c = gf_inverse[m[col * k + col]];
+		for (i = 0; i < k; i++) {
+			m[col * k + i] = fec_gf_mul(m[col * k + i], c);
+			inv[col * k + i] = fec_gf_mul(inv[col * k + i], c);
+		}
+		for (row = 0; row < k; row++) {
+			if (row == col || m[row * k + col] == 0)
+				continue;
+			c = m[row * k + col];
+			fec_gf_addmul(&m[row * k], &m[col * k], c, k);
+			fec_gf_addmul(&inv[row * k], &inv[col * k], c, k);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,17 @@
+#ifndef __FEC_GF_H__
+#define __FEC_GF_H__
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * GF(2^8) arithmetic, same field as zfec(x^8 + x^4 + x^3 + x^2 + 1).
+ * zfec keeps its tables private, so we have our own copy.
+ */
+extern void fec_gf_init(void);
+extern const char *fec_gf_kernel(void);
+extern int fec_gf_set_kernel(const char *name);
+extern uint8_t fec_gf_mul(uint8_t a, uint8_t b);
+extern void fec_gf_addmul(uint8_t *dst, const uint8_t *src, uint8_t c,
+    size_t size);
+extern int fec_gf_invert_matrix(uint8_t *m, uint8_t *inv, int k);
+#endif /* __FEC_GF_H__ */
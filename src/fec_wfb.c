@@ -1,35 +1,192 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <alloca.h>
 #include <assert.h>
 
+#include <pthread.h>
+
+#include "wfb_params.h"
 #include "frame_wfb.h"
 #include "fec_wfb.h"
+#include "fec_gf.h"
 #include "util_rbuf.h"
 #include "util_msg.h"
 
+/*
+ * fec_new() builds the encode matrix. keep recently used codecs, so
+ * switching between a few (k, n) pairs doesn't rebuild them.
+ */
+static struct zfec_cache {
+	fec_t *zfec;
+	int k;
+	int n;
+	uint64_t last_used;
+} zfec_cache[FEC_WFB_CACHE];
+static uint64_t zfec_cache_clock;
+
+static fec_t *
+zfec_cache_get(int k, int n)
+{
+	struct zfec_cache *ent, *victim = NULL;
+	int i;
+
+	for (i = 0; i < FEC_WFB_CACHE; i++) {
+		ent = &zfec_cache[i];
+		if (ent->zfec && ent->k == k && ent->n == n) {
+			ent->last_used = ++zfec_cache_clock;
+			__atomic_add_fetch(&wfb_stats.fec_cache_hit, 1,
+			    __ATOMIC_RELAXED);
+			return ent->zfec;
+		}
+		// empty slots have last_used 0.
+		if (victim == NULL || ent->last_used < victim->last_used)
+			victim = ent;
+	}
+	__atomic_add_fetch(&wfb_stats.fec_cache_miss, 1,
+	    __ATOMIC_RELAXED);
+
+	// the codec in use is the most recently used one, never evicted.
+	if (victim->zfec) {
+		fec_free(victim->zfec);
+		victim->zfec = NULL;
+	}
+	victim->zfec = fec_new(k, n);
+	if (victim->zfec == NULL) {
+		victim->last_used = 0;
+		return NULL;
+	}
+	victim->k = k;
+	victim->n = n;
+	victim->last_used = ++zfec_cache_clock;
+
+	return victim->zfec;
+}
+
 static int
 fec_zfec_new(struct fec_context *ctx, int k, int n)
 {
 	struct zfec_context *zctx = &ctx->u.zfec;
 
-	if (zctx->zfec) {
-		fec_free(zctx->zfec);
-		zctx->zfec = NULL;
-	}
-	zctx->zfec = fec_new(k, n);
+	if (zctx->zfec && zctx->k == k && zctx->n == n)
+		return 0;
+
+	zctx->zfec = zfec_cache_get(k, n);
 	if (!zctx->zfec) {
 		p_err("fec_new() failed.\n");
 		return -1;
 	}
+	zctx->k = k;
+	zctx->n = n;
 
 	return 0;
 }
 
+/*
+ * fec_decode() builds and inverts the decode matrix for every block,
+ * but loss patterns are repeated on real links. keep inverted matrices
+ * keyed by (k, n, index[]). the encode matrix depends on (k, n) only.
+ *
+ * FEC jobs of blocks run on workers in parallel. the cache is locked,
+ * and the matrix is copied out to the caller.
+ */
+static struct zfec_decode_cache {
+	int k;
+	int n;
+	uint8_t *index; // k bytes
+	uint8_t *matrix; // k * k bytes, follows index
+	uint64_t last_used;
+} zfec_decode_cache[FEC_WFB_DECODE_CACHE];
+static uint64_t zfec_decode_clock;
+static pthread_mutex_t zfec_decode_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int
+zfec_decode_matrix_locked(const fec_t *code, const unsigned *index,
+    uint8_t *m_dec)
+{
+	struct zfec_decode_cache *ent, *victim = NULL;
+	uint8_t key[UINT8_MAX + 1];
+	uint8_t *m;
+	int k = code->k, n = code->n;
+	int i;
+
+	for (i = 0; i < k; i++)
+		key[i] = index[i];
+
+	for (i = 0; i < FEC_WFB_DECODE_CACHE; i++) {
+		ent = &zfec_decode_cache[i];
+		if (ent->index && ent->k == k && ent->n == n &&
+		    memcmp(ent->index, key, k) == 0) {
+			ent->last_used = ++zfec_decode_clock;
+			__atomic_add_fetch(&wfb_stats.fec_decode_cache_hit, 1,
+			    __ATOMIC_RELAXED);
+			memcpy(m_dec, ent->matrix, k * k);
+			return 0;
+		}
+		// empty slots have last_used 0.
+		if (victim == NULL || ent->last_used < victim->last_used)
+			victim = ent;
+	}
+	__atomic_add_fetch(&wfb_stats.fec_decode_cache_miss, 1,
+	    __ATOMIC_RELAXED);
+
+	if (victim->index == NULL || victim->k != k) {
+		free(victim->index);
+		victim->index = malloc(k + k * k);
+		if (victim->index == NULL) {
+			victim->matrix = NULL;
+			victim->last_used = 0;
+			return -1;
+		}
+		victim->matrix = victim->index + k;
+	}
+	victim->k = k;
+	victim->n = n;
+	victim->last_used = 0; // invalid until filled.
+	memcpy(victim->index, key, k);
+
+	m = alloca(k * k);
+	for (i = 0; i < k; i++) {
+		if (index[i] < k) {
+			memset(&m[i * k], 0, k);
+			m[i * k + i] = 1;
+		}
+		else {
+			memcpy(&m[i * k], &code->enc_matrix[index[i] * k], k);
+		}
+	}
+	if (fec_gf_invert_matrix(m, victim->matrix, k) < 0) {
+		p_err("singular decode matrix.\n");
+		free(victim->index);
+		victim->index = victim->matrix = NULL;
+		return -1;
+	}
+	victim->last_used = ++zfec_decode_clock;
+	memcpy(m_dec, victim->matrix, k * k);
+
+	return 0;
+}
+
+static int
+zfec_decode_matrix(const fec_t *code, const unsigned *index, uint8_t *m_dec)
+{
+	int r;
+
+	pthread_mutex_lock(&zfec_decode_lock);
+	r = zfec_decode_matrix_locked(code, index, m_dec);
+	pthread_mutex_unlock(&zfec_decode_lock);
+
+	return r;
+}
+
 int
 fec_zfec_decode(struct fec_context *ctx,
     const uint8_t **in, uint8_t **out, unsigned *index, size_t size)
 {
 	struct zfec_context *zctx;
+	uint8_t *m_dec;
+	int row, col, k, outix;
 
 	if (!ctx)
 		return -1;
@@ -38,7 +195,25 @@ fec_zfec_decode(struct fec_context *ctx,
 	if (!zctx)
 		return -1;
 
-	fec_decode(zctx->zfec, in, out, index, size);
+	k = zctx->zfec->k;
+	m_dec = alloca(k * k);
+	if (zfec_decode_matrix(zctx->zfec, index, m_dec) < 0) {
+		fec_decode(zctx->zfec, in, out, index, size);
+		return 0;
+	}
+
+	// same as fec_decode() except the matrix.
+	for (row = 0, outix = 0; row < k; row++) {
+		if (index[row] < k)
+			continue;
+		memset(out[outix], 0, size);
+		for (col = 0; col < k; col++) {
+			fec_gf_addmul(out[outix], in[col],
+			    m_dec[row * k + col], size);
+		}
+		outix++;
+	}
+
 	return 0;
 }
 
@@ -46,6 +221,7 @@ int
 fec_wfb_init(void)
 {
 	fec_init();
+	fec_gf_init();
 
 	return 0;
 }
@@ -3,12 +3,17 @@
 #include <fec.h>
 #include "util_rbuf.h"
 
+#define FEC_WFB_CACHE	8 // number of prebuilt codecs
+#define FEC_WFB_DECODE_CACHE	16 // number of inverted decode matrices
+
 struct fec_context {
 	int type;
 
 	union {
 		struct zfec_context {
-			fec_t *zfec;
+			fec_t *zfec; // owned by the codec cache
+			int k;
+			int n;
 		} zfec;
 	} u;
 };
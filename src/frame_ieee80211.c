@@ -96,6 +96,19 @@ ieee80211_frame_parse(void *data, size_t size, struct ieee80211_context *ctx)
 	assert(data);
 	assert(ctx);
 
+	/*
+	 * frames from the same transmitter are byte-identical up to
+	 * addr2. hdrlen, signature and channel_id are still valid.
+	 */
+	if (ctx->has_predict && size >= ctx->hdrlen &&
+	    memcmp(data, &ctx->predict_fc, sizeof(ctx->predict_fc)) == 0 &&
+	    memcmp(((struct ieee80211_header *)data)->u.base3.addr2,
+	    ctx->predict_addr2, sizeof(ctx->predict_addr2)) == 0) {
+		ctx->hdr = (struct ieee80211_header *)data;
+		wfb_stats.pcap_80211_predict_hit++;
+		return ctx->hdrlen;
+	}
+
 	memset(ctx, 0, sizeof(*ctx));
 	ctx->hdr = (struct ieee80211_header *)data;
 
@@ -157,5 +170,11 @@ ieee80211_frame_parse(void *data, size_t size, struct ieee80211_context *ctx)
 			return -1;
 	}
 
+	memcpy(&ctx->predict_fc, &ctx->hdr->frame_control,
+	    sizeof(ctx->predict_fc));
+	memcpy(ctx->predict_addr2, ctx->hdr->u.base3.addr2,
+	    sizeof(ctx->predict_addr2));
+	ctx->has_predict = true;
+
 	return ctx->hdrlen;
 }
@@ -1,6 +1,7 @@
 #ifndef __FRAME_IEEE80211_H__
 #define __FRAME_IEEE80211_H__
 #include <stdint.h>
+#include <stdbool.h>
 #include <unistd.h>
 #include <sys/uio.h>
 
@@ -64,6 +65,11 @@ struct ieee80211_context {
 	size_t hdrlen;
 	uint16_t wfb_signature;
 	uint32_t channel_id;
+
+	/* header of the last valid frame, for prediction */
+	bool has_predict;
+	uint16_t predict_fc; // little endian
+	uint8_t predict_addr2[ETH_ADDR_LEN];
 };
 
 struct ieee80211_tx_context {
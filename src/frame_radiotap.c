@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <inttypes.h>
 #include <string.h>
 #include <errno.h>
@@ -11,6 +12,8 @@
 
 #include "compat.h"
 
+#include "wfb_params.h"
+
 #include "frame_radiotap.h"
 #include "rx_log.h"
 #include "util_msg.h"
@@ -104,22 +107,133 @@ radiotap_context_dump(const struct radiotap_context *ctx)
 		    ctx->raw.mcs->flags, ctx->raw.mcs->index);
 }
 
-ssize_t
-radiotap_frame_parse(void *data, size_t size, struct radiotap_context *ctx)
+static void
+radiotap_set_arg(struct radiotap_params *raw, int index, void *arg)
 {
-	struct ieee80211_radiotap_iterator iter;
-	int err;
+	switch (index) {
+		case IEEE80211_RADIOTAP_TSFT:
+			raw->tsft = arg;
+			break;
+		case IEEE80211_RADIOTAP_FLAGS:
+			raw->flags = arg;
+			break;
+		case IEEE80211_RADIOTAP_RATE:
+			raw->rate = arg;
+			break;
+		case IEEE80211_RADIOTAP_CHANNEL:
+			raw->channel = arg;
+			break;
+		case IEEE80211_RADIOTAP_FHSS:
+			raw->fhss = arg;
+			break;
+		case IEEE80211_RADIOTAP_DBM_ANTSIGNAL:
+			raw->dbm_antenna_signal = arg;
+			break;
+		case IEEE80211_RADIOTAP_DBM_ANTNOISE:
+			raw->dbm_antenna_noise = arg;
+			break;
+		case IEEE80211_RADIOTAP_LOCK_QUALITY:
+			raw->lock_quality = arg;
+			break;
+		case IEEE80211_RADIOTAP_TX_ATTENUATION:
+			raw->tx_att = arg;
+			break;
+		case IEEE80211_RADIOTAP_DB_TX_ATTENUATION:
+			raw->db_tx_att = arg;
+			break;
+		case IEEE80211_RADIOTAP_DBM_TX_POWER:
+			raw->tx_power = arg;
+			break;
+		case IEEE80211_RADIOTAP_ANTENNA:
+			raw->antenna = arg;
+			break;
+		case IEEE80211_RADIOTAP_DB_ANTSIGNAL:
+			raw->db_antenna_signal = arg;
+			break;
+		case IEEE80211_RADIOTAP_DB_ANTNOISE:
+			raw->db_antenna_noise = arg;
+			break;
+		case IEEE80211_RADIOTAP_RX_FLAGS:
+			raw->rx_flags = arg;
+			break;
+		case IEEE80211_RADIOTAP_TX_FLAGS:
+			raw->tx_flags = arg;
+			break;
+		case IEEE80211_RADIOTAP_RTS_RETRIES:
+			raw->rts_retries = arg;
+			break;
+		case IEEE80211_RADIOTAP_DATA_RETRIES:
+			raw->data_retries = arg;
+			break;
+		case IEEE80211_RADIOTAP_MCS:
+			raw->mcs = arg;
+			break;
+		case IEEE80211_RADIOTAP_AMPDU_STATUS:
+			raw->ampdu = arg;
+			break;
+		case IEEE80211_RADIOTAP_VHT:
+			raw->vht = arg;
+			break;
+		case IEEE80211_RADIOTAP_TIMESTAMP:
+			raw->timestamp = arg;
+			break;
+		default:
+			/*
+			 * bit 18, 23 - 34 is described * in
+			 * radiotap.org, but not defined in their
+			 * library.
+			 */
+			break;
+	}
+}
 
-	assert(ctx);
-	assert(data);
+static int
+radiotap_count_present(uint8_t *data, size_t size)
+{
+	uint32_t present;
+	size_t off = offsetof(struct ieee80211_radiotap_header, it_present);
+	int n = 0;
 
-	memset(ctx, 0, sizeof(*ctx));
+	do {
+		if (off + sizeof(present) > size)
+			return -1;
+		memcpy(&present, data + off, sizeof(present));
+		off += sizeof(present);
+		n++;
+	} while (le32toh(present) & (1U << IEEE80211_RADIOTAP_EXT));
 
-	if (size < sizeof(struct ieee80211_radiotap_header)) {
-		p_err("Frame too short\n");
-		return 0;
+	return n;
+}
+
+static struct radiotap_layout *
+radiotap_layout_lookup(struct radiotap_context *ctx,
+    uint8_t *data, uint16_t it_len, int n_present)
+{
+	uint8_t *present;
+	int i;
+
+	present = data + offsetof(struct ieee80211_radiotap_header, it_present);
+	for (i = 0; i < RADIOTAP_LAYOUT_CACHE; i++) {
+		struct radiotap_layout *layout = &ctx->layout[i];
+
+		if (layout->it_len != it_len || layout->n_present != n_present)
+			continue;
+		if (memcmp(layout->present, present,
+		    sizeof(uint32_t) * n_present) != 0)
+			continue;
+		return layout;
 	}
 
+	return NULL;
+}
+
+static ssize_t
+radiotap_frame_parse_full(void *data, size_t size,
+    struct radiotap_context *ctx, struct radiotap_layout *layout)
+{
+	struct ieee80211_radiotap_iterator iter;
+	int err;
+
 	err = ieee80211_radiotap_iterator_init(&iter, data, size, NULL);
 	if (err < 0) {
 		p_err("malformed radiotap header\n");
@@ -131,82 +245,13 @@ radiotap_frame_parse(void *data, size_t size, struct radiotap_context *ctx)
 
 		if (!iter.is_radiotap_ns) {
 			/* ignore vendor name spaces */
+			layout->it_len = 0; // cannot be cached.
 			continue;
 		}
-		switch (iter.this_arg_index) {
-			case IEEE80211_RADIOTAP_TSFT:
-				ctx->raw.tsft = arg;
-				break;
-			case IEEE80211_RADIOTAP_FLAGS:
-				ctx->raw.flags = arg;
-				break;
-			case IEEE80211_RADIOTAP_RATE:
-				ctx->raw.rate = arg;
-				break;
-			case IEEE80211_RADIOTAP_CHANNEL:
-				ctx->raw.channel = arg;
-				break;
-			case IEEE80211_RADIOTAP_FHSS:
-				ctx->raw.fhss = arg;
-				break;
-			case IEEE80211_RADIOTAP_DBM_ANTSIGNAL:
-				ctx->raw.dbm_antenna_signal = arg;
-				break;
-			case IEEE80211_RADIOTAP_DBM_ANTNOISE:
-				ctx->raw.dbm_antenna_noise = arg;
-				break;
-			case IEEE80211_RADIOTAP_LOCK_QUALITY:
-				ctx->raw.lock_quality = arg;
-				break;
-			case IEEE80211_RADIOTAP_TX_ATTENUATION:
-				ctx->raw.tx_att = arg;
-				break;
-			case IEEE80211_RADIOTAP_DB_TX_ATTENUATION:
-				ctx->raw.db_tx_att = arg;
-				break;
-			case IEEE80211_RADIOTAP_DBM_TX_POWER:
-				ctx->raw.tx_power = arg;
-				break;
-			case IEEE80211_RADIOTAP_ANTENNA:
-				ctx->raw.antenna = arg;
-				break;
-			case IEEE80211_RADIOTAP_DB_ANTSIGNAL:
-				ctx->raw.db_antenna_signal = arg;
-				break;
-			case IEEE80211_RADIOTAP_DB_ANTNOISE:
-				ctx->raw.db_antenna_noise = arg;
-				break;
-			case IEEE80211_RADIOTAP_RX_FLAGS:
-				ctx->raw.rx_flags = arg;
-				break;
-			case IEEE80211_RADIOTAP_TX_FLAGS:
-				ctx->raw.tx_flags = arg;
-				break;
-			case IEEE80211_RADIOTAP_RTS_RETRIES:
-				ctx->raw.rts_retries = arg;
-				break;
-			case IEEE80211_RADIOTAP_DATA_RETRIES:
-				ctx->raw.data_retries = arg;
-				break;
-			case IEEE80211_RADIOTAP_MCS:
-				ctx->raw.mcs = arg;
-				break;
-			case IEEE80211_RADIOTAP_AMPDU_STATUS:
-				ctx->raw.ampdu = arg;
-				break;
-			case IEEE80211_RADIOTAP_VHT:
-				ctx->raw.vht = arg;
-				break;
-			case IEEE80211_RADIOTAP_TIMESTAMP:
-				ctx->raw.timestamp = arg;
-				break;
-			default:
-				/*
-				 * bit 18, 23 - 34 is described * in
-				 * radiotap.org, but not defined in their
-				 * library.
-				 */
-				break;
+		radiotap_set_arg(&ctx->raw, iter.this_arg_index, arg);
+		if (iter.this_arg_index < RADIOTAP_LAYOUT_NARG) {
+			layout->offset[iter.this_arg_index] =
+			    (uint8_t *)arg - (uint8_t *)data;
 		}
 	}
 	if (err != -ENOENT) {
@@ -214,10 +259,73 @@ radiotap_frame_parse(void *data, size_t size, struct radiotap_context *ctx)
 		return -1;
 	}
 
-	ctx->has_fcs =
-	    (*ctx->raw.flags & IEEE80211_RADIOTAP_F_FCS) ? true : false;
-	ctx->bad_fcs =
-	    (*ctx->raw.flags & IEEE80211_RADIOTAP_F_BADFCS) ? true : false;
+	return iter._max_length;
+}
+
+ssize_t
+radiotap_frame_parse(void *data, size_t size, struct radiotap_context *ctx)
+{
+	struct ieee80211_radiotap_header *hdr = data;
+	struct radiotap_layout *layout, new_layout;
+	uint16_t it_len;
+	ssize_t parsed;
+	int n_present;
+	int i;
+
+	assert(ctx);
+	assert(data);
+
+	// keep the layout cache.
+	memset(ctx, 0, offsetof(struct radiotap_context, layout));
+
+	if (size < sizeof(struct ieee80211_radiotap_header)) {
+		p_err("Frame too short\n");
+		return 0;
+	}
+	memcpy(&it_len, &hdr->it_len, sizeof(it_len));
+	it_len = le16toh(it_len);
+	n_present = radiotap_count_present(data, size);
+
+	layout = NULL;
+	if (hdr->it_version == 0 && it_len <= size &&
+	    n_present > 0 && n_present <= RADIOTAP_LAYOUT_PRESENT)
+		layout = radiotap_layout_lookup(ctx, data, it_len, n_present);
+	if (layout) {
+		for (i = 0; i < RADIOTAP_LAYOUT_NARG; i++) {
+			if (layout->offset[i] == 0)
+				continue;
+			radiotap_set_arg(&ctx->raw, i,
+			    (uint8_t *)data + layout->offset[i]);
+		}
+		parsed = it_len;
+		wfb_stats.pcap_radiotap_cache_hit++;
+	}
+	else {
+		memset(&new_layout, 0, sizeof(new_layout));
+		new_layout.it_len = it_len;
+		parsed = radiotap_frame_parse_full(data, size, ctx, &new_layout);
+		if (parsed < 0)
+			return -1;
+		if (new_layout.it_len != 0 &&
+		    n_present > 0 && n_present <= RADIOTAP_LAYOUT_PRESENT) {
+			new_layout.n_present = n_present;
+			memcpy(new_layout.present, (uint8_t *)data +
+			    offsetof(struct ieee80211_radiotap_header,
+			    it_present), sizeof(uint32_t) * n_present);
+			ctx->layout[ctx->layout_next] = new_layout;
+			ctx->layout_next =
+			    (ctx->layout_next + 1) % RADIOTAP_LAYOUT_CACHE;
+		}
+		wfb_stats.pcap_radiotap_cache_miss++;
+	}
+
+	if (ctx->raw.flags) {
+		ctx->has_fcs =
+		    (*ctx->raw.flags & IEEE80211_RADIOTAP_F_FCS) ? true : false;
+		ctx->bad_fcs =
+		    (*ctx->raw.flags & IEEE80211_RADIOTAP_F_BADFCS) ?
+		    true : false;
+	}
 	if (ctx->raw.channel) {
 		ctx->freq = le16toh(ctx->raw.channel->freq);
 		ctx->flags = le16toh(ctx->raw.channel->flags);
@@ -229,5 +337,5 @@ radiotap_frame_parse(void *data, size_t size, struct radiotap_context *ctx)
 		ctx->dbm = DBM_INVAL;
 	}
 
-	return iter._max_length;
+	return parsed;
 }
@@ -107,6 +107,21 @@ struct radiotap_eht {
 	uint32_t user_info[];
 } __packed;
 
+/*
+ * offsets of known fields, cached per it_present bitmap. a layout with a
+ * vendor namespace is never cached, as its skip length is in the data.
+ */
+#define RADIOTAP_LAYOUT_CACHE	4
+#define RADIOTAP_LAYOUT_PRESENT	4 // it_present words
+#define RADIOTAP_LAYOUT_NARG	(IEEE80211_RADIOTAP_TIMESTAMP + 1)
+
+struct radiotap_layout {
+	uint16_t it_len; // 0 if unused.
+	int n_present;
+	uint32_t present[RADIOTAP_LAYOUT_PRESENT];
+	uint16_t offset[RADIOTAP_LAYOUT_NARG]; // 0 if not present.
+};
+
 struct radiotap_context {
 	bool has_fcs;
 	bool bad_fcs;
@@ -155,6 +170,10 @@ struct radiotap_context {
 		struct radiotap_u_sig *u_sig;		// bit 33
 		struct radiotap_eht *eht;		// bit 34
 	} raw;
+
+	/* kept across frames */
+	struct radiotap_layout layout[RADIOTAP_LAYOUT_CACHE];
+	int layout_next;
 };
 
 struct radiotap_tx_context {
@@ -18,6 +18,8 @@
 #include "log_csv.h"
 #include "log_json.h"
 #include "log_summary.h"
+#include "log_hist.h"
+#include "log_stream.h"
 #ifdef ENABLE_GSTREAMER
 #include "log_h265.h"
 #endif
@@ -35,6 +37,12 @@ struct log_analysis_opt options = {
 	.local_play = false,
 	.interactive = false,
 	.dump_message = false,
+	.stream = false,
+	.follow = false,
+};
+
+static struct log_range range = {
+	.type = LOG_RANGE_NONE,
 };
 
 static void
@@ -49,7 +57,7 @@ print_help(const char *path)
 	printf("\n");
 	printf("Synopsis:\n");
 	printf("\t%s [-f <name>] [-o <name>] [-t <type>] [-l] [-i [<name>]]"
-	    " [-m] [-d]\n", name);
+	    " [-R <range>] [-s] [-F] [-m] [-d]\n", name);
 	printf("Options:\n");
 	printf("\t-f <name> ... specify input file name. default: STDIN\n");
 	printf("\t-o <name> ... specify output file name. default: STDOUT\n");
@@ -59,6 +67,11 @@ print_help(const char *path)
 #endif
 	printf("\t-i [<name>] ... interactive mode."
 	    " file <name> will be loaded.\n");
+	printf("\t-R <range> ... load records in the range only."
+	    " default: all\n");
+	printf("\t-s ... single pass streaming analysis."
+	    " csv, summary and hist only.\n");
+	printf("\t-F ... follow the input file while it grows. implies -s.\n");
 	printf("\t-r ... enable RSSI overlay.\n");
 	printf("\t-m ... dump messages.\n");
 	printf("\t-d ... enable debug log.\n");
@@ -67,10 +80,16 @@ print_help(const char *path)
 	printf("\tjson .. javascript object(per sequence).\n");
 	printf("\tjson_block .. javascript object(per block).\n");
 	printf("\tsummary .. summary values.\n");
+	printf("\thist .. histogram of dbm.\n");
 #ifdef ENABLE_GSTREAMER
 	printf("\tmp4 .. write MP4 video.\n");
 #endif
 	printf("\tnone .. no output. error check only.\n");
+	printf("Range <range>:\n");
+	printf("\tseq:<min>-<max> .. packet sequence.\n");
+	printf("\tblock:<min>-<max> .. block index.\n");
+	printf("\ttime:<min>-<max> .. seconds from the start of the log.\n");
+	printf("\t<min> or <max> can be omitted.\n");
 }
 
 static void
@@ -80,7 +99,7 @@ parse_options(int *argc0, char **argv0[])
 	char **argv = *argv0;
 	int ch;
 
-	while ((ch = getopt(argc, argv, "f:o:t:w:li:mrdh")) != -1) {
+	while ((ch = getopt(argc, argv, "f:o:t:w:li:msFrR:dh")) != -1) {
 		switch (ch) {
 			case 'f':
 				options.file_name_in = optarg;
@@ -101,6 +120,9 @@ parse_options(int *argc0, char **argv0[])
 				else if (strcasecmp(optarg, "summary") == 0) {
 					options.out_type = OUTPUT_SUMMARY;
 				}
+				else if (strcasecmp(optarg, "hist") == 0) {
+					options.out_type = OUTPUT_HIST;
+				}
 #ifdef ENABLE_GSTREAMER
 				else if (strcasecmp(optarg, "mp4") == 0) {
 					options.out_type = OUTPUT_MP4;
@@ -127,9 +149,23 @@ parse_options(int *argc0, char **argv0[])
 			case 'm':
 				options.dump_message = true;
 				break;
+			case 's':
+				options.stream = true;
+				break;
+			case 'F':
+				options.stream = true;
+				options.follow = true;
+				break;
 			case 'r':
 				wfb_options.rssi_overlay = true;
 				break;
+			case 'R':
+				if (log_range_parse(optarg, &range) < 0) {
+					fprintf(stderr,
+					    "Invalid range %s.\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
 			case 'i':
 				options.interactive = true;
 				options.file_name_in = optarg;
@@ -184,7 +220,18 @@ _main(int argc, char *argv[])
 		}
 	}
 
-	ls = load_log(fp_in);
+	if (options.stream) {
+		if (range.type != LOG_RANGE_NONE) {
+			p_err("-R cannot be used with -s.\n");
+			exit(EXIT_FAILURE);
+		}
+		if (log_stream(fp_in, options.file_name_in, fp_out,
+		    options.out_type, options.follow) < 0)
+			exit(EXIT_FAILURE);
+		exit(EXIT_SUCCESS);
+	}
+
+	ls = load_log_range(fp_in, &range);
 	if (fp_in)
 		fclose(fp_in);
 	if (ls == NULL) {
@@ -217,6 +264,9 @@ _main(int argc, char *argv[])
 		case OUTPUT_SUMMARY:
 			summary_output(fp_out, ls);
 			break;
+		case OUTPUT_HIST:
+			log_hist(ls);
+			break;
 		case OUTPUT_MP4:
 #ifdef ENABLE_GSTREAMER
 			if (fp_out)
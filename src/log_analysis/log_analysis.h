@@ -9,6 +9,7 @@ enum output_types {
 	OUTPUT_JSON_BLOCK,
 	OUTPUT_SUMMARY,
 	OUTPUT_MP4,
+	OUTPUT_HIST,
 	OUTPUT_MAX
 };
 
@@ -19,6 +20,8 @@ struct log_analysis_opt {
 	bool local_play;
 	bool interactive;
 	bool dump_message;
+	bool stream;
+	bool follow;
 };
 
 #endif /* __LOG_ANALYSIS_H__ */
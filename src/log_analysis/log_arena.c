@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "log_arena.h"
+
+#define ROUNDUP_ALIGN(x) \
+	(((x) + LOG_ARENA_ALIGN - 1) & ~((size_t)LOG_ARENA_ALIGN - 1))
+
+static struct log_arena_chunk *
+log_arena_chunk_alloc(struct log_arena *arena, size_t size)
+{
+	struct log_arena_chunk *c;
+
+	c = (struct log_arena_chunk *)malloc(sizeof(*c) + size);
+	if (c == NULL)
+		return NULL;
+	c->size = size;
+	c->used = 0;
+	c->next = NULL;
+	arena->n_chunks++;
+
+	return c;
+}
+
+void
+log_arena_init(struct log_arena *arena)
+{
+	assert(arena);
+
+	memset(arena, 0, sizeof(*arena));
+}
+
+void *
+log_arena_alloc(struct log_arena *arena, size_t size)
+{
+	struct log_arena_chunk *c;
+	void *p;
+
+	assert(arena);
+
+	size = ROUNDUP_ALIGN(size);
+	c = arena->head;
+	if (c && c->size - c->used >= size)
+		goto found;
+
+	if (size > LOG_ARENA_CHUNK_SIZE / 4) {
+		// dedicated chunk. keep filling the current one.
+		c = log_arena_chunk_alloc(arena, size);
+		if (c == NULL)
+			return NULL;
+		if (arena->head) {
+			c->next = arena->head->next;
+			arena->head->next = c;
+		}
+		else {
+			arena->head = c;
+		}
+		goto found;
+	}
+
+	c = log_arena_chunk_alloc(arena, LOG_ARENA_CHUNK_SIZE);
+	if (c == NULL)
+		return NULL;
+	c->next = arena->head;
+	arena->head = c;
+found:
+	p = c->data + c->used;
+	c->used += size;
+	arena->total += size;
+
+	return p;
+}
+
+void *
+log_arena_zalloc(struct log_arena *arena, size_t size)
+{
+	void *p;
+
+	p = log_arena_alloc(arena, size);
+	if (p)
+		memset(p, 0, size);
+
+	return p;
+}
+
+void
+log_arena_free(struct log_arena *arena)
+{
+	struct log_arena_chunk *c, *next;
+
+	if (arena == NULL)
+		return;
+
+	for (c = arena->head; c; c = next) {
+		next = c->next;
+		free(c);
+	}
+	memset(arena, 0, sizeof(*arena));
+}
@@ -0,0 +1,30 @@
+#ifndef __LOG_ARENA_H__
+#define __LOG_ARENA_H__
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Bump pointer allocator. objects are never freed one by one; the whole
+ * arena is released by log_arena_free().
+ */
+#define LOG_ARENA_CHUNK_SIZE	(1 << 20)
+#define LOG_ARENA_ALIGN		8 // enough for kvs and vs
+
+struct log_arena_chunk {
+	struct log_arena_chunk *next;
+	size_t size;
+	size_t used;
+	uint8_t data[] __attribute__((aligned(LOG_ARENA_ALIGN)));
+};
+
+struct log_arena {
+	struct log_arena_chunk *head;
+	size_t n_chunks;
+	size_t total; // bytes allocated
+};
+
+extern void log_arena_init(struct log_arena *arena);
+extern void *log_arena_alloc(struct log_arena *arena, size_t size);
+extern void *log_arena_zalloc(struct log_arena *arena, size_t size);
+extern void log_arena_free(struct log_arena *arena);
+#endif /* __LOG_ARENA_H__ */
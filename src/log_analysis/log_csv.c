@@ -46,7 +46,7 @@ add_nl(FILE *fp)
 	fprintf(fp, "\n");
 }
 
-static int
+int
 csv_serialize_v(FILE *fp, struct log_data_kv *kv, struct log_data_v *v)
 {
 	static const char *s_hdr[] = {
@@ -121,7 +121,7 @@ csv_serialize(FILE *fp, struct log_store *ls)
 	csv_serialize_v(fp, NULL, NULL);
 	TAILQ_FOREACH(kv, &ls->kvh, chain) {
 		TAILQ_FOREACH(v, &kv->vh, chain) {
-			if (v->filtered)
+			if (log_v_filtered(ls, v))
 				continue;
 			csv_serialize_v(fp, kv, v);
 		}
@@ -4,4 +4,5 @@
 #include "log_raw.h"
 
 int csv_serialize(FILE *fp, struct log_store *ls);
+int csv_serialize_v(FILE *fp, struct log_data_kv *kv, struct log_data_v *v);
 #endif /* __LOG_CSV_H__ */
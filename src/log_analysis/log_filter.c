@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <sys/queue.h>
 
@@ -42,7 +43,7 @@ log_update_kv(struct log_store *ls)
 		kv->n_ethernet_frame = 0;
 		kv->n_h265_frame = 0;
 		TAILQ_FOREACH(v, &kv->vh, block_chain) {
-			if (v->filtered)
+			if (log_v_filtered(ls, v))
 				continue;
 			if (v->type != FRAME_TYPE_INET6)
 				continue;
@@ -65,7 +66,7 @@ log_update_kv(struct log_store *ls)
 		TAILQ_FOREACH(v, &kv->vh, chain) {
 			if (!block_kv && v->block_kv)
 				block_kv = v->block_kv;
-			if (v->filtered)
+			if (log_v_filtered(ls, v))
 				continue;
 			if (v->type == FRAME_TYPE_INET6) {
 				kv->has_ethernet_frame = true;
@@ -85,7 +86,7 @@ log_update_kv(struct log_store *ls)
 		}
 		else if (kv->has_ethernet_frame) {
 			/* decode is not affected. */
-			vd->filtered = false;
+			ls->col.filtered[vd->row] = false;
 			kv->n_h265_frame++;
 			block_kv->n_h265_frame++;
 		}
@@ -94,14 +95,14 @@ log_update_kv(struct log_store *ls)
 			kv->has_fec_frame = true;
 			block_kv->has_fec_frame = true;
 
-			vd->filtered = false;
+			ls->col.filtered[vd->row] = false;
 			kv->n_h265_frame++;
 			block_kv->n_h265_frame++;
 			n_fec++;
 		}
 		else {
 			/* Can't apply FEC, the frame is lost */
-			vd->filtered = true;
+			ls->col.filtered[vd->row] = true;
 			kv->has_lost_frame = true;
 			block_kv->has_lost_frame = true;
 		}
@@ -113,15 +114,10 @@ log_update_kv(struct log_store *ls)
 int
 log_filter_reset(struct log_store *ls)
 {
-	struct log_data_kv *kv;
-	struct log_data_v *v;
-	int n_filtered = 0;
+	struct log_columns *col = &ls->col;
 
-	TAILQ_FOREACH(kv, &ls->kvh, chain) {
-		TAILQ_FOREACH(v, &kv->vh, chain) {
-			v->filtered = false;
-		}
-	}
+	if (col->n > 0)
+		memset(col->filtered, 0, col->n * sizeof(*col->filtered));
 
 	return 0;
 }
@@ -129,25 +125,20 @@ log_filter_reset(struct log_store *ls)
 int
 log_filter_dbm(struct log_store *ls, int8_t cut_off)
 {
-	struct log_data_kv *seq_kv, *block_kv;
-	struct log_data_v *v;
+	struct log_columns *col = &ls->col;
 	int n_filtered = 0;
 	int n_fec;
-
-	TAILQ_FOREACH(seq_kv, &ls->kvh, chain) {
-		TAILQ_FOREACH(v, &seq_kv->vh, chain) {
-			if (v->type != FRAME_TYPE_INET6)
-				continue;
-			if (v->dbm == DBM_INVAL)
-				continue;
-			if (v->dbm <= cut_off) {
-				v->filtered = true;
-				n_filtered++;
-			}
-			else {
-				v->filtered = false;
-			}
-		}
+	size_t i;
+	bool cut;
+
+	for (i = 0; i < col->n; i++) {
+		if (col->type[i] != FRAME_TYPE_INET6)
+			continue;
+		if (col->dbm[i] == DBM_INVAL)
+			continue;
+		cut = (col->dbm[i] <= cut_off);
+		col->filtered[i] = cut;
+		n_filtered += cut;
 	}
 	p_info("%d frames filtered.\n", n_filtered);
 	n_fec = log_update_kv(ls);
@@ -67,7 +67,7 @@ send_data(struct wfb_gst_context *ctx, struct log_store *ls)
 			}
 			if (v->type != FRAME_TYPE_DECODE)
 				continue;
-			if (v->filtered)
+			if (log_v_filtered(ls, v))
 				continue;
 			for (;;) {
 				if (emulate_tick) {
@@ -82,7 +82,7 @@ send_data(struct wfb_gst_context *ctx, struct log_store *ls)
 				}
 				wfb_gst_add_dbm(&player_ctx, dbm);
 				wfb_gst_write(&player_ctx,
-				    &v->ts, v->buf, v->size);
+				    &v->ts, log_payload(ls, v), v->size);
 				break;
 			}
 		}
@@ -43,41 +43,30 @@ graph(uint32_t hist, uint32_t hist_Max)
 }
 
 int
-log_hist(struct log_store *ls)
+log_hist_print(const uint32_t *hist)
 {
-	struct log_data_kv *kv;
-	struct log_data_v *v;
-	uint32_t hist[UINT8_MAX], cumulative[UINT8_MAX], mode, hist_Max;
+	uint32_t cumulative[LOG_HIST_SIZE], mode, hist_Max;
 	int nentry = 0, sum = 0, half;
-	uint8_t idx, idx_min = UINT8_MAX, idx_Max = 0, idx_mode;
-	uint8_t idx_median = 0;
+	int idx, idx_min = LOG_HIST_SIZE - 1, idx_Max = 0, idx_mode;
+	int idx_median = 0;
 	int8_t dbm;
 	float mean;
 
-	memset(hist, 0, sizeof(hist));
-	TAILQ_FOREACH(kv, &ls->kvh, chain) {
-		TAILQ_FOREACH(v, &kv->vh, chain) {
-			if (v->type != FRAME_TYPE_INET6)
-				continue;
-			if (v->dbm == DBM_INVAL)
-				continue;
-			if (v->filtered)
-				continue;
-			idx = v->dbm - INT8_MIN;
-			hist[idx]++;
-			if (idx_min > idx)
-				idx_min = idx;
-			if (idx_Max < idx)
-				idx_Max = idx;
-			nentry++;
-			sum += v->dbm;
-		}
+	for (idx = 0; idx < LOG_HIST_SIZE; idx++) {
+		if (hist[idx] == 0)
+			continue;
+		if (idx_min > idx)
+			idx_min = idx;
+		if (idx_Max < idx)
+			idx_Max = idx;
+		nentry += hist[idx];
+		sum += hist[idx] * (idx + INT8_MIN);
 	}
 	half = nentry / 2;
 
 	hist_Max = 0;
 	cumulative[0] = hist[0];
-	for (idx = 1; idx < UINT8_MAX; idx++) {
+	for (idx = 1; idx < LOG_HIST_SIZE; idx++) {
 		cumulative[idx] = cumulative[idx - 1] + hist[idx];
 		if (idx_median == 0 && cumulative[idx] > half) {
 			idx_median = idx;
@@ -109,3 +98,23 @@ log_hist(struct log_store *ls)
 	return 0;
 }
 
+int
+log_hist(struct log_store *ls)
+{
+	struct log_columns *col = &ls->col;
+	uint32_t hist[LOG_HIST_SIZE];
+	size_t i;
+
+	memset(hist, 0, sizeof(hist));
+	for (i = 0; i < col->n; i++) {
+		if (col->type[i] != FRAME_TYPE_INET6)
+			continue;
+		if (col->dbm[i] == DBM_INVAL)
+			continue;
+		if (col->filtered[i])
+			continue;
+		hist[(uint8_t)(col->dbm[i] - INT8_MIN)]++;
+	}
+
+	return log_hist_print(hist);
+}
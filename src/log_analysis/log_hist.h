@@ -1,4 +1,9 @@
 #ifndef __LOG_HIST_H__
 #define __LOG_HIST_H__
+#include <stdint.h>
+
+#define LOG_HIST_SIZE (UINT8_MAX + 1) // dbm - INT8_MIN
+
 extern int log_hist(struct log_store *ls);
+extern int log_hist_print(const uint32_t *hist);
 #endif /* __LOG_HIST_H__ */
@@ -19,7 +19,7 @@ dump_message(FILE *fp, struct log_store *ls)
 			if (v->size == 0)
 				continue;
 			fprintf(fp, "%ld.%09ld: ", v->ts.tv_sec, v->ts.tv_nsec);
-			fwrite(v->buf, v->size, 1, fp);
+			fwrite(log_payload(ls, v), v->size, 1, fp);
 			fflush(fp);
 		}
 	}
@@ -5,7 +5,10 @@
 #include <stdbool.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 #include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <assert.h>
 
 #include "../wfb_params.h"
@@ -15,6 +18,10 @@
 
 #include "log_raw.h"
 
+#ifdef ENABLE_ZSTD
+#include <zstd.h>
+#endif
+
 static void
 dump_header(struct rx_log_frame_header *hd)
 {
@@ -32,7 +39,7 @@ dump_header(struct rx_log_frame_header *hd)
 	p_debug("dbm: %d\n", le16toh(hd->dbm));
 }
 
-static struct log_store *
+struct log_store *
 log_store_alloc(void)
 {
 	struct log_store *ls;
@@ -49,50 +56,167 @@ log_store_alloc(void)
 	TAILQ_INIT(&ls->kvh);
 	TAILQ_INIT(&ls->block_kvh);
 	TAILQ_INIT(&ls->msg_kvh);
+	log_arena_init(&ls->arena);
 
 	return ls;
 }
 
-static struct log_data_kv *
-log_kv_alloc(struct log_data_kv_hd *kvh, uint64_t key, enum kv_type_t type)
+static size_t
+log_kv_hash(uint64_t page, size_t n_slots)
 {
-	struct log_data_kv *kv = NULL, *kvp = NULL;
+	// Fibonacci hashing.
+	return (size_t)((page * 0x9e3779b97f4a7c15ULL) >> 32) & (n_slots - 1);
+}
 
-	TAILQ_FOREACH_REVERSE(kv, kvh, log_data_kv_hd, chain) {
-		if (kv->key > key) {
-			kvp = kv;
-			continue;
-		}
+static struct log_kv_page **
+log_kv_page_lookup(struct log_kv_index *kvi, uint64_t page)
+{
+	size_t i;
 
-		if (kv->key == key) {
-			/* use existing kv */
-			break;
-		}
-		/* no key found. create new kv and insert it before the kvp */
-		kv = NULL;
-		break;
+	i = log_kv_hash(page, kvi->n_slots);
+	while (kvi->slot[i] && kvi->slot[i]->page != page)
+		i = (i + 1) & (kvi->n_slots - 1);
+
+	return &kvi->slot[i];
+}
+
+static int
+log_kv_index_grow(struct log_kv_index *kvi)
+{
+	struct log_kv_page **old = kvi->slot;
+	size_t i, n_old = kvi->n_slots;
+
+	kvi->n_slots = n_old ? n_old * 2 : LOG_KV_INDEX_MIN;
+	kvi->slot = (struct log_kv_page **)calloc(kvi->n_slots,
+	    sizeof(*kvi->slot));
+	if (kvi->slot == NULL) {
+		kvi->slot = old;
+		kvi->n_slots = n_old;
+		return -1;
 	}
-	if (!kv || kv->key != key) {
-		kv = (struct log_data_kv *)malloc(sizeof(*kv));
-		if (kv == NULL)
+	for (i = 0; i < n_old; i++) {
+		if (old[i])
+			*log_kv_page_lookup(kvi, old[i]->page) = old[i];
+	}
+	free(old);
+
+	return 0;
+}
+
+static struct log_data_kv **
+log_kv_lookup(struct log_arena *arena, struct log_kv_index *kvi, uint64_t key)
+{
+	struct log_kv_page **slot, *pg;
+	uint64_t page = key / LOG_KV_PAGE_SIZE;
+
+	pg = kvi->last;
+	if (pg == NULL || pg->page != page) {
+		if (kvi->n_pages * 2 >= kvi->n_slots &&
+		    log_kv_index_grow(kvi) < 0)
 			return NULL;
-		memset(kv, 0, sizeof(*kv));
-		kv->key = key;
-		kv->type = type;
-		kv->has_ethernet_frame = false;
-		TAILQ_INIT(&kv->vh);
-
-		if (kvp) {
-			TAILQ_INSERT_BEFORE(kvp, kv, chain);
-		}
-		else {
-			TAILQ_INSERT_TAIL(kvh, kv, chain);
+
+		slot = log_kv_page_lookup(kvi, page);
+		if (*slot == NULL) {
+			*slot = (struct log_kv_page *)log_arena_zalloc(arena,
+			    sizeof(**slot));
+			if (*slot == NULL)
+				return NULL;
+			(*slot)->page = page;
+			kvi->n_pages++;
 		}
+		pg = kvi->last = *slot;
 	}
 
-	return kv;
+	return &pg->kv[key % LOG_KV_PAGE_SIZE];
 }
 
+static void
+log_kv_index_free(struct log_kv_index *kvi)
+{
+	// pages are in the arena.
+	free(kvi->slot);
+	memset(kvi, 0, sizeof(*kvi));
+}
+
+static int
+log_kv_cmp(const void *a, const void *b)
+{
+	const struct log_data_kv *ka = *(struct log_data_kv * const *)a;
+	const struct log_data_kv *kb = *(struct log_data_kv * const *)b;
+
+	if (ka->key < kb->key)
+		return -1;
+	if (ka->key > kb->key)
+		return 1;
+	return 0;
+}
+
+static int
+log_kv_sort(struct log_data_kv_hd *kvh, struct log_kv_index *kvi)
+{
+	struct log_data_kv **kva, *kv;
+	size_t i = 0;
+
+	if (!kvi->unsorted)
+		return 0;
+
+	kva = (struct log_data_kv **)malloc(kvi->n_keys * sizeof(*kva));
+	if (kva == NULL)
+		return -1;
+	TAILQ_FOREACH(kv, kvh, chain)
+		kva[i++] = kv;
+	assert(i == kvi->n_keys);
+	qsort(kva, kvi->n_keys, sizeof(*kva), log_kv_cmp);
+
+	TAILQ_INIT(kvh);
+	for (i = 0; i < kvi->n_keys; i++)
+		TAILQ_INSERT_TAIL(kvh, kva[i], chain);
+	free(kva);
+	kvi->unsorted = false;
+
+	return 0;
+}
+
+static void
+log_store_sort(struct log_store *ls)
+{
+	if (log_kv_sort(&ls->kvh, &ls->kvi) < 0 ||
+	    log_kv_sort(&ls->block_kvh, &ls->block_kvi) < 0 ||
+	    log_kv_sort(&ls->msg_kvh, &ls->msg_kvi) < 0)
+		p_err("Cannot sort the log. out of memory.\n");
+}
+
+static struct log_data_kv *
+log_kv_alloc(struct log_arena *arena, struct log_data_kv_hd *kvh,
+    struct log_kv_index *kvi, uint64_t key, enum kv_type_t type)
+{
+	struct log_data_kv *kv, *last, **slot;
+
+	slot = log_kv_lookup(arena, kvi, key);
+	if (slot == NULL)
+		return NULL;
+	if (*slot) {
+		/* use existing kv */
+		return *slot;
+	}
+
+	kv = (struct log_data_kv *)log_arena_zalloc(arena, sizeof(*kv));
+	if (kv == NULL)
+		return NULL;
+	kv->key = key;
+	kv->type = type;
+	kv->has_ethernet_frame = false;
+	TAILQ_INIT(&kv->vh);
+
+	last = TAILQ_LAST(kvh, log_data_kv_hd);
+	if (last && last->key > key)
+		kvi->unsorted = true;
+	TAILQ_INSERT_TAIL(kvh, kv, chain);
+	*slot = kv;
+	kvi->n_keys++;
+
+	return kv;
+}
 
 static struct log_data_v *
 log_v_alloc(struct log_store *ls, struct rx_log_frame_header *hd)
@@ -104,8 +228,8 @@ log_v_alloc(struct log_store *ls, struct rx_log_frame_header *hd)
 		case FRAME_TYPE_MSG_INFO:
 		case FRAME_TYPE_MSG_ERR:
 		case FRAME_TYPE_MSG_DEBUG:
-			msg_kv = log_kv_alloc(&ls->msg_kvh,
-			   hd->seq, KV_TYPE_MSG);
+			msg_kv = log_kv_alloc(&ls->arena, &ls->msg_kvh,
+			    &ls->msg_kvi, hd->seq, KV_TYPE_MSG);
 			if (msg_kv == NULL)
 				return NULL;
 			break;
@@ -115,11 +239,12 @@ log_v_alloc(struct log_store *ls, struct rx_log_frame_header *hd)
 			/* fallthrough */
 		case FRAME_TYPE_CORRUPT:
 			/* fallthrough */
-			kv = log_kv_alloc(&ls->kvh, hd->seq, KV_TYPE_SEQ);
+			kv = log_kv_alloc(&ls->arena, &ls->kvh,
+			    &ls->kvi, hd->seq, KV_TYPE_SEQ);
 			if (kv == NULL)
 				return NULL;
-			block_kv = log_kv_alloc(&ls->block_kvh,
-			    hd->block_idx, KV_TYPE_BLK);
+			block_kv = log_kv_alloc(&ls->arena, &ls->block_kvh,
+			    &ls->block_kvi, hd->block_idx, KV_TYPE_BLK);
 			if (block_kv == NULL)
 				return NULL;
 			break;
@@ -129,10 +254,9 @@ log_v_alloc(struct log_store *ls, struct rx_log_frame_header *hd)
 		
 	}
 
-	v = (struct log_data_v *)malloc(sizeof(*v));
+	v = (struct log_data_v *)log_arena_zalloc(&ls->arena, sizeof(*v));
 	if (v == NULL)
 		return NULL;
-	memset(v, 0, sizeof(*v));
 
 	if (kv) {
 		v->kv = kv;
@@ -200,7 +324,8 @@ mark_h265(struct log_store *ls, struct log_data_v *v)
 }
 
 static int
-process_payload(FILE *fp, struct log_data_v *v, ssize_t size)
+process_payload(FILE *fp, struct log_store *ls, struct log_data_v *v,
+    ssize_t size)
 {
 	assert(fp);
 	assert(size >= 0 && size < WIFI_MTU);
@@ -212,13 +337,12 @@ process_payload(FILE *fp, struct log_data_v *v, ssize_t size)
 		return 0;
 	}
 
-	v->buf = malloc(size);
+	v->buf = log_arena_alloc(&ls->arena, size);
 	if (v->buf == NULL)
 		return -1;
 
 	if (fread(v->buf, size, 1, fp) <= 0) {
-		free(v->buf);
-		v->buf = NULL;
+		v->buf = NULL; // left in the arena.
 		v->size = 0;
 		if (feof(fp)) {
 			p_debug("End of File\n");
@@ -235,8 +359,8 @@ process_payload(FILE *fp, struct log_data_v *v, ssize_t size)
 	return 0;
 }
 
-static ssize_t
-process_file_header(FILE *fp, struct log_store *ls)
+ssize_t
+log_read_file_header(FILE *fp, struct log_store *ls)
 {
 	struct rx_log_file_header hd;
 
@@ -258,10 +382,12 @@ process_file_header(FILE *fp, struct log_store *ls)
 		p_err("Invalid file signature.\n");
 		return -1;
 	}
-	if (hd.version != RX_LOG_VERSION) {
+	if (hd.version != RX_LOG_VERSION &&
+	    hd.version != RX_LOG_VERSION_CHUNKED) {
 		p_err("Unknown Log version.\n");
 		return -1;
 	}
+	ls->version = hd.version;
 	ls->channel_id = le32toh(hd.channel_id);
 	ls->fec_type = hd.fec_type;
 	ls->fec_k = hd.fec_k;
@@ -270,114 +396,755 @@ process_file_header(FILE *fp, struct log_store *ls)
 	return sizeof(hd);
 }
 
-static ssize_t
-process_frame_header(FILE *fp, struct log_store *ls)
+static int
+attach_payload(FILE *fp, struct log_store *ls, struct log_data_v *v,
+    struct rx_log_frame_header *hd, uint64_t off)
 {
-	struct rx_log_frame_header hd;
-	struct log_data_v *v;
-	struct timespec ts;
+	if (fp)
+		return process_payload(fp, ls, v, hd->size);
 
-	assert(fp);
+	// the payload stays in the file. pages are read by log_payload().
+	v->mapped = true;
+	v->offset = off;
+	return 0;
+}
 
-	if (fread(&hd, sizeof(hd), 1, fp) <= 0) {
-		if (feof(fp)) {
-			p_debug("End of File\n");
-			return -1;
-		}
-		else if (ferror(fp)) {
-			p_err("%s\n", strerror(errno));
-			return -1;
-		}
-		p_err("Unknown I/O failure.\n");
-		return -1;
-	}
-	dump_header(&hd);
-	ts.tv_sec = (time_t)(le64toh(hd.tv_sec));
-	ts.tv_nsec = (long)(le64toh(hd.tv_nsec));
+void
+log_v_fill(struct log_store *ls, struct log_data_v *v,
+    const struct rx_log_frame_header *hd)
+{
+	struct timespec ts;
+
+	ts.tv_sec = (time_t)(le64toh(hd->tv_sec));
+	ts.tv_nsec = (long)(le64toh(hd->tv_nsec));
 	if (ls->epoch.tv_sec == 0) {
 		ls->epoch = ts;
 	}
 	timespecsub(&ts, &ls->epoch, &ts);
 
-	v = log_v_alloc(ls, &hd);
-	if (v == NULL)
-		return -1;
-
-	v->size = hd.size;
+	v->size = hd->size;
 
 	if (v->ts.tv_sec == 0 && v->ts.tv_nsec == 0)
 		v->ts = ts;
-	v->block_idx = hd.block_idx;
-	v->fragment_idx = hd.fragment_idx;
+	v->block_idx = hd->block_idx;
+	v->fragment_idx = hd->fragment_idx;
 	if (v->fragment_idx >= ls->fec_k) {
 		v->is_parity = true;
 	}
 	else {
 		v->is_parity = false;
 	}
-	v->freq = hd.freq;
-	v->dbm = hd.dbm;
-	v->type = hd.type;
+	v->freq = hd->freq;
+	v->dbm = hd->dbm;
+	v->type = hd->type;
 
-	switch (hd.type) {
+	switch (hd->type) {
 	case FRAME_TYPE_CORRUPT:
-		v->rx_src.sin6_family = AF_INET6;
-		v->rx_src.sin6_port = 0;
 		v->corrupt = true;
-		memcpy(&v->rx_src.sin6_addr, hd.rx_src,
-		    sizeof(v->rx_src.sin6_addr));
-
-		mark_corrupt(ls, v);
-		break;
+		/* fallthrough */
 	case FRAME_TYPE_INET6:
 		v->rx_src.sin6_family = AF_INET6;
 		v->rx_src.sin6_port = 0;
-		memcpy(&v->rx_src.sin6_addr, hd.rx_src,
+		memcpy(&v->rx_src.sin6_addr, hd->rx_src,
 		    sizeof(v->rx_src.sin6_addr));
+		break;
+	default:
+		break;
+	}
+}
 
+void
+log_store_account(struct log_store *ls, const struct rx_log_frame_header *hd)
+{
+	switch (hd->type) {
+	case FRAME_TYPE_INET6:
 		ls->n_pkts++;
-		if (hd.dbm != DBM_INVAL) {
+		if (hd->dbm != DBM_INVAL) {
 			ls->n_pkts_with_dbm++;
-			if (ls->max_dbm < hd.dbm)
-				ls->max_dbm = hd.dbm;
-			if (ls->min_dbm > hd.dbm)
-				ls->min_dbm = hd.dbm;
+			if (ls->max_dbm < hd->dbm)
+				ls->max_dbm = hd->dbm;
+			if (ls->min_dbm > hd->dbm)
+				ls->min_dbm = hd->dbm;
 		}
-
-		mark_inet6(ls, v);
 		break;
 	case FRAME_TYPE_DECODE:
-		if (process_payload(fp, v, hd.size) < 0)
+		ls->n_frames++;
+		if (ls->max_frame_size < hd->size)
+			ls->max_frame_size = hd->size;
+		if (ls->min_frame_size > hd->size)
+			ls->min_frame_size = hd->size;
+		ls->total_bytes += hd->size;
+		break;
+	default:
+		break;
+	}
+}
+
+static uint64_t
+log_header_ts(const struct rx_log_frame_header *hd)
+{
+	return le64toh(hd->tv_sec) * 1000000000 + le64toh(hd->tv_nsec);
+}
+
+static uint64_t
+log_epoch_ts(struct log_store *ls)
+{
+	return (uint64_t)ls->epoch.tv_sec * 1000000000 + ls->epoch.tv_nsec;
+}
+
+static bool
+log_range_match(struct log_store *ls, const struct rx_log_frame_header *hd)
+{
+	const struct log_range *r = &ls->range;
+	uint64_t key;
+
+	if (r->type == LOG_RANGE_NONE)
+		return true;
+
+	// the first record is the origin of time, even if not in the range.
+	if (ls->epoch.tv_sec == 0) {
+		ls->epoch.tv_sec = (time_t)le64toh(hd->tv_sec);
+		ls->epoch.tv_nsec = (long)le64toh(hd->tv_nsec);
+	}
+
+	switch (r->type) {
+	case LOG_RANGE_SEQ:
+	case LOG_RANGE_BLOCK:
+		if (hd->type != FRAME_TYPE_INET6 &&
+		    hd->type != FRAME_TYPE_DECODE)
+			return false;
+		key = (r->type == LOG_RANGE_SEQ) ?
+		    le64toh(hd->seq) : le64toh(hd->block_idx);
+		break;
+	case LOG_RANGE_TIME:
+		key = log_header_ts(hd);
+		if (key < log_epoch_ts(ls))
+			return r->min == 0;
+		key -= log_epoch_ts(ls);
+		break;
+	default:
+		return true;
+	}
+
+	return key >= r->min && key <= r->max;
+}
+
+static int
+skip_payload(FILE *fp, size_t size)
+{
+	uint8_t buf[WIFI_MTU];
+
+	assert(fp);
+
+	if (size == 0)
+		return 0;
+	if (size >= sizeof(buf) || fread(buf, size, 1, fp) <= 0) {
+		p_debug("Truncated record.\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * fp != NULL: the payload follows in fp and is copied.
+ * fp == NULL: the payload is at off of the mapped file.
+ */
+static ssize_t
+process_record(FILE *fp, struct log_store *ls,
+    struct rx_log_frame_header *phd, uint64_t off)
+{
+	struct rx_log_frame_header hd = *phd;
+	struct log_data_v *v;
+
+	if (!log_range_match(ls, &hd)) {
+		if (fp && skip_payload(fp, rx_log_payload_size(&hd)) < 0)
 			return -1;
+		return hd.size;
+	}
 
-		ls->n_frames++;
-		if (ls->max_frame_size < hd.size)
-			ls->max_frame_size = hd.size;
-		if (ls->min_frame_size > hd.size)
-			ls->min_frame_size = hd.size;
-		ls->total_bytes += hd.size;
+	dump_header(&hd);
 
+	v = log_v_alloc(ls, &hd);
+	if (v == NULL)
+		return -1;
+	log_v_fill(ls, v, &hd);
+
+	switch (hd.type) {
+	case FRAME_TYPE_CORRUPT:
+		mark_corrupt(ls, v);
+		break;
+	case FRAME_TYPE_INET6:
+		mark_inet6(ls, v);
+		break;
+	case FRAME_TYPE_DECODE:
+		if (attach_payload(fp, ls, v, &hd, off) < 0)
+			return -1;
 		mark_h265(ls, v);
 		break;
 	case FRAME_TYPE_MSG_INFO:
 	case FRAME_TYPE_MSG_ERR:
 	case FRAME_TYPE_MSG_DEBUG:
-		if (process_payload(fp, v, hd.size) < 0)
+		if (attach_payload(fp, ls, v, &hd, off) < 0)
 			return -1;
 		break;
 	default:
 		p_err("Unknown frame type %d.\n", hd.type);
 		break;
 	}
+	log_store_account(ls, &hd);
 
 	return hd.size;
 }
 
+static ssize_t
+process_frame_header(FILE *fp, struct log_store *ls)
+{
+	struct rx_log_frame_header hd;
+
+	assert(fp);
+
+	if (fread(&hd, sizeof(hd), 1, fp) <= 0) {
+		if (feof(fp)) {
+			p_debug("End of File\n");
+			return -1;
+		}
+		else if (ferror(fp)) {
+			p_err("%s\n", strerror(errno));
+			return -1;
+		}
+		p_err("Unknown I/O failure.\n");
+		return -1;
+	}
+
+	return process_record(fp, ls, &hd, 0);
+}
+
+void *
+log_decompress_chunk(struct rx_log_chunk_header *hd, void *data)
+{
+	uint32_t raw_size = le32toh(hd->raw_size);
+
+	switch (hd->codec) {
+	case RX_LOG_CODEC_NONE:
+		if (le32toh(hd->size) != raw_size) {
+			p_err("Broken chunk.\n");
+			return NULL;
+		}
+		return data;
+#ifdef ENABLE_ZSTD
+	case RX_LOG_CODEC_ZSTD:
+	{
+		void *raw;
+		size_t r;
+
+		raw = malloc(raw_size);
+		if (raw == NULL)
+			return NULL;
+		r = ZSTD_decompress(raw, raw_size, data, le32toh(hd->size));
+		if (ZSTD_isError(r) || r != raw_size) {
+			p_err("Broken chunk.\n");
+			free(raw);
+			return NULL;
+		}
+		free(data);
+		return raw;
+	}
+#endif
+	default:
+		break;
+	}
+	p_err("Unsupported codec %u.\n", hd->codec);
+
+	return NULL;
+}
+
+static int
+process_raw_chunk(struct log_store *ls, struct rx_log_chunk_header *hd,
+    void *raw)
+{
+	FILE *mfp;
+
+	ls->n_chunks++;
+
+	// records are the same as version 1.
+	mfp = fmemopen(raw, le32toh(hd->raw_size), "r");
+	if (mfp == NULL) {
+		p_err("fmemopen() failed: %s\n", strerror(errno));
+		free(raw);
+		return -1;
+	}
+	while (process_frame_header(mfp, ls) >= 0)
+		;
+	fclose(mfp);
+	free(raw);
+
+	return 0;
+}
+
+static int
+process_chunk(FILE *fp, struct log_store *ls)
+{
+	struct rx_log_chunk_header hd;
+	void *data, *raw;
+
+	assert(fp);
+
+	if (fread(&hd, sizeof(hd), 1, fp) <= 0) {
+		if (feof(fp)) {
+			p_debug("End of File\n");
+			return -1;
+		}
+		p_err("%s\n", strerror(errno));
+		return -1;
+	}
+	switch (le32toh(hd.signature)) {
+	case RX_LOG_CHUNK_SIGNATURE:
+		break;
+	case RX_LOG_INDEX_SIGNATURE:
+		p_debug("Index found.\n");
+		return -1;
+	default:
+		p_err("Invalid chunk signature.\n");
+		return -1;
+	}
+	if (hd.size == 0 || hd.raw_size == 0)
+		return 0;
+
+	data = malloc(le32toh(hd.size));
+	if (data == NULL)
+		return -1;
+	if (fread(data, le32toh(hd.size), 1, fp) <= 0) {
+		p_debug("Truncated chunk.\n");
+		free(data);
+		return -1;
+	}
+	raw = log_decompress_chunk(&hd, data);
+	if (raw == NULL) {
+		free(data);
+		return -1;
+	}
+
+	return process_raw_chunk(ls, &hd, raw);
+}
+
+static uint16_t
+log_columns_src(struct log_columns *col, const struct sockaddr_in6 *sa)
+{
+	struct in6_addr *table;
+	size_t i;
+
+	if (sa->sin6_family != AF_INET6)
+		return LOG_SRC_NONE;
+
+	// a few nodes at most. the last one is likely to match.
+	for (i = col->n_src; i > 0; i--) {
+		if (memcmp(&col->src_table[i - 1], &sa->sin6_addr,
+		    sizeof(sa->sin6_addr)) == 0)
+			return i - 1;
+	}
+	if (col->n_src >= LOG_SRC_NONE)
+		return LOG_SRC_NONE;
+
+	table = (struct in6_addr *)realloc(col->src_table,
+	    (col->n_src + 1) * sizeof(*table));
+	if (table == NULL)
+		return LOG_SRC_NONE;
+	table[col->n_src] = sa->sin6_addr;
+	col->src_table = table;
+
+	return col->n_src++;
+}
+
+static void
+log_columns_free(struct log_columns *col)
+{
+	free(col->ts);
+	free(col->seq);
+	free(col->block_idx);
+	free(col->fragment_idx);
+	free(col->type);
+	free(col->size);
+	free(col->dbm);
+	free(col->freq);
+	free(col->src);
+	free(col->filtered);
+	free(col->src_table);
+	memset(col, 0, sizeof(*col));
+}
+
+static int
+log_columns_build(struct log_store *ls)
+{
+	struct log_columns *col = &ls->col;
+	struct log_data_kv *kv;
+	struct log_data_v *v;
+	size_t n = 0, i = 0;
+
+	log_columns_free(col);
+
+	TAILQ_FOREACH(kv, &ls->kvh, chain) {
+		TAILQ_FOREACH(v, &kv->vh, chain)
+			n++;
+	}
+	if (n == 0)
+		return 0;
+
+	col->ts = (int64_t *)malloc(n * sizeof(*col->ts));
+	col->seq = (uint64_t *)malloc(n * sizeof(*col->seq));
+	col->block_idx = (uint64_t *)malloc(n * sizeof(*col->block_idx));
+	col->fragment_idx = (uint8_t *)malloc(n * sizeof(*col->fragment_idx));
+	col->type = (uint8_t *)malloc(n * sizeof(*col->type));
+	col->size = (uint32_t *)malloc(n * sizeof(*col->size));
+	col->dbm = (int16_t *)malloc(n * sizeof(*col->dbm));
+	col->freq = (uint16_t *)malloc(n * sizeof(*col->freq));
+	col->src = (uint16_t *)malloc(n * sizeof(*col->src));
+	col->filtered = (bool *)calloc(n, sizeof(*col->filtered));
+	if (!col->ts || !col->seq || !col->block_idx || !col->fragment_idx ||
+	    !col->type || !col->size || !col->dbm || !col->freq ||
+	    !col->src || !col->filtered) {
+		log_columns_free(col);
+		return -1;
+	}
+
+	TAILQ_FOREACH(kv, &ls->kvh, chain) {
+		TAILQ_FOREACH(v, &kv->vh, chain) {
+			v->row = i;
+			col->ts[i] = (int64_t)v->ts.tv_sec * 1000000000 +
+			    v->ts.tv_nsec;
+			col->seq[i] = kv->key;
+			col->block_idx[i] = v->block_idx;
+			col->fragment_idx[i] = v->fragment_idx;
+			col->type[i] = v->type;
+			col->size[i] = v->size;
+			col->dbm[i] = v->dbm;
+			col->freq[i] = v->freq;
+			col->src[i] = log_columns_src(col, &v->rx_src);
+			i++;
+		}
+	}
+	col->n = n;
+
+	return 0;
+}
+
+static int
+process_mapped_records(struct log_store *ls, uint64_t off, uint64_t end)
+{
+	const uint8_t *base = ls->map;
+	struct rx_log_frame_header hd;
+	uint32_t size;
+
+	while (end - off >= sizeof(hd)) {
+		memcpy(&hd, base + off, sizeof(hd));
+		off += sizeof(hd);
+		size = rx_log_payload_size(&hd);
+		if (size >= WIFI_MTU || end - off < size) {
+			p_debug("Truncated record.\n");
+			return -1;
+		}
+		if (process_record(NULL, ls, &hd, off) < 0)
+			return -1;
+		off += size;
+	}
+	if (end != off)
+		p_debug("Truncated record.\n");
+
+	return 0;
+}
+
+/*
+ * returns the offset of the next chunk, 0 at the index, or -1 if the
+ * chunk is broken.
+ */
+static int64_t
+process_mapped_chunk(struct log_store *ls, uint64_t off)
+{
+	const uint8_t *base = ls->map;
+	struct rx_log_chunk_header hd;
+	uint32_t size;
+	void *data, *raw;
+
+	if (ls->map_size - off < sizeof(hd)) {
+		p_debug("Truncated chunk.\n");
+		return -1;
+	}
+	memcpy(&hd, base + off, sizeof(hd));
+	off += sizeof(hd);
+	switch (le32toh(hd.signature)) {
+	case RX_LOG_CHUNK_SIGNATURE:
+		break;
+	case RX_LOG_INDEX_SIGNATURE:
+		p_debug("Index found.\n");
+		return 0;
+	default:
+		p_err("Invalid chunk signature.\n");
+		return -1;
+	}
+	size = le32toh(hd.size);
+	if (ls->map_size - off < size) {
+		p_debug("Truncated chunk.\n");
+		return -1;
+	}
+	if (size == 0 || hd.raw_size == 0)
+		return off + size;
+
+	if (hd.codec == RX_LOG_CODEC_NONE) {
+		if (size != le32toh(hd.raw_size)) {
+			p_err("Broken chunk.\n");
+			return -1;
+		}
+		// records are the same as version 1.
+		ls->n_chunks++;
+		(void)process_mapped_records(ls, off, off + size);
+	}
+	else {
+		// payloads are copied from the decompressed chunk.
+		data = malloc(size);
+		if (data == NULL)
+			return -1;
+		memcpy(data, base + off, size);
+		raw = log_decompress_chunk(&hd, data);
+		if (raw == NULL) {
+			free(data);
+			return -1;
+		}
+		if (process_raw_chunk(ls, &hd, raw) < 0)
+			return -1;
+	}
+
+	return off + size;
+}
+
+static int
+process_mapped_chunks(struct log_store *ls, uint64_t off)
+{
+	int64_t next;
+
+	while (ls->map_size - off >= sizeof(struct rx_log_chunk_header)) {
+		next = process_mapped_chunk(ls, off);
+		if (next <= 0)
+			return next;
+		off = next;
+	}
+
+	return 0;
+}
+
+/*
+ * the index is found by the trailer at the end of the file. it is
+ * checked against the file before use, and NULL is returned if the log
+ * has no index(e.g. the listener was killed) or the index is broken.
+ */
+static const uint8_t *
+log_index_map(struct log_store *ls, uint64_t pos, uint32_t *n_chunks)
+{
+	const uint8_t *base = ls->map;
+	struct rx_log_index_trailer tr;
+	struct rx_log_index_header hd;
+	struct rx_log_index_entry ent;
+	struct rx_log_chunk_header chd;
+	uint64_t idx_off, off, prev;
+	uint32_t n, i;
+
+	if (ls->map_size < pos + sizeof(hd) + sizeof(tr))
+		return NULL;
+	memcpy(&tr, base + ls->map_size - sizeof(tr), sizeof(tr));
+	if (le32toh(tr.signature) != RX_LOG_INDEX_SIGNATURE) {
+		p_debug("No index.\n");
+		return NULL;
+	}
+
+	idx_off = le64toh(tr.offset);
+	n = le32toh(tr.n_chunks);
+	if (idx_off < pos ||
+	    idx_off > ls->map_size - sizeof(tr) - sizeof(hd) ||
+	    (ls->map_size - sizeof(tr) - sizeof(hd) - idx_off) !=
+	    (uint64_t)n * sizeof(ent))
+		goto err;
+	memcpy(&hd, base + idx_off, sizeof(hd));
+	if (le32toh(hd.signature) != RX_LOG_INDEX_SIGNATURE ||
+	    le32toh(hd.n_chunks) != n)
+		goto err;
+
+	prev = pos;
+	for (i = 0; i < n; i++) {
+		memcpy(&ent, base + idx_off + sizeof(hd) + sizeof(ent) * i,
+		    sizeof(ent));
+		off = le64toh(ent.offset);
+		if (off < prev || off > idx_off - sizeof(chd))
+			goto err;
+		memcpy(&chd, base + off, sizeof(chd));
+		if (le32toh(chd.signature) != RX_LOG_CHUNK_SIGNATURE ||
+		    le32toh(chd.size) > idx_off - off - sizeof(chd) ||
+		    le64toh(ent.min_seq) > le64toh(ent.max_seq) ||
+		    le64toh(ent.min_block) > le64toh(ent.max_block) ||
+		    le64toh(ent.min_ts) > le64toh(ent.max_ts))
+			goto err;
+		prev = off + sizeof(chd) + le32toh(chd.size);
+	}
+	if (prev != idx_off)
+		goto err;
+
+	*n_chunks = n;
+	return base + idx_off + sizeof(hd);
+
+err:
+	p_err("Broken index. the log is read in order.\n");
+	return NULL;
+}
+
+static bool
+log_index_match(struct log_store *ls, const struct rx_log_index_entry *ent)
+{
+	const struct log_range *r = &ls->range;
+	uint64_t min, max, epoch;
+
+	if (le32toh(ent->n_records) == 0)
+		return false;
+
+	switch (r->type) {
+	case LOG_RANGE_SEQ:
+		min = le64toh(ent->min_seq);
+		max = le64toh(ent->max_seq);
+		break;
+	case LOG_RANGE_BLOCK:
+		min = le64toh(ent->min_block);
+		max = le64toh(ent->max_block);
+		break;
+	case LOG_RANGE_TIME:
+		epoch = log_epoch_ts(ls);
+		min = le64toh(ent->min_ts);
+		max = le64toh(ent->max_ts);
+		min = (min > epoch) ? min - epoch : 0;
+		max = (max > epoch) ? max - epoch : 0;
+		break;
+	default:
+		return true;
+	}
+
+	return max >= r->min && min <= r->max;
+}
+
+/*
+ * only the chunks which overlap the range are read. the first chunk
+ * gives the origin of time.
+ */
+static int
+process_indexed_chunks(struct log_store *ls, const uint8_t *index,
+    uint32_t n_chunks)
+{
+	struct rx_log_index_entry ent;
+	uint64_t ts;
+	uint32_t i;
+
+	if (n_chunks > 0 && ls->range.type != LOG_RANGE_NONE) {
+		memcpy(&ent, index, sizeof(ent));
+		ts = le64toh(ent.min_ts);
+		ls->epoch.tv_sec = ts / 1000000000;
+		ls->epoch.tv_nsec = ts % 1000000000;
+	}
+
+	for (i = 0; i < n_chunks; i++) {
+		memcpy(&ent, index + sizeof(ent) * i, sizeof(ent));
+		if (!log_index_match(ls, &ent))
+			continue;
+		if (process_mapped_chunk(ls, le64toh(ent.offset)) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int
+map_log(FILE *fp, struct log_store *ls)
+{
+	struct stat st;
+	void *map;
+
+	if (fstat(fileno(fp), &st) < 0)
+		return -1;
+	if (!S_ISREG(st.st_mode) || st.st_size == 0)
+		return -1; // pipe, tty, etc.
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+	if (map == MAP_FAILED) {
+		p_debug("mmap() failed: %s\n", strerror(errno));
+		return -1;
+	}
+	ls->map = map;
+	ls->map_size = st.st_size;
+
+	return 0;
+}
+
+int
+log_range_parse(const char *s, struct log_range *range)
+{
+	const char *p;
+	char *endptr;
+	double min, max;
+
+	assert(s);
+	assert(range);
+
+	p = strchr(s, ':');
+	if (p == NULL)
+		return -1;
+	if (p - s == 3 && strncasecmp(s, "seq", 3) == 0)
+		range->type = LOG_RANGE_SEQ;
+	else if (p - s == 5 && strncasecmp(s, "block", 5) == 0)
+		range->type = LOG_RANGE_BLOCK;
+	else if (p - s == 4 && strncasecmp(s, "time", 4) == 0)
+		range->type = LOG_RANGE_TIME;
+	else
+		return -1;
+
+	// <min>-<max>. either can be omitted.
+	p++;
+	min = 0;
+	max = -1;
+	if (*p != '-') {
+		min = strtod(p, &endptr);
+		if (endptr == p || min < 0)
+			return -1;
+		p = endptr;
+	}
+	if (*p != '-')
+		return -1;
+	p++;
+	if (*p != '\0') {
+		max = strtod(p, &endptr);
+		if (endptr == p || *endptr != '\0' || max < min)
+			return -1;
+	}
+
+	if (range->type == LOG_RANGE_TIME) {
+		// [s] to [ns]
+		min *= 1000000000;
+		max *= 1000000000;
+	}
+	range->min = (uint64_t)min;
+	range->max = (max < 0 || max >= (double)UINT64_MAX) ?
+	    UINT64_MAX : (uint64_t)max;
+
+	return 0;
+}
+
 struct log_store *
 load_log(FILE *fp)
+{
+	return load_log_range(fp, NULL);
+}
+
+struct log_store *
+load_log_range(FILE *fp, const struct log_range *range)
 {
 	struct log_store *ls;
+	const uint8_t *index;
+	uint32_t n_chunks;
 	ssize_t size;
+	off_t pos;
 
 	if (fp == NULL)
 		fp = stdin;
@@ -385,62 +1152,53 @@ load_log(FILE *fp)
 	ls = log_store_alloc();
 	if (ls == NULL)
 		return NULL;
+	if (range)
+		ls->range = *range;
 
 
-	if (process_file_header(fp, ls) < 0) {
+	if (log_read_file_header(fp, ls) < 0) {
 		free(ls);
 		return NULL;
 	}
 
-	for (;;) {
-		size = process_frame_header(fp, ls);
-		if (size < 0)
-			break;
+	pos = ftello(fp);
+	if (pos > 0 && map_log(fp, ls) == 0) {
+		/*
+		 * headers are read from the mapped file and payloads are
+		 * left in it. only the pages of headers are touched here.
+		 */
+		(void)madvise(ls->map, ls->map_size, MADV_SEQUENTIAL);
+		index = NULL;
+		if (ls->version == RX_LOG_VERSION_CHUNKED)
+			index = log_index_map(ls, pos, &n_chunks);
+		if (index)
+			(void)process_indexed_chunks(ls, index, n_chunks);
+		else if (ls->version == RX_LOG_VERSION_CHUNKED)
+			(void)process_mapped_chunks(ls, pos);
+		else
+			(void)process_mapped_records(ls, pos, ls->map_size);
+		(void)madvise(ls->map, ls->map_size, MADV_NORMAL);
 	}
-
-	return ls;
-}
-
-static void
-free_kvh(struct log_data_kv_hd *kvh)
-{
-	struct log_data_kv *kv, *kvp;
-	struct log_data_v *v, *vp;
-
-	assert(kvh);
-
-	TAILQ_FOREACH_SAFE(kv, kvh, chain, kvp) {
-		p_debug("Delete KV\n");
-		TAILQ_FOREACH_SAFE(v, &kv->vh, chain, vp) {
-			p_debug("Delete V\n");
-			switch (kv->type) {
-				case KV_TYPE_SEQ:
-					p_debug("Delete SEQ\n");
-					TAILQ_REMOVE(&kv->vh, v, chain);
-					v->kv = NULL;
-					break;
-				case KV_TYPE_BLK:
-					p_debug("Delete BLK\n");
-					TAILQ_REMOVE(&kv->vh, v, block_chain);
-					v->block_kv = NULL;
-					break;
-				case KV_TYPE_MSG:
-					p_debug("Delete MSG\n");
-					TAILQ_REMOVE(&kv->vh, v, msg_chain);
-					v->msg_kv = NULL;
-					break;
-				default:
-					break;
-			}
-			if (!v->kv && !v->block_kv && !v->msg_kv) {
-				if (v->buf)
-					free(v->buf);
-				free(v);
-			}
+	else if (ls->version == RX_LOG_VERSION_CHUNKED) {
+		// not seekable. read chunks in order.
+		while (process_chunk(fp, ls) == 0)
+			;
+	}
+	else {
+		for (;;) {
+			size = process_frame_header(fp, ls);
+			if (size < 0)
+				break;
 		}
-		TAILQ_REMOVE(kvh, kv, chain);
-		free(kv);
 	}
+	log_store_sort(ls);
+	if (log_columns_build(ls) < 0) {
+		p_err("Cannot build columns. out of memory.\n");
+		free_log(ls);
+		return NULL;
+	}
+
+	return ls;
 }
 
 void
@@ -449,8 +1207,25 @@ free_log(struct log_store *ls)
 	if (!ls)
 		return;
 
-	free_kvh(&ls->kvh);
-	free_kvh(&ls->block_kvh);
-	free_kvh(&ls->msg_kvh);
+	// kvs, vs and copied payloads are in the arena.
+	log_arena_free(&ls->arena);
+	log_columns_free(&ls->col);
+	log_kv_index_free(&ls->kvi);
+	log_kv_index_free(&ls->block_kvi);
+	log_kv_index_free(&ls->msg_kvi);
+	if (ls->map)
+		munmap(ls->map, ls->map_size);
 	free(ls);
 }
+
+const void *
+log_payload(struct log_store *ls, struct log_data_v *v)
+{
+	assert(ls);
+	assert(v);
+
+	if (v->mapped)
+		return (const uint8_t *)ls->map + v->offset;
+
+	return v->buf;
+}
@@ -1,10 +1,14 @@
 #ifndef __LOG_RAW_H__
 #define __LOG_RAW_H__
+#include <stdio.h>
 #include <stdbool.h>
+#include <sys/types.h>
 #include <netinet/in.h>
 #include <sys/time.h>
 #include <sys/queue.h>
 
+#include "log_arena.h"
+
 enum kv_type_t {
 	KV_TYPE_INVAL,
 	KV_TYPE_SEQ,
@@ -42,8 +46,10 @@ struct log_data_v {
 	int16_t dbm;
 	bool corrupt;
 	bool is_parity;
-	void *buf;
-	bool filtered;
+	void *buf; // copy of the payload, or NULL if mapped.
+	bool mapped;
+	uint64_t offset; // of the payload in the mapped file.
+	uint32_t row; // in log_columns. only for the vs in kvh.
 
 	struct log_data_kv *kv;
 	TAILQ_ENTRY(log_data_v) chain;
@@ -55,7 +61,78 @@ struct log_data_v {
 	TAILQ_ENTRY(log_data_v) msg_chain;
 };
 
+/*
+ * key to kv lookup. keys are dense, so kvs are kept in pages of direct
+ * arrays indexed by the key. pages are found by open addressing with
+ * linear probing. new keys are appended to the TAILQ, which is sorted
+ * after loading if needed.
+ */
+#define LOG_KV_PAGE_SIZE 1024 // keys
+#define LOG_KV_INDEX_MIN 64 // slots, power of 2
+
+struct log_kv_page {
+	uint64_t page; // key / LOG_KV_PAGE_SIZE
+	struct log_data_kv *kv[LOG_KV_PAGE_SIZE];
+};
+
+struct log_kv_index {
+	struct log_kv_page **slot;
+	size_t n_slots; // power of 2
+	size_t n_pages;
+	size_t n_keys;
+	struct log_kv_page *last; // hit cache
+	bool unsorted;
+};
+
+/*
+ * columnar view of the vs in kvh, in the same order. built after
+ * loading. analytics run over these arrays instead of the lists.
+ */
+#define LOG_SRC_NONE UINT16_MAX
+
+struct log_columns {
+	size_t n; // rows
+	int64_t *ts; // nsec, relative to epoch
+	uint64_t *seq;
+	uint64_t *block_idx;
+	uint8_t *fragment_idx;
+	uint8_t *type;
+	uint32_t *size;
+	int16_t *dbm;
+	uint16_t *freq;
+	uint16_t *src; // index of src_table, or LOG_SRC_NONE
+	bool *filtered;
+
+	struct in6_addr *src_table; // interned rx_src
+	size_t n_src;
+};
+
+/*
+ * range of records to load. seq and block ranges select received frames
+ * and decoded frames only. time is in nsec since the first record of the
+ * log. chunks of a version 2 log out of the range are not read.
+ */
+enum log_range_type {
+	LOG_RANGE_NONE,
+	LOG_RANGE_SEQ,
+	LOG_RANGE_BLOCK,
+	LOG_RANGE_TIME,
+};
+
+struct log_range {
+	enum log_range_type type;
+	uint64_t min;
+	uint64_t max;
+};
+
 struct log_store {
+	/* file info */
+	uint8_t version;
+	uint32_t n_chunks; // version 2
+	struct log_range range;
+	void *map; // whole file, if it is a regular file.
+	size_t map_size;
+
 	/* session info */
 	uint32_t channel_id;
 	uint8_t fec_type;
@@ -78,9 +155,35 @@ struct log_store {
 	struct log_data_kv_hd msg_kvh;
 	struct log_data_kv_hd block_kvh;
 	struct log_data_kv_hd kvh;
+	struct log_kv_index msg_kvi;
+	struct log_kv_index block_kvi;
+	struct log_kv_index kvi;
+
+	struct log_arena arena; // kvs, vs and copied payloads
+	struct log_columns col;
 };
 
+static inline bool
+log_v_filtered(struct log_store *ls, struct log_data_v *v)
+{
+	return ls->col.filtered[v->row];
+}
+
 struct log_store *load_log(FILE *fp);
+struct log_store *load_log_range(FILE *fp, const struct log_range *range);
+int log_range_parse(const char *s, struct log_range *range);
 void free_log(struct log_store *ls);
+const void *log_payload(struct log_store *ls, struct log_data_v *v);
+
+/* record decoding, shared with log_stream.c */
+struct rx_log_frame_header;
+struct rx_log_chunk_header;
+struct log_store *log_store_alloc(void);
+ssize_t log_read_file_header(FILE *fp, struct log_store *ls);
+void *log_decompress_chunk(struct rx_log_chunk_header *hd, void *data);
+void log_v_fill(struct log_store *ls, struct log_data_v *v,
+    const struct rx_log_frame_header *hd);
+void log_store_account(struct log_store *ls,
+    const struct rx_log_frame_header *hd);
 
 #endif /* __LOG_RAW_H__ */
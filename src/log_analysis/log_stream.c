@@ -0,0 +1,520 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <limits.h>
+#include <assert.h>
+#include <sys/stat.h>
+
+#include "../wfb_params.h"
+#include "../rx_log.h"
+#include "../util_msg.h"
+
+#include "log_analysis.h"
+#include "log_raw.h"
+#include "log_csv.h"
+#include "log_hist.h"
+#include "log_summary.h"
+#include "log_stream.h"
+
+struct log_stream_block {
+	uint64_t block_idx;
+	bool used;
+	uint32_t n_h265_frame;
+	uint64_t has_ethernet[(UINT8_MAX + 1) / 64]; // per fragment
+};
+
+struct log_stream {
+	FILE *fp;
+	FILE *fp_out;
+	enum output_types type;
+	bool follow;
+	struct log_store *ls; // session info and counters only
+
+	/* segments of a rotated log. follow mode only. */
+	char base[PATH_MAX]; // empty if unknown
+	int seq;
+	bool rotated; // the writer moved to the next segment
+
+	/* version 2 */
+	uint8_t *chunk;
+	size_t chunk_size;
+	size_t chunk_off;
+
+	/* loss counters */
+	struct log_stream_block block[LOG_STREAM_WINDOW];
+	uint64_t n_fec;
+	uint64_t n_lost;
+	uint64_t n_late;
+
+	uint32_t hist[LOG_HIST_SIZE];
+	uint64_t n_records;
+};
+
+static volatile sig_atomic_t stream_stop = 0;
+
+static void
+stream_sigint(int sig)
+{
+	stream_stop = 1;
+}
+
+enum stream_read {
+	STREAM_CLOSED = -2, // the index is found. the writer closed the file.
+	STREAM_EOF = -1,
+	STREAM_AGAIN = 0, // partial record. follow mode only.
+	STREAM_OK = 1,
+};
+
+static enum stream_read
+stream_fread(struct log_stream *st, void *buf, size_t size, off_t pos)
+{
+	if (size == 0 || fread(buf, size, 1, st->fp) == 1)
+		return STREAM_OK;
+
+	if (ferror(st->fp)) {
+		if (!stream_stop)
+			p_err("%s\n", strerror(errno));
+		return STREAM_EOF;
+	}
+	if (!st->follow)
+		return STREAM_EOF;
+
+	// the writer is not done yet. retry from the head of the record.
+	clearerr(st->fp);
+	if (fseeko(st->fp, pos, SEEK_SET) < 0) {
+		p_err("Cannot follow this input: %s\n", strerror(errno));
+		return STREAM_EOF;
+	}
+	return STREAM_AGAIN;
+}
+
+static enum stream_read
+stream_read_chunk(struct log_stream *st)
+{
+	struct rx_log_chunk_header hd;
+	enum stream_read r;
+	void *data, *raw;
+	uint32_t size;
+	off_t pos;
+
+	pos = ftello(st->fp);
+	r = stream_fread(st, &hd, sizeof(hd), pos);
+	if (r != STREAM_OK)
+		return r;
+	switch (le32toh(hd.signature)) {
+	case RX_LOG_CHUNK_SIGNATURE:
+		break;
+	case RX_LOG_INDEX_SIGNATURE:
+		// the log is closed.
+		p_debug("Index found.\n");
+		return STREAM_CLOSED;
+	default:
+		p_err("Invalid chunk signature.\n");
+		return STREAM_EOF;
+	}
+
+	size = le32toh(hd.size);
+	data = malloc(size ? size : 1);
+	if (data == NULL)
+		return STREAM_EOF;
+	r = stream_fread(st, data, size, pos);
+	if (r != STREAM_OK) {
+		free(data);
+		return r;
+	}
+	if (size == 0 || hd.raw_size == 0) {
+		free(data);
+		return STREAM_OK;
+	}
+	raw = log_decompress_chunk(&hd, data);
+	if (raw == NULL) {
+		free(data);
+		return STREAM_EOF;
+	}
+	free(st->chunk);
+	st->chunk = raw;
+	st->chunk_size = le32toh(hd.raw_size);
+	st->chunk_off = 0;
+	st->ls->n_chunks++;
+
+	return STREAM_OK;
+}
+
+static enum stream_read
+stream_next(struct log_stream *st, struct rx_log_frame_header *hd)
+{
+	static uint8_t payload[WIFI_MTU];
+	enum stream_read r;
+	uint32_t size;
+	off_t pos;
+
+	if (st->ls->version != RX_LOG_VERSION_CHUNKED) {
+		pos = ftello(st->fp);
+		r = stream_fread(st, hd, sizeof(*hd), pos);
+		if (r != STREAM_OK)
+			return r;
+		size = rx_log_payload_size(hd);
+		if (size >= WIFI_MTU) {
+			p_err("Broken record.\n");
+			return STREAM_EOF;
+		}
+		// payloads are not used.
+		return stream_fread(st, payload, size, pos);
+	}
+
+	while (st->chunk_size - st->chunk_off < sizeof(*hd)) {
+		r = stream_read_chunk(st);
+		if (r != STREAM_OK)
+			return r;
+	}
+	memcpy(hd, st->chunk + st->chunk_off, sizeof(*hd));
+	size = rx_log_payload_size(hd);
+	if (st->chunk_size - st->chunk_off - sizeof(*hd) < size) {
+		p_err("Broken chunk.\n");
+		return STREAM_EOF;
+	}
+	st->chunk_off += sizeof(*hd) + size;
+
+	return STREAM_OK;
+}
+
+static int
+stream_read_file_header(struct log_stream *st)
+{
+	for (;;) {
+		if (log_read_file_header(st->fp, st->ls) >= 0)
+			return 0;
+		if (!st->follow || stream_stop)
+			return -1;
+
+		// the header may still be in the buffer of the writer.
+		clearerr(st->fp);
+		if (fseeko(st->fp, 0, SEEK_SET) < 0)
+			return -1;
+		usleep(LOG_STREAM_POLL_MS * 1000);
+	}
+}
+
+/*
+ * segment N of a rotated log is <base>.N, or <base> if N is 0. the name
+ * has a sequence number only if <base>.seq is also there.
+ */
+static void
+stream_segment_init(struct log_stream *st, const char *name)
+{
+	char seq_name[PATH_MAX];
+	struct stat sb;
+	const char *dot, *p;
+
+	st->base[0] = '\0';
+	st->seq = 0;
+	if (name == NULL || strlen(name) >= sizeof(st->base))
+		return;
+	snprintf(st->base, sizeof(st->base), "%s", name);
+
+	dot = strrchr(name, '.');
+	if (dot == NULL || dot[1] == '\0')
+		return;
+	for (p = dot + 1; *p; p++) {
+		if (*p < '0' || *p > '9')
+			return;
+	}
+	snprintf(seq_name, sizeof(seq_name), "%.*s.seq",
+	    (int)(dot - name), name);
+	if (stat(seq_name, &sb) < 0)
+		return;
+	st->base[dot - name] = '\0';
+	st->seq = atoi(dot + 1);
+}
+
+static void
+stream_segment_name(struct log_stream *st, char *name, size_t len, int seq)
+{
+	if (seq == 0)
+		snprintf(name, len, "%s", st->base);
+	else
+		snprintf(name, len, "%s.%d", st->base, seq);
+}
+
+/*
+ * the next segment is created in advance, but its header is written
+ * only when the writer switches to it.
+ */
+static bool
+stream_segment_next_ready(struct log_stream *st)
+{
+	char name[PATH_MAX];
+	struct stat sb;
+
+	if (st->base[0] == '\0')
+		return false;
+	stream_segment_name(st, name, sizeof(name), st->seq + 1);
+	if (stat(name, &sb) < 0)
+		return false;
+
+	return sb.st_size >= sizeof(struct rx_log_file_header);
+}
+
+static bool
+stream_segment_wait(struct log_stream *st)
+{
+	int waited;
+
+	for (waited = 0; waited < LOG_STREAM_ROTATE_MS && !stream_stop;
+	    waited += LOG_STREAM_POLL_MS) {
+		if (stream_segment_next_ready(st))
+			return true;
+		usleep(LOG_STREAM_POLL_MS * 1000);
+	}
+
+	return false;
+}
+
+static int stream_read_file_header(struct log_stream *st);
+
+static int
+stream_segment_switch(struct log_stream *st)
+{
+	char name[PATH_MAX];
+	FILE *fp;
+
+	stream_segment_name(st, name, sizeof(name), st->seq + 1);
+	fp = fopen(name, "r");
+	if (fp == NULL) {
+		p_err("Cannot open %s: %s\n", name, strerror(errno));
+		return -1;
+	}
+	fclose(st->fp);
+	st->fp = fp;
+	st->seq++;
+	st->rotated = false;
+
+	free(st->chunk);
+	st->chunk = NULL;
+	st->chunk_size = 0;
+	st->chunk_off = 0;
+	p_debug("Following %s\n", name);
+
+	return stream_read_file_header(st);
+}
+
+static bool
+stream_block_lost(struct log_stream *st, struct log_stream_block *b)
+{
+	return b->used && b->n_h265_frame > 0 &&
+	    b->n_h265_frame < st->ls->fec_k;
+}
+
+static struct log_stream_block *
+stream_block(struct log_stream *st, uint64_t block_idx)
+{
+	struct log_stream_block *b;
+
+	b = &st->block[block_idx & (LOG_STREAM_WINDOW - 1)];
+	if (b->used && b->block_idx == block_idx)
+		return b;
+	if (b->used && b->block_idx > block_idx) {
+		// behind the window.
+		st->n_late++;
+		return NULL;
+	}
+
+	// the block leaves the window.
+	if (stream_block_lost(st, b))
+		st->n_lost++;
+	memset(b, 0, sizeof(*b));
+	b->block_idx = block_idx;
+	b->used = true;
+
+	return b;
+}
+
+static void
+stream_record(struct log_stream *st, struct rx_log_frame_header *hd)
+{
+	struct log_stream_block *b;
+	struct log_data_kv kv;
+	struct log_data_v v;
+	uint8_t frag = hd->fragment_idx;
+
+	switch (hd->type) {
+	case FRAME_TYPE_INET6:
+	case FRAME_TYPE_DECODE:
+	case FRAME_TYPE_CORRUPT:
+		break;
+	default:
+		return; // messages
+	}
+	st->n_records++;
+	log_store_account(st->ls, hd);
+
+	b = stream_block(st, hd->block_idx);
+	switch (hd->type) {
+	case FRAME_TYPE_INET6:
+		if (b)
+			b->has_ethernet[frag / 64] |= (1ULL << (frag % 64));
+		if (hd->dbm != DBM_INVAL)
+			st->hist[(uint8_t)(hd->dbm - INT8_MIN)]++;
+		break;
+	case FRAME_TYPE_DECODE:
+		if (b == NULL)
+			break;
+		b->n_h265_frame++;
+		if (!(b->has_ethernet[frag / 64] & (1ULL << (frag % 64)))) {
+			/* only decoded frame appered */
+			st->n_fec++;
+		}
+		break;
+	default:
+		break;
+	}
+
+	if (st->type == OUTPUT_CSV) {
+		memset(&kv, 0, sizeof(kv));
+		memset(&v, 0, sizeof(v));
+		kv.key = hd->seq;
+		log_v_fill(st->ls, &v, hd);
+		csv_serialize_v(st->fp_out, &kv, &v);
+	}
+}
+
+static void
+stream_report(struct log_stream *st)
+{
+	uint64_t n_lost = st->n_lost;
+	int i;
+
+	switch (st->type) {
+	case OUTPUT_SUMMARY:
+		// blocks in the window are counted as they are now.
+		for (i = 0; i < LOG_STREAM_WINDOW; i++) {
+			if (stream_block_lost(st, &st->block[i]))
+				n_lost++;
+		}
+		summary_print(st->fp_out, st->ls, (int)st->n_fec, (int)n_lost);
+		fprintf(st->fp_out, "Records behind the window: %" PRIu64 "\n",
+		    st->n_late);
+		break;
+	case OUTPUT_HIST:
+		log_hist_print(st->hist);
+		break;
+	default:
+		break;
+	}
+	fflush(st->fp_out);
+}
+
+static uint64_t
+stream_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+int
+log_stream(FILE *fp_in, const char *name_in, FILE *fp_out,
+    enum output_types type, bool follow)
+{
+	struct log_stream *st;
+	struct rx_log_frame_header hd;
+	enum stream_read r;
+	uint64_t last_report, n_reported = 0;
+	int rc = -1;
+
+	switch (type) {
+	case OUTPUT_CSV:
+	case OUTPUT_SUMMARY:
+	case OUTPUT_HIST:
+	case OUTPUT_NONE:
+		break;
+	default:
+		p_err("The output type is not supported in streaming mode.\n");
+		return -1;
+	}
+
+	st = (struct log_stream *)malloc(sizeof(*st));
+	if (st == NULL)
+		return -1;
+	memset(st, 0, sizeof(*st));
+	st->fp = fp_in ? fp_in : stdin;
+	st->fp_out = fp_out ? fp_out : stdout;
+	st->type = type;
+	st->follow = follow;
+	if (follow && fp_in)
+		stream_segment_init(st, name_in);
+	st->ls = log_store_alloc();
+	if (st->ls == NULL)
+		goto err;
+
+	if (follow && signal(SIGINT, stream_sigint) == SIG_ERR) {
+		p_err("signal() failed: %s\n", strerror(errno));
+		goto err;
+	}
+
+	if (stream_read_file_header(st) < 0) {
+		p_err("Invalid log file.\n");
+		goto err;
+	}
+	if (type == OUTPUT_CSV)
+		csv_serialize_v(st->fp_out, NULL, NULL);
+
+	last_report = stream_now();
+	while (!stream_stop) {
+		r = stream_next(st, &hd);
+		if (r == STREAM_OK) {
+			stream_record(st, &hd);
+			continue;
+		}
+		if (r == STREAM_CLOSED && follow && stream_segment_wait(st)) {
+			// rotated. the listener writes the next one.
+			if (stream_segment_switch(st) < 0)
+				break;
+			continue;
+		}
+		if (r != STREAM_AGAIN)
+			break;
+
+		// follow mode.
+		if (stream_segment_next_ready(st)) {
+			if (st->rotated) {
+				if (stream_segment_switch(st) < 0)
+					break;
+				continue;
+			}
+			// the segment is complete now. read the rest first.
+			st->rotated = true;
+			continue;
+		}
+
+		// print rolling results while waiting.
+		if (type == OUTPUT_CSV)
+			fflush(st->fp_out);
+		if (st->n_records != n_reported &&
+		    stream_now() - last_report >= LOG_STREAM_REPORT_SEC) {
+			stream_report(st);
+			last_report = stream_now();
+			n_reported = st->n_records;
+		}
+		usleep(LOG_STREAM_POLL_MS * 1000);
+	}
+	stream_report(st);
+
+	rc = 0;
+err:
+	if (st->ls)
+		free_log(st->ls);
+	if (st->fp != fp_in && st->fp != stdin)
+		fclose(st->fp); // switched to a later segment
+	free(st->chunk);
+	free(st);
+	return rc;
+}
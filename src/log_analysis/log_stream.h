@@ -0,0 +1,24 @@
+#ifndef __LOG_STREAM_H__
+#define __LOG_STREAM_H__
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "log_analysis.h"
+
+/*
+ * single pass analysis. records are read one by one and only the
+ * state of the recent blocks is kept, so the memory usage doesn't
+ * depend on the size of the log.
+ */
+#define LOG_STREAM_WINDOW	256 // blocks, power of 2
+#define LOG_STREAM_POLL_MS	200 // follow mode
+#define LOG_STREAM_REPORT_SEC	1 // follow mode
+#define LOG_STREAM_ROTATE_MS	1000 // follow mode, wait for the next segment
+
+/*
+ * in follow mode, name_in is used to find the next segment of a log
+ * rotated by wfb_listener.
+ */
+extern int log_stream(FILE *fp_in, const char *name_in, FILE *fp_out,
+    enum output_types type, bool follow);
+#endif /* __LOG_STREAM_H__ */
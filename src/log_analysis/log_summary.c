@@ -21,12 +21,8 @@ s_fectype(uint8_t type)
 }
 
 int
-summary_output(FILE *fp, struct log_store *ls)
+summary_print(FILE *fp, struct log_store *ls, int n_fec, int n_lost)
 {
-	struct log_data_kv *kv;
-	int n_fec = 0;
-	int n_lost = 0;
-
 	if (fp == NULL)
 		fp = stdout;
 
@@ -46,13 +42,25 @@ summary_output(FILE *fp, struct log_store *ls)
 	fprintf(fp, "Total H.265 bytes: %" PRIu64 "\n", ls->total_bytes);
 
 	fprintf(fp, "---AFTER FILTER---\n");
+	fprintf(fp, "Frame recovered using FEC: %d\n", n_fec);
+	fprintf(fp, "Number of corrupted blocks: %d\n", n_lost);
+
+	return 0;
+}
+
+int
+summary_output(FILE *fp, struct log_store *ls)
+{
+	struct log_data_kv *kv;
+	int n_fec = 0;
+	int n_lost = 0;
+
 	TAILQ_FOREACH(kv, &ls->kvh, chain) {
 		if (!kv->has_fec_frame)
 			continue;
 		p_debug("Sequence %" PRIu64 " recovered by FEC\n", kv->key);
 		n_fec++;
 	}
-	fprintf(fp, "Frame recovered using FEC: %d\n", n_fec);
 
 	TAILQ_FOREACH(kv, &ls->block_kvh, chain) {
 		if (!kv->has_lost_frame)
@@ -60,7 +68,6 @@ summary_output(FILE *fp, struct log_store *ls)
 		p_debug("Block %" PRIu64 " has lost frames\n", kv->key);
 		n_lost++;
 	}
-	fprintf(fp, "Number of corrupted blocks: %d\n", n_lost);
 
-	return 0;
+	return summary_print(fp, ls, n_fec, n_lost);
 }
@@ -5,4 +5,6 @@
 
 int
 summary_output(FILE *fp, struct log_store *ls);
+int
+summary_print(FILE *fp, struct log_store *ls, int n_fec, int n_lost);
 #endif /* __LOG_SUMMARY_H__ */
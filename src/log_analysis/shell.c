@@ -21,7 +21,7 @@
 #include "shell.h"
 
 static struct log_store *
-load_file(const char *file_name)
+load_file(const char *file_name, const struct log_range *range)
 {
 	FILE *fp;
 	struct log_store *ls;
@@ -34,7 +34,7 @@ load_file(const char *file_name)
 		return NULL;
 	}
 	p_info("Loading %s...\n", file_name);
-	ls = load_log(fp);
+	ls = load_log_range(fp, range);
 	fclose(fp);
 
 	if (ls == NULL) {
@@ -338,15 +338,25 @@ shell_load(struct shell_context *ctx, struct shell_token *token)
 {
 	FILE *fp;
 	struct log_store *ls;
+	struct log_range range = { .type = LOG_RANGE_NONE };
+	const char *file_name;
 
 	token_next(token);
 	if (token->cur == NULL) {
 		p_info("Missing argument.\n");
-		p_info("%s <file_name>\n", expand_token(token));
+		p_info("%s <file_name> [<range>]\n", expand_token(token));
+		return -1;
+	}
+	file_name = token->cur;
+
+	token_next(token);
+	if (token->cur && token->cur[0] != '\0' &&
+	    log_range_parse(token->cur, &range) < 0) {
+		p_info("Invalid range %s.\n", token->cur);
 		return -1;
 	}
 
-	ls = load_file(token->cur);
+	ls = load_file(file_name, &range);
 	if (ls == NULL) {
 		return -1;
 	}
@@ -595,7 +605,7 @@ shell(const char *file_name)
 	}
 
 	if (file_name) {
-		ctx.ls = load_file(file_name);
+		ctx.ls = load_file(file_name, NULL);
 	}
 
 	while ( (token = shell_read(ctx.fp_in, ctx.fp_out))) {
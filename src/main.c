@@ -21,8 +21,12 @@
 #include "wfb_params.h"
 #include "net_core.h"
 #include "net_pcap.h"
+#ifdef __linux__
+#include "net_tpacket.h"
+#endif
 #include "net_inet.h"
 #include "rx_core.h"
+#include "rx_pipe.h"
 #include "rx_log.h"
 #include "crypto_wfb.h"
 #include "fec_wfb.h"
@@ -34,16 +38,25 @@
 #include "util_msg.h"
 
 struct wfb_opt wfb_options = {
-	.rx_wireless = DEF_WRX,
+	.rx_wireless = { DEF_WRX },
 	.tx_wired = DEF_ETX,
 	.rx_wired = DEF_ERX,
 	.key_file = DEF_KEY_FILE,
 	.mc_addr = WFB_ADDR6,
 	.mc_port = WFB_PORT,
+	.rx_backend = WFB_RX_PCAP,
+	.rx_batch = 1,
+	.tx_hold = 0,
+	.pipeline = false,
+	.rx_hugepage = false,
+	.workers = 1,
+	.rx_reorder = 0,
 	.local_play = false,
 	.use_monitor = false,
 	.no_fec = false,
+	.relay = false,
 	.log_file = NULL,
+	.log_version = RX_LOG_VERSION,
 	.pid_file = DEF_PID_FILE,
 	.ctrl_file = DEF_CTRL_FILE,
 	.debug = false
@@ -65,15 +78,22 @@ print_help(const char *path)
 	printf("\t%s [-w <dev>] [-e <dev>] [-E <dev>]\n", name);
         printf("\t[-a <addr>] [-p <port>] [-k <file>]\n");
 	printf("\t[-P <pid_file>] [-S <ipc_socket>]\n");
-	printf("\t[-s <param>] [-r]\n");
-	printf("\t[-l] [-m] [-n] [-d] [-D] [-s] [-h]\n");
+	printf("\t[-s <param>] [-b <backend>] [-B <batch>] [-H <usec>] [-r]\n");
+	printf("\t[-j <n>] [-R <msec>] [-l] [-m] [-M] [-n] [-f] [-T] [-d] [-D] [-s] [-h]\n");
 	printf("Options:\n");
-	printf("\t-w <dev> ... specify Wireless Rx device. default: %s\n",
+	printf("\t-w <dev> ... specify Wireless Rx device."
+	    " can be repeated up to %d times. default: %s\n", RX_MAX_WIRELESS,
 	    DEF_WRX ? DEF_WRX : "none");
 	printf("\t-e <dev> ... specify Ethernet Rx device. default: %s\n",
 	    DEF_ERX ? DEF_ERX : "none");
 	printf("\t-E <dev> ... specify Ethernet Tx device. default: %s\n",
 	    DEF_ERX ? DEF_ERX : "none");
+	printf("\t-b <backend> ... specify Wireless Rx backend. default: pcap\n");
+	printf("\t-B <batch> ... specify number of Ethernet Rx frames"
+	    " per wakeup(1-%d). default: 1\n", NETINET_RX_BATCH_MAX);
+	printf("\t-H <usec> ... specify max hold time of Ethernet Tx queue"
+	    "(0-%d). 0 flushes it at the end of each event loop."
+	    " default: 0\n", NETINET_TX_HOLD_MAX);
 	printf("\t-a <addr> ... specify Multicast address . default: %s\n",
 	    WFB_ADDR6);
 	printf("\t-p <port> ... specify Multicast port . default: %s\n",
@@ -89,13 +109,31 @@ print_help(const char *path)
 	printf("\t-r ... enable rssi overlay. default: disable\n");
 #endif
 	printf("\t-L ... traffic log file name. default: (none)\n");
+	printf("\t-V <version> ... specify traffic log format(%d-%d)."
+	    " default: %d\n", RX_LOG_VERSION, RX_LOG_VERSION_CHUNKED,
+	    RX_LOG_VERSION);
 	printf("\t-m ... use RFMonitor mode instead of Promiscous mode.\n");
 	printf("\t-n ... don't apply FEC decode.\n");
+	printf("\t-f ... relay Wireless frames to Ethernet Tx device only."
+	    " requires -E.\n");
+	printf("\t-M ... use hugepages for Rx ring.\n");
+	printf("\t-T ... capture on dedicated threads(pipelined mode).\n");
+	printf("\t-j <n> ... specify number of decrypt/FEC threads(1-%d)."
+	    " default: 1\n", RX_MAX_WORKER);
+	printf("\t-R <msec> ... specify max time to wait for a lost fragment"
+	    "(0-%d). 0 drops it when the next block arrives. default: 0\n",
+	    RX_REORDER_MAX);
 	printf("\t-D ... run as daemon.\n");
 	printf("\t-K ... kill daemon.\n");
 	printf("\t-s <param> ... send query via IPC.\n");
 	printf("\t-d ... enable debug output.\n");
 	printf("\t-h ... print help(this).\n");
+	printf("\n");
+	printf("Backends(<backend>):\n");
+	printf("\tpcap ... libpcap\n");
+#ifdef __linux__
+	printf("\ttpacket ... AF_PACKET TPACKET_V3 memory mapped ring\n");
+#endif
 	printf("\n");
 	printf("Queries(<param>):\n");
 	printf("\tping ... check liveness only\n");
@@ -105,6 +143,58 @@ print_help(const char *path)
 	printf("\n");
 }
 
+static enum wfb_rx_backend
+parse_backend(const char *name)
+{
+	assert(name);
+
+	if (strcasecmp(name, "pcap") == 0)
+		return WFB_RX_PCAP;
+#ifdef __linux__
+	if (strcasecmp(name, "tpacket") == 0)
+		return WFB_RX_TPACKET;
+#endif
+	fprintf(stderr, "Unknown Rx backend: %s\n", name);
+	exit(EXIT_FAILURE);
+}
+
+static void
+add_wireless(const char *dev)
+{
+	int i;
+
+	assert(dev);
+
+	for (i = 0; i < RX_MAX_WIRELESS; i++) {
+		if (wfb_options.rx_wireless[i] == NULL) {
+			wfb_options.rx_wireless[i] = dev;
+			return;
+		}
+	}
+	fprintf(stderr, "Too many Wireless Rx devices. max: %d\n",
+	    RX_MAX_WIRELESS);
+	exit(EXIT_FAILURE);
+}
+
+static void
+parse_wireless(const char *list)
+{
+	char *devs, *dev, *last;
+
+	assert(list);
+
+	// comma separated list. the copy is never freed.
+	devs = strdup(list);
+	if (devs == NULL) {
+		fprintf(stderr, "Cannot allocate memory.\n");
+		exit(EXIT_FAILURE);
+	}
+	memset(wfb_options.rx_wireless, 0, sizeof(wfb_options.rx_wireless));
+	for (dev = strtok_r(devs, ",", &last); dev;
+	    dev = strtok_r(NULL, ",", &last))
+		add_wireless(dev);
+}
+
 static void
 load_environment(void)
 {
@@ -132,7 +222,75 @@ load_environment(void)
 	}
 	v = getenv("WFB_RX_WIRELESS");
 	if (v) {
-		wfb_options.rx_wireless = v;
+		parse_wireless(v);
+	}
+
+	v = getenv("WFB_RX_BACKEND");
+	if (v) {
+		wfb_options.rx_backend = parse_backend(v);
+	}
+
+	v = getenv("WFB_RX_BATCH");
+	if (v) {
+		wfb_options.rx_batch = atoi(v);
+		if (wfb_options.rx_batch < 1)
+			wfb_options.rx_batch = 1;
+		if (wfb_options.rx_batch > NETINET_RX_BATCH_MAX)
+			wfb_options.rx_batch = NETINET_RX_BATCH_MAX;
+	}
+
+	v = getenv("WFB_TX_HOLD");
+	if (v) {
+		wfb_options.tx_hold = atoi(v);
+		if (wfb_options.tx_hold < 0)
+			wfb_options.tx_hold = 0;
+		if (wfb_options.tx_hold > NETINET_TX_HOLD_MAX)
+			wfb_options.tx_hold = NETINET_TX_HOLD_MAX;
+	}
+
+	v = getenv("WFB_WORKERS");
+	if (v) {
+		wfb_options.workers = atoi(v);
+		if (wfb_options.workers < 1)
+			wfb_options.workers = 1;
+		if (wfb_options.workers > RX_MAX_WORKER)
+			wfb_options.workers = RX_MAX_WORKER;
+	}
+
+	v = getenv("WFB_RX_REORDER");
+	if (v) {
+		wfb_options.rx_reorder = atoi(v);
+		if (wfb_options.rx_reorder < 0)
+			wfb_options.rx_reorder = 0;
+		if (wfb_options.rx_reorder > RX_REORDER_MAX)
+			wfb_options.rx_reorder = RX_REORDER_MAX;
+	}
+
+	v = getenv("WFB_LOG_VERSION");
+	if (v) {
+		wfb_options.log_version = atoi(v);
+		if (wfb_options.log_version != RX_LOG_VERSION_CHUNKED)
+			wfb_options.log_version = RX_LOG_VERSION;
+	}
+
+	v = getenv("WFB_LOG_ROTATE_SIZE");
+	if (v) {
+		long long mb = atoll(v);
+
+		wfb_options.log_rotate_size =
+		    (mb > 0) ? (uint64_t)mb * 1024 * 1024 : 0;
+	}
+	v = getenv("WFB_LOG_ROTATE_TIME");
+	if (v) {
+		wfb_options.log_rotate_time = atoi(v);
+		if (wfb_options.log_rotate_time < 0)
+			wfb_options.log_rotate_time = 0;
+	}
+	v = getenv("WFB_LOG_ROTATE_RETAIN");
+	if (v) {
+		wfb_options.log_retain = atoi(v);
+		if (wfb_options.log_retain < 0)
+			wfb_options.log_retain = 0;
 	}
 
 	v = getenv("WFB_MULTICAST");
@@ -150,16 +308,24 @@ parse_options(int *argc0, char **argv0[])
 {
 	int argc = *argc0;
 	char **argv = *argv0;
+	bool has_wireless = false;
 	int ch;
 
-	while ((ch = getopt(argc, argv, "w:e:E:a:p:k:L:P:S:s:DKlrmndh")) != -1) {
+	while ((ch = getopt(argc, argv, "w:e:E:a:p:k:b:B:H:j:L:P:S:s:DKR:V:lrmMnfTdh")) != -1) {
 		switch (ch) {
 			case 'w':
 				wfb_options.rx_wired = NULL;
-				wfb_options.rx_wireless = optarg;
+				if (!has_wireless) {
+					// override the default.
+					memset(wfb_options.rx_wireless, 0,
+					    sizeof(wfb_options.rx_wireless));
+					has_wireless = true;
+				}
+				add_wireless(optarg);
 				break;
 			case 'e':
-				wfb_options.rx_wireless = NULL;
+				memset(wfb_options.rx_wireless, 0,
+				    sizeof(wfb_options.rx_wireless));
 				wfb_options.rx_wired = optarg;
 				break;
 			case 'E':
@@ -174,6 +340,58 @@ parse_options(int *argc0, char **argv0[])
 			case 'k':
 				wfb_options.key_file = optarg;
 				break;
+			case 'b':
+				wfb_options.rx_backend = parse_backend(optarg);
+				break;
+			case 'B':
+				wfb_options.rx_batch = atoi(optarg);
+				if (wfb_options.rx_batch < 1 ||
+				    wfb_options.rx_batch > NETINET_RX_BATCH_MAX) {
+					fprintf(stderr,
+					    "Invalid batch size: %s\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'H':
+				wfb_options.tx_hold = atoi(optarg);
+				if (wfb_options.tx_hold < 0 ||
+				    wfb_options.tx_hold > NETINET_TX_HOLD_MAX) {
+					fprintf(stderr,
+					    "Invalid hold time: %s\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'j':
+				wfb_options.workers = atoi(optarg);
+				if (wfb_options.workers < 1 ||
+				    wfb_options.workers > RX_MAX_WORKER) {
+					fprintf(stderr,
+					    "Invalid number of threads: %s\n",
+					    optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'R':
+				wfb_options.rx_reorder = atoi(optarg);
+				if (wfb_options.rx_reorder < 0 ||
+				    wfb_options.rx_reorder > RX_REORDER_MAX) {
+					fprintf(stderr,
+					    "Invalid reorder window: %s\n",
+					    optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'V':
+				wfb_options.log_version = atoi(optarg);
+				if (wfb_options.log_version != RX_LOG_VERSION &&
+				    wfb_options.log_version !=
+				    RX_LOG_VERSION_CHUNKED) {
+					fprintf(stderr,
+					    "Invalid log version: %s\n",
+					    optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
 			case 'l':
 #ifdef ENABLE_GSTREAMER
 				wfb_options.local_play = true;
@@ -190,6 +408,12 @@ parse_options(int *argc0, char **argv0[])
 				exit(EXIT_FAILURE);
 #endif
 				break;
+			case 'M':
+				wfb_options.rx_hugepage = true;
+				break;
+			case 'T':
+				wfb_options.pipeline = true;
+				break;
 			case 'D':
 				wfb_options.daemon = true;
 				break;
@@ -211,6 +435,9 @@ parse_options(int *argc0, char **argv0[])
 			case 'n':
 				wfb_options.no_fec = true;
 				break;
+			case 'f':
+				wfb_options.relay = true;
+				break;
 			case 'd':
 				wfb_options.debug = true;
 				break;
@@ -236,29 +463,78 @@ parse_options(int *argc0, char **argv0[])
 	if (wfb_options.kill_daemon)
 		return;
 
-	if (!wfb_options.rx_wireless && !wfb_options.rx_wired) {
+	wfb_options.n_rx_wireless = 0;
+	while (wfb_options.n_rx_wireless < RX_MAX_WIRELESS &&
+	    wfb_options.rx_wireless[wfb_options.n_rx_wireless])
+		wfb_options.n_rx_wireless++;
+
+	if (!wfb_options.n_rx_wireless && !wfb_options.rx_wired) {
 		fprintf(stderr, "Please specify at least one Rx device.\n");
 		exit(EXIT_FAILURE);
 	}
+	if (wfb_options.use_monitor &&
+	    wfb_options.rx_backend == WFB_RX_TPACKET) {
+		fprintf(stderr, "RFMonitor mode(-m) is not supported by"
+		    " tpacket backend. Set the device to monitor mode"
+		    " by iw(8).\n");
+		exit(EXIT_FAILURE);
+	}
+	if (wfb_options.relay && !wfb_options.tx_wired) {
+		fprintf(stderr, "Relay(-f) requires Ethernet Tx device(-E).\n");
+		exit(EXIT_FAILURE);
+	}
+	if (wfb_options.relay &&
+	    (wfb_options.local_play || wfb_options.log_file)) {
+		fprintf(stderr, "Relay(-f) cannot decode(-l) or log(-L).\n");
+		exit(EXIT_FAILURE);
+	}
 
 	return;
 }
 
 
+static struct netcore_context *
+capture_core_initialize(struct netcore_context *cap_ctx,
+    struct rx_pipe *pipe_ctx, struct netcore_context *net_ctx,
+    struct rx_context *rx_ctx, int id)
+{
+	if (!wfb_options.pipeline)
+		return net_ctx;
+
+	p_debug("Initalizing capture thread#%d.\n", id);
+	if (netcore_worker_initialize(cap_ctx, net_ctx) < 0) {
+		p_err("Cannot Initialize capture thread\n");
+		exit(EXIT_FAILURE);
+	}
+	if (rx_pipe_initialize(pipe_ctx, net_ctx, rx_ctx, id) < 0) {
+		p_err("Cannot Initialize capture pipe\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return cap_ctx;
+}
+
 static int
 _main(int argc, char *argv[])
 {
 	struct netcore_context net_ctx;
 	struct ipc_rx_context ipc_ctx;
-	struct netpcap_context pcap_ctx;
+	struct netpcap_context pcap_ctx[RX_MAX_WIRELESS];
+#ifdef __linux__
+	struct nettpacket_context tpacket_ctx[RX_MAX_WIRELESS];
+#endif
 	struct netinet_rx_context inrx_ctx;
 	struct netinet_tx_context intx_ctx;
 	struct rx_context rx_ctx;
+	struct netcore_context cap_ctx[RX_MAX_PIPE];
+	struct rx_pipe pipe_ctx[RX_MAX_PIPE];
+	struct netcore_context *core;
 #ifdef ENABLE_GSTREAMER
 	struct wfb_gst_context gst_ctx;
 #endif
 	uint32_t wfb_ch = 0;
-	int fd;
+	int n_pipe = 0;
+	int fd, i;
 
 	load_environment();
 	parse_options(&argc, &argv);
@@ -279,6 +555,8 @@ _main(int argc, char *argv[])
 		if (create_daemon(wfb_options.pid_file) < 0)
 			exit(EXIT_FAILURE);
 	}
+	if (msg_async_start() < 0)
+		p_info("Cannot start message writer. Write directly.\n");
 
 	p_debug("Initalizing netcore.\n");
 	if (netcore_initialize(&net_ctx) < 0) {
@@ -310,10 +588,21 @@ _main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 	msg_set_hook(rx_log_hook, &rx_ctx);
+	if (rx_context_set_workers(&rx_ctx, &net_ctx,
+	    wfb_options.workers) < 0) {
+		p_err("Cannot Initialize Workers.\n");
+		exit(EXIT_FAILURE);
+	}
+	if (rx_context_set_reorder(&rx_ctx, &net_ctx,
+	    wfb_options.rx_reorder) < 0) {
+		p_err("Cannot Initialize Reorder Window.\n");
+		exit(EXIT_FAILURE);
+	}
 
 	if (wfb_options.tx_wired) {
 		p_debug("Initalizing inet tx.\n");
-		netinet_tx_initialize(&intx_ctx, &net_ctx, wfb_options.tx_wired);
+		netinet_tx_initialize(&intx_ctx, &net_ctx, wfb_options.tx_wired,
+		    wfb_options.tx_hold);
 		if (rx_context_set_mirror(&rx_ctx, netinet_tx, &intx_ctx) < 0) {
 			p_err("Cannot Attach NetRx\n");
 			exit(EXIT_FAILURE);
@@ -340,31 +629,83 @@ _main(int argc, char *argv[])
 	}
 #endif
 
-	if (wfb_options.rx_wireless) {
-		p_debug("Initalizing pcap rx.\n");
-		fd = netpcap_initialize(&pcap_ctx, &net_ctx, &rx_ctx,
-		    wfb_options.rx_wireless, wfb_options.use_monitor);
+	if (wfb_options.relay) {
+		p_info("Relay frames only.\n");
+		if (rx_context_set_relay(&rx_ctx, true) < 0) {
+			p_err("Cannot Initialize Relay\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (i = 0; i < wfb_options.n_rx_wireless; i++) {
+		core = capture_core_initialize(&cap_ctx[n_pipe],
+		    &pipe_ctx[n_pipe], &net_ctx, &rx_ctx, n_pipe);
+		switch (wfb_options.rx_backend) {
+#ifdef __linux__
+		case WFB_RX_TPACKET:
+			p_debug("Initalizing tpacket rx on %s.\n",
+			    wfb_options.rx_wireless[i]);
+			fd = nettpacket_initialize(&tpacket_ctx[i], core,
+			    &rx_ctx, wfb_options.rx_wireless[i], i,
+			    wfb_options.use_monitor);
+			if (fd >= 0 && wfb_options.pipeline &&
+			    nettpacket_set_pipe(&tpacket_ctx[i],
+			    &pipe_ctx[n_pipe]) < 0)
+				fd = -1;
+			break;
+#endif
+		case WFB_RX_PCAP:
+		default:
+			p_debug("Initalizing pcap rx on %s.\n",
+			    wfb_options.rx_wireless[i]);
+			fd = netpcap_initialize(&pcap_ctx[i], core, &rx_ctx,
+			    wfb_options.rx_wireless[i], i,
+			    wfb_options.use_monitor);
+			if (fd >= 0 && wfb_options.pipeline)
+				netpcap_set_pipe(&pcap_ctx[i],
+				    &pipe_ctx[n_pipe]);
+			break;
+		}
 		if (fd < 0) {
 			p_err("Cannot Initialize PCAP Rx\n");
 			exit(EXIT_FAILURE);
 		}
+		if (wfb_options.pipeline)
+			n_pipe++;
 	}
 
 	if (wfb_options.rx_wired) {
 		p_debug("Initalizing inet rx.\n");
-		fd = netinet_rx_initialize(&inrx_ctx, &net_ctx, &rx_ctx,
-		    wfb_options.rx_wired);
+		core = capture_core_initialize(&cap_ctx[n_pipe],
+		    &pipe_ctx[n_pipe], &net_ctx, &rx_ctx, n_pipe);
+		fd = netinet_rx_initialize(&inrx_ctx, core, &rx_ctx,
+		    wfb_options.rx_wired, wfb_options.rx_batch);
 		if (fd < 0) {
 			p_err("Cannot Initialize Inet6 Rx\n");
 			exit(EXIT_FAILURE);
 		}
+		if (wfb_options.pipeline) {
+			netinet_rx_set_pipe(&inrx_ctx, &pipe_ctx[n_pipe]);
+			n_pipe++;
+		}
 	}
 
 	p_debug("Start netcore thread.\n");
 	netcore_thread_start(&net_ctx);
+	for (i = 0; i < n_pipe; i++) {
+		p_debug("Start capture thread#%d.\n", i);
+		if (netcore_thread_start(&cap_ctx[i]) < 0) {
+			p_err("Cannot start capture thread\n");
+			exit(EXIT_FAILURE);
+		}
+	}
 	p_debug("Waiting for netcore thread complete.\n");
 	netcore_thread_join(&net_ctx);
 	p_debug("netcore thread completed.\n");
+	for (i = 0; i < n_pipe; i++) {
+		p_debug("Stopping capture thread#%d.\n", i);
+		netcore_thread_stop(&cap_ctx[i]);
+	}
 
 #ifdef ENABLE_GSTREAMER
 	if (wfb_options.local_play) {
@@ -383,10 +724,25 @@ _main(int argc, char *argv[])
 		p_debug("Deinitalizing inet tx.\n");
 		netinet_tx_deinitialize(&intx_ctx);
 	}
-	if (wfb_options.rx_wireless) {
-		netpcap_deinitialize(&pcap_ctx);
+	for (i = 0; i < wfb_options.n_rx_wireless; i++) {
+		switch (wfb_options.rx_backend) {
+#ifdef __linux__
+		case WFB_RX_TPACKET:
+			nettpacket_deinitialize(&tpacket_ctx[i]);
+			break;
+#endif
+		case WFB_RX_PCAP:
+		default:
+			netpcap_deinitialize(&pcap_ctx[i]);
+			break;
+		}
+	}
+	for (i = 0; i < n_pipe; i++) {
+		rx_pipe_deinitialize(&pipe_ctx[i]);
+		netcore_deinitialize(&cap_ctx[i]);
 	}
 	p_debug("Deinitalizing rx parser.\n");
+	msg_set_hook(NULL, NULL);
 	rx_context_deinitialize(&rx_ctx);
 	p_debug("Deinitalizing netcore.\n");
 	netcore_deinitialize(&net_ctx);
@@ -4,6 +4,8 @@
 #include <string.h>
 #include <errno.h>
 #include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <assert.h>
 
 #include <pthread.h>
@@ -34,7 +36,21 @@ netcore_hup(evutil_socket_t s, short what, void *arg)
 	assert(ctx);
 
 	wfb_stats.sighup++;
-	ctx->reload = true;
+	netcore_reload(ctx);
+}
+
+static void
+netcore_wakeup(evutil_socket_t fd, short what, void *arg)
+{
+	struct netcore_context *ctx = (struct netcore_context *)arg;
+	uint8_t buf[64];
+
+	assert(ctx);
+
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+	if (__atomic_load_n(&ctx->stop, __ATOMIC_ACQUIRE))
+		event_base_loopbreak(ctx->base);
 }
 
 static void
@@ -51,7 +67,8 @@ netcore_wdt(evutil_socket_t s, short what, void *arg)
 			if (hook->func(hook->arg) < 0)
 				error = true;
 		}
-		wfb_stats.reload++;
+		// each netcore thread has its own watchdog.
+		__atomic_add_fetch(&wfb_stats.reload, 1, __ATOMIC_RELAXED);
 	}
 
 	pthread_mutex_lock(&ctx->lock);
@@ -60,14 +77,16 @@ netcore_wdt(evutil_socket_t s, short what, void *arg)
 	evtimer_add(ctx->wdt, &ctx->wdt_to);
 }
 
-int
-netcore_initialize(struct netcore_context *ctx)
+static int
+netcore_base_initialize(struct netcore_context *ctx)
 {
 	struct event_config *cfg;
+	int i;
 
 	assert(ctx);
 
 	memset(ctx, 0, sizeof(*ctx));
+	ctx->wakeup[0] = ctx->wakeup[1] = -1;
 
 	cfg = event_config_new();
 	if (cfg == NULL) {
@@ -76,9 +95,35 @@ netcore_initialize(struct netcore_context *ctx)
 	}
 
 	ctx->base = event_base_new();
+	event_config_free(cfg);
+	if (ctx->base == NULL) {
+		p_err("Failed to create event base.\n");
+		return -1;
+	}
 	pthread_mutex_init(&ctx->lock, NULL);
 	ctx->reload = false;
 	LIST_INIT(&ctx->reload_hooks);
+	LIST_INIT(&ctx->workers);
+
+	if (pipe(ctx->wakeup) < 0) {
+		p_err("pipe() failed: %s\n", strerror(errno));
+		return -1;
+	}
+	for (i = 0; i < 2; i++) {
+		if (fcntl(ctx->wakeup[i], F_SETFL, O_NONBLOCK) < 0 ||
+		    fcntl(ctx->wakeup[i], F_SETFD, FD_CLOEXEC) < 0) {
+			p_err("fcntl() failed: %s\n", strerror(errno));
+			return -1;
+		}
+	}
+	ctx->wakeup_ev = event_new(ctx->base, ctx->wakeup[0],
+	    EV_READ|EV_PERSIST, netcore_wakeup, ctx);
+	if (ctx->wakeup_ev == NULL) {
+		p_err("Failed to allocate wakeup event.\n");
+		return -1;
+	}
+	event_add(ctx->wakeup_ev, NULL);
+
 	ctx->wdt = evtimer_new(ctx->base, netcore_wdt, ctx);
 	if (ctx->wdt == NULL) {
 		p_err("Failed to allocate wdt event.\n");
@@ -88,6 +133,17 @@ netcore_initialize(struct netcore_context *ctx)
 	ctx->wdt_to.tv_usec = 0;
 	evtimer_add(ctx->wdt, &ctx->wdt_to);
 
+	return 0;
+}
+
+int
+netcore_initialize(struct netcore_context *ctx)
+{
+	assert(ctx);
+
+	if (netcore_base_initialize(ctx) < 0)
+		return -1;
+
 	ctx->sighup = evsignal_new(ctx->base, SIGHUP, netcore_hup, ctx);
 	if (ctx->sighup == NULL) {
 		p_err("Failed to allocate signal event.\n");
@@ -109,7 +165,28 @@ netcore_initialize(struct netcore_context *ctx)
 	}
 	evsignal_add(ctx->sigint, NULL);
 
-	event_config_free(cfg);
+	return 0;
+}
+
+/*
+ * event loop without signal handlers. signals are handled by the
+ * context initialized by netcore_initialize(), and reload requests are
+ * forwarded from the parent.
+ */
+int
+netcore_worker_initialize(struct netcore_context *ctx,
+    struct netcore_context *parent)
+{
+	assert(ctx);
+	assert(parent);
+
+	if (netcore_base_initialize(ctx) < 0)
+		return -1;
+
+	ctx->parent = parent;
+	pthread_mutex_lock(&parent->lock);
+	LIST_INSERT_HEAD(&parent->workers, ctx, next);
+	pthread_mutex_unlock(&parent->lock);
 
 	return 0;
 }
@@ -117,12 +194,32 @@ netcore_initialize(struct netcore_context *ctx)
 void
 netcore_deinitialize(struct netcore_context *ctx)
 {
+	int i;
+
 	assert(ctx);
 
-	netcore_thread_cancel(ctx);
+	netcore_thread_stop(ctx);
 
 	// netcore thread is terminated and joined here.
 
+	if (ctx->parent) {
+		pthread_mutex_lock(&ctx->parent->lock);
+		LIST_REMOVE(ctx, next);
+		pthread_mutex_unlock(&ctx->parent->lock);
+		ctx->parent = NULL;
+	}
+	if (ctx->wakeup_ev) {
+		event_del(ctx->wakeup_ev);
+		event_free(ctx->wakeup_ev);
+		ctx->wakeup_ev = NULL;
+	}
+	for (i = 0; i < 2; i++) {
+		if (ctx->wakeup[i] >= 0) {
+			close(ctx->wakeup[i]);
+			ctx->wakeup[i] = -1;
+		}
+	}
+
 	if (ctx->wdt) {
 		event_del(ctx->wdt);
 		event_free(ctx->wdt);
@@ -209,8 +306,12 @@ netcore_reload_hook_add(struct netcore_context *ctx,
 extern void
 netcore_reload(struct netcore_context *ctx)
 {
+	struct netcore_context *worker;
+
 	pthread_mutex_lock(&ctx->lock);
 	ctx->reload = true;
+	LIST_FOREACH(worker, &ctx->workers, next)
+		netcore_reload(worker);
 	pthread_mutex_unlock(&ctx->lock);
 }
 
@@ -221,14 +322,6 @@ netcore_exit(struct netcore_context *ctx)
 	event_base_loopexit(ctx->base, NULL);
 }
 
-static void
-thread_cleanup(void *arg)
-{
-	struct netcore_context *ctx = (struct netcore_context *)arg;
-
-	(void)pthread_mutex_unlock(&ctx->lock);
-}
-
 static void *
 thread_main(void *arg)
 {
@@ -236,20 +329,10 @@ thread_main(void *arg)
 
 	assert(ctx);
 
-	pthread_cleanup_push(thread_cleanup, ctx);
-
 	event_base_dispatch(ctx->base);
 	// NOTE: events are not free()'ed yet.
-	pthread_mutex_lock(&ctx->lock);
-	ctx->cancel = true;
-	pthread_mutex_unlock(&ctx->lock);
-
-	pthread_cleanup_pop(1);
-
-	pthread_exit(arg);
 
-	// not reached
-	return NULL;
+	return arg;
 }
 
 extern int
@@ -264,6 +347,9 @@ netcore_thread_start(struct netcore_context *ctx)
 		p_err("pthread_create() failed: %s\n", strerror(err));
 		return -1;
 	}
+	pthread_mutex_lock(&ctx->lock);
+	ctx->started = true;
+	pthread_mutex_unlock(&ctx->lock);
 
 	return 0;
 }
@@ -271,36 +357,35 @@ netcore_thread_start(struct netcore_context *ctx)
 extern void
 netcore_thread_join(struct netcore_context *ctx)
 {
-	void *ret = NULL;
 	assert(ctx);
 
 	pthread_mutex_lock(&ctx->lock);
-	if (!ctx->stopped) {
+	if (ctx->started && !ctx->stopped) {
 		pthread_mutex_unlock(&ctx->lock);
-		(void)pthread_join(ctx->tid, &ret);
+		(void)pthread_join(ctx->tid, NULL);
 		pthread_mutex_lock(&ctx->lock);
 		ctx->stopped = true;
-		if (ret == PTHREAD_CANCELED) {
-			p_info("netcore thread is canceled.\n");
-		}
 	}
 	pthread_mutex_unlock(&ctx->lock);
 }
 
+/*
+ * the loop is broken by the thread itself, after pending callbacks.
+ * no-op if the loop has exited already.
+ */
 extern void
-netcore_thread_cancel(struct netcore_context *ctx)
+netcore_thread_stop(struct netcore_context *ctx)
 {
+	uint8_t c = 0;
+
 	assert(ctx);
 
-	pthread_mutex_lock(&ctx->lock);
-	if (!ctx->cancel) {
-		pthread_mutex_unlock(&ctx->lock);
-		if (pthread_cancel(ctx->tid) != 0)
-			return;
-		pthread_mutex_lock(&ctx->lock);
-		ctx->cancel = true;
+	__atomic_store_n(&ctx->stop, true, __ATOMIC_RELEASE);
+	if (ctx->wakeup[1] >= 0) {
+		while (write(ctx->wakeup[1], &c, sizeof(c)) < 0 &&
+		    errno == EINTR)
+			;
 	}
-	pthread_mutex_unlock(&ctx->lock);
 
 	return netcore_thread_join(ctx);
 }
@@ -12,6 +12,11 @@ struct netcore_reload_hook {
 	LIST_ENTRY(netcore_reload_hook) next;
 };
 
+/*
+ * a worker context has no signal handlers. reload requests to the
+ * parent are forwarded to the workers. a thread is stopped by the stop
+ * flag and a byte to the wakeup pipe, then joined.
+ */
 struct netcore_context {
 	pthread_mutex_t lock;
 	pthread_t tid;
@@ -19,17 +24,26 @@ struct netcore_context {
 	struct event *sighup;
 	struct event *sigint;
 	struct event *sigterm;
+	struct event *wakeup_ev;
 	struct timeval wdt_to;
+	int wakeup[2];
 	bool reload;
-	bool cancel;
+	bool started;
+	bool stop;
 	bool stopped;
 
 	LIST_HEAD(netcore_rh, netcore_reload_hook) reload_hooks;
 
+	struct netcore_context *parent;
+	LIST_HEAD(netcore_ch, netcore_context) workers;
+	LIST_ENTRY(netcore_context) next;
+
 	struct event_base *base;
 };
 
 extern int netcore_initialize(struct netcore_context *ctx);
+extern int netcore_worker_initialize(struct netcore_context *ctx,
+    struct netcore_context *parent);
 extern void netcore_deinitialize(struct netcore_context *ctx);
 
 extern struct event *netcore_rx_event_add(struct netcore_context *ctx, int fd,
@@ -42,6 +56,6 @@ extern void netcore_exit(struct netcore_context *ctx);
 
 extern int netcore_thread_start(struct netcore_context *ctx);
 extern void netcore_thread_join(struct netcore_context *ctx);
-extern void netcore_thread_cancel(struct netcore_context *ctx);
+extern void netcore_thread_stop(struct netcore_context *ctx);
 
 #endif /* __NET_CORE_H__ */
@@ -1,3 +1,6 @@
+#ifdef __linux__
+#define _GNU_SOURCE /* recvmmsg(), sendmmsg() */
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,6 +14,7 @@
 #include <sys/types.h>
 #include <net/if.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <arpa/inet.h>
 
 #include <event2/event.h>
@@ -19,9 +23,57 @@
 
 #include "wfb_params.h"
 #include "net_inet.h"
+#include "rx_pipe.h"
 #include "util_inet.h"
 #include "util_msg.h"
 
+#if defined(__linux__) && !defined(UDP_SEGMENT)
+#define UDP_SEGMENT 103 /* linux/udp.h */
+#endif
+
+static inline void
+netinet_rx_batch_count(int n)
+{
+	int bucket = 0;
+
+	while (n > 1 && bucket < NETINET_RX_BATCH_HIST - 1) {
+		n >>= 1;
+		bucket++;
+	}
+	wfb_stats.mc_rx_batch[bucket]++;
+}
+
+static inline void
+netinet_rx_set_src(struct sockaddr_in6 *rx_src,
+    struct sockaddr_storage *ss_src, socklen_t ss_len)
+{
+	switch (ss_src->ss_family) {
+		case AF_INET6:
+			memcpy(rx_src, ss_src, ss_len);
+			break;
+		default:
+			rx_src->sin6_family = AF_UNSPEC;
+			break;
+	}
+}
+
+static inline void
+netinet_rx_deliver(struct netinet_rx_context *ctx, uint8_t *rxbuf,
+    size_t rxlen, struct sockaddr_storage *ss_src, socklen_t ss_len)
+{
+	struct sockaddr_in6 rx_src;
+
+	if (ctx->pipe) {
+		netinet_rx_set_src(&rx_src, ss_src, ss_len);
+		rx_pipe_push(ctx->pipe, RX_PIPE_UDP, RX_ADAPTER_NONE,
+		    &rx_src, rxbuf, rxlen);
+		return;
+	}
+
+	netinet_rx_set_src(&ctx->rx_ctx->rx_src, ss_src, ss_len);
+	rx_frame_udp(ctx->rx_ctx, rxbuf, rxlen);
+}
+
 static void
 netinet_rx(evutil_socket_t fd, short event, void *arg)
 {
@@ -44,29 +96,101 @@ retry:
 		netcore_reload(ctx->net_ctx);
 		return;
 	}
+	netinet_rx_batch_count(1);
 
-	switch (ss_src.ss_family) {
-		case AF_INET6:
-			memcpy(&ctx->rx_ctx->rx_src, &ss_src, ss_len);
-			break;
-		default:
-			ctx->rx_ctx->rx_src.sin6_family = AF_UNSPEC;
-			break;
+	netinet_rx_deliver(ctx, ctx->rxbuf, rxlen, &ss_src, ss_len);
+}
+
+#ifdef __linux__
+static void
+netinet_rx_mmsg(evutil_socket_t fd, short event, void *arg)
+{
+	struct netinet_rx_context *ctx = (struct netinet_rx_context *)arg;
+	int i, n;
+
+	assert(ctx);
+
+	for (i = 0; i < ctx->rx_batch; i++) {
+		ctx->rx_msgs[i].msg_hdr.msg_namelen = sizeof(ctx->rx_ss[i]);
+		ctx->rx_msgs[i].msg_len = 0;
 	}
 
-	rx_frame_udp(ctx->rx_ctx, ctx->rxbuf, rxlen);
-}
+retry:
+	n = recvmmsg(fd, ctx->rx_msgs, ctx->rx_batch, MSG_DONTWAIT, NULL);
+	if (n < 0) {
+		if (errno == EINTR) {
+			goto retry;
+		}
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return;
+		}
+		p_debug("recvmmsg() failed: %s.\n", strerror(errno));
+		netcore_reload(ctx->net_ctx);
+		return;
+	}
+	if (n == 0)
+		return;
+	netinet_rx_batch_count(n);
 
+	for (i = 0; i < n; i++) {
+		netinet_rx_deliver(ctx, ctx->rxbufs[i],
+		    ctx->rx_msgs[i].msg_len, &ctx->rx_ss[i],
+		    ctx->rx_msgs[i].msg_hdr.msg_namelen);
+	}
+}
 
-void
-netinet_tx(struct iovec *iov, int iovcnt, void *arg)
+static int
+netinet_rx_mmsg_alloc(struct netinet_rx_context *ctx)
 {
-	struct netinet_tx_context *ctx = (struct netinet_tx_context *)arg;
-	ssize_t n;
+	int i;
 
 	assert(ctx);
-	assert(iov);
-	assert(iovcnt > 0);
+	assert(ctx->rx_batch > 1);
+
+	ctx->rxbufs = calloc(ctx->rx_batch, sizeof(*ctx->rxbufs));
+	ctx->rx_ss = calloc(ctx->rx_batch, sizeof(*ctx->rx_ss));
+	ctx->rx_iov = calloc(ctx->rx_batch, sizeof(*ctx->rx_iov));
+	ctx->rx_msgs = calloc(ctx->rx_batch, sizeof(*ctx->rx_msgs));
+	if (!ctx->rxbufs || !ctx->rx_ss || !ctx->rx_iov || !ctx->rx_msgs) {
+		p_err("cannot allocate memory.\n");
+		return -1;
+	}
+
+	for (i = 0; i < ctx->rx_batch; i++) {
+		ctx->rx_iov[i].iov_base = ctx->rxbufs[i];
+		ctx->rx_iov[i].iov_len = sizeof(ctx->rxbufs[i]);
+		ctx->rx_msgs[i].msg_hdr.msg_name = &ctx->rx_ss[i];
+		ctx->rx_msgs[i].msg_hdr.msg_namelen = sizeof(ctx->rx_ss[i]);
+		ctx->rx_msgs[i].msg_hdr.msg_iov = &ctx->rx_iov[i];
+		ctx->rx_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	return 0;
+}
+#endif
+
+static void
+netinet_rx_mmsg_free(struct netinet_rx_context *ctx)
+{
+	assert(ctx);
+
+	free(ctx->rxbufs);
+	ctx->rxbufs = NULL;
+	free(ctx->rx_ss);
+	ctx->rx_ss = NULL;
+	free(ctx->rx_iov);
+	ctx->rx_iov = NULL;
+#ifdef __linux__
+	free(ctx->rx_msgs);
+	ctx->rx_msgs = NULL;
+#endif
+}
+
+static void
+netinet_tx_writev(struct netinet_tx_context *ctx,
+    struct iovec *iov, int iovcnt)
+{
+	ssize_t n;
 
 retry:
 	/*
@@ -81,6 +205,201 @@ retry:
 		p_err("writev() failed: %s\n", strerror(errno));
 		netcore_reload(ctx->net_ctx);
 	}
+	wfb_stats.mc_tx_syscalls++;
+}
+
+#ifdef __linux__
+static bool
+netinet_tx_gso_ok(struct netinet_tx_context *ctx)
+{
+	int i;
+
+	if (!ctx->tx_gso)
+		return false;
+	if (ctx->tx_used > NETINET_TX_GSO_MAX)
+		return false;
+
+	// all segments must have same size except the last one.
+	for (i = 1; i < ctx->tx_qlen - 1; i++) {
+		if (ctx->tx_len[i] != ctx->tx_len[0])
+			return false;
+	}
+	if (ctx->tx_len[ctx->tx_qlen - 1] > ctx->tx_len[0])
+		return false;
+
+	return true;
+}
+
+static int
+netinet_tx_gso(struct netinet_tx_context *ctx)
+{
+	union {
+		char buf[CMSG_SPACE(sizeof(uint16_t))];
+		struct cmsghdr align;
+	} cmsg;
+	struct cmsghdr *cm;
+	struct msghdr msg;
+	struct iovec iov;
+	uint16_t gso_size = ctx->tx_len[0];
+	ssize_t n;
+
+	iov.iov_base = ctx->tx_buf;
+	iov.iov_len = ctx->tx_used;
+	memset(&msg, 0, sizeof(msg));
+	memset(&cmsg, 0, sizeof(cmsg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsg.buf;
+	msg.msg_controllen = sizeof(cmsg.buf);
+	cm = CMSG_FIRSTHDR(&msg);
+	cm->cmsg_level = SOL_UDP;
+	cm->cmsg_type = UDP_SEGMENT;
+	cm->cmsg_len = CMSG_LEN(sizeof(gso_size));
+	memcpy(CMSG_DATA(cm), &gso_size, sizeof(gso_size));
+
+retry:
+	n = sendmsg(ctx->tx_sock, &msg, 0);
+	wfb_stats.mc_tx_syscalls++;
+	if (n < 0) {
+		if (errno == EINTR) {
+			goto retry;
+		}
+		if (errno == EINVAL || errno == EIO || errno == ENOPROTOOPT) {
+			// kernel or device doesn't support UDP GSO.
+			// the failed attempt is counted as a syscall.
+			p_info("UDP_SEGMENT is not available: %s. "
+			    "Use sendmmsg().\n", strerror(errno));
+			ctx->tx_gso = false;
+			return -1;
+		}
+		p_err("sendmsg() failed: %s\n", strerror(errno));
+		netcore_reload(ctx->net_ctx);
+	}
+	else {
+		wfb_stats.mc_tx_gso++;
+	}
+
+	return 0;
+}
+
+static void
+netinet_tx_mmsg(struct netinet_tx_context *ctx)
+{
+	uint8_t *p = ctx->tx_buf;
+	int i, n, sent;
+
+	for (i = 0; i < ctx->tx_qlen; i++) {
+		ctx->tx_iov[i].iov_base = p;
+		ctx->tx_iov[i].iov_len = ctx->tx_len[i];
+		p += ctx->tx_len[i];
+	}
+
+	for (sent = 0; sent < ctx->tx_qlen; sent += n) {
+		n = sendmmsg(ctx->tx_sock, &ctx->tx_msgs[sent],
+		    ctx->tx_qlen - sent, 0);
+		if (n < 0) {
+			if (errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			p_err("sendmmsg() failed: %s\n", strerror(errno));
+			netcore_reload(ctx->net_ctx);
+			break;
+		}
+		wfb_stats.mc_tx_syscalls++;
+	}
+}
+#endif
+
+static void
+netinet_tx_flush(struct netinet_tx_context *ctx)
+{
+	uint64_t syscalls;
+
+	assert(ctx);
+
+	if (ctx->tx_qlen == 0)
+		return;
+	evtimer_del(ctx->tx_ev);
+
+	if (ctx->tx_sock < 0) {
+		// socket is reopening. drop.
+		goto drop;
+	}
+	syscalls = wfb_stats.mc_tx_syscalls;
+#ifdef __linux__
+	if (ctx->tx_qlen == 1) {
+		ctx->tx_iov[0].iov_base = ctx->tx_buf;
+		ctx->tx_iov[0].iov_len = ctx->tx_len[0];
+		netinet_tx_writev(ctx, &ctx->tx_iov[0], 1);
+		goto done;
+	}
+	if (netinet_tx_gso_ok(ctx) && netinet_tx_gso(ctx) == 0)
+		goto done;
+	netinet_tx_mmsg(ctx);
+#endif
+done:
+	syscalls = wfb_stats.mc_tx_syscalls - syscalls;
+	if (syscalls < ctx->tx_qlen)
+		wfb_stats.mc_tx_syscalls_saved += ctx->tx_qlen - syscalls;
+drop:
+	ctx->tx_qlen = 0;
+	ctx->tx_used = 0;
+}
+
+static void
+netinet_tx_timeout(evutil_socket_t fd, short event, void *arg)
+{
+	struct netinet_tx_context *ctx = (struct netinet_tx_context *)arg;
+
+	assert(ctx);
+
+	netinet_tx_flush(ctx);
+}
+
+void
+netinet_tx(struct iovec *iov, int iovcnt, void *arg)
+{
+	struct netinet_tx_context *ctx = (struct netinet_tx_context *)arg;
+	size_t size = 0;
+	int i;
+
+	assert(ctx);
+	assert(iov);
+	assert(iovcnt > 0);
+
+	if (ctx->tx_buf == NULL) {
+		netinet_tx_writev(ctx, iov, iovcnt);
+		return;
+	}
+
+	for (i = 0; i < iovcnt; i++)
+		size += iov[i].iov_len;
+	if (size > INET6_MTU) {
+		// keep the order of frames.
+		netinet_tx_flush(ctx);
+		netinet_tx_writev(ctx, iov, iovcnt);
+		return;
+	}
+	if (ctx->tx_used + size > NETINET_TX_QUEUE * INET6_MTU)
+		netinet_tx_flush(ctx);
+
+	ctx->tx_len[ctx->tx_qlen] = size;
+	for (i = 0; i < iovcnt; i++) {
+		memcpy(ctx->tx_buf + ctx->tx_used,
+		    iov[i].iov_base, iov[i].iov_len);
+		ctx->tx_used += iov[i].iov_len;
+	}
+	ctx->tx_qlen++;
+
+	if (ctx->tx_qlen == NETINET_TX_QUEUE)
+		netinet_tx_flush(ctx);
+	else if (ctx->tx_qlen == 1 && timerisset(&ctx->tx_hold))
+		evtimer_add(ctx->tx_ev, &ctx->tx_hold);
+	else if (ctx->tx_qlen == 1) {
+		// flush after the other ready events of this loop pass.
+		event_active(ctx->tx_ev, EV_TIMEOUT, 0);
+	}
 }
 
 static int
@@ -110,8 +429,17 @@ netinet_rx_socket_open(void *arg)
 	}
 
 	ctx->rx_sock = s;
-	ctx->rx_ev = netcore_rx_event_add(ctx->net_ctx, ctx->rx_sock,
-	    netinet_rx, ctx);
+#ifdef __linux__
+	if (ctx->rx_batch > 1) {
+		ctx->rx_ev = netcore_rx_event_add(ctx->net_ctx, ctx->rx_sock,
+		    netinet_rx_mmsg, ctx);
+	}
+	else
+#endif
+	{
+		ctx->rx_ev = netcore_rx_event_add(ctx->net_ctx, ctx->rx_sock,
+		    netinet_rx, ctx);
+	}
 	if (ctx->rx_ev == NULL) {
 		p_err("Cannot register inet event.\n");
 		goto err;
@@ -131,7 +459,7 @@ int
 netinet_rx_initialize(struct netinet_rx_context *ctx,
     struct netcore_context *net_ctx,
     struct rx_context *rx_ctx,
-    const char *dev)
+    const char *dev, int batch)
 {
 	assert(ctx);
 	assert(net_ctx);
@@ -144,6 +472,20 @@ netinet_rx_initialize(struct netinet_rx_context *ctx,
 	ctx->dev = dev;
 	ctx->rx_sock = -1;
 
+	if (batch > NETINET_RX_BATCH_MAX)
+		batch = NETINET_RX_BATCH_MAX;
+#ifdef __linux__
+	ctx->rx_batch = (batch > 1) ? batch : 1;
+	if (ctx->rx_batch > 1 && netinet_rx_mmsg_alloc(ctx) < 0) {
+		netinet_rx_mmsg_free(ctx);
+		return -1;
+	}
+#else
+	if (batch > 1)
+		p_info("recvmmsg() is not supported. batch disabled.\n");
+	ctx->rx_batch = 1;
+#endif
+
 	netcore_reload_hook_add(net_ctx, netinet_rx_socket_open, ctx);
 
 	return netinet_rx_socket_open(ctx);
@@ -181,9 +523,61 @@ err:
 	return -1;
 }
 
+#ifdef __linux__
+static int
+netinet_tx_queue_alloc(struct netinet_tx_context *ctx, int hold_us)
+{
+	int i;
+
+	assert(ctx);
+
+	ctx->tx_buf = malloc(NETINET_TX_QUEUE * INET6_MTU);
+	ctx->tx_msgs = calloc(NETINET_TX_QUEUE, sizeof(*ctx->tx_msgs));
+	if (ctx->tx_buf == NULL || ctx->tx_msgs == NULL) {
+		p_err("cannot allocate memory.\n");
+		return -1;
+	}
+	for (i = 0; i < NETINET_TX_QUEUE; i++) {
+		// socket is connected. no msg_name.
+		ctx->tx_msgs[i].msg_hdr.msg_iov = &ctx->tx_iov[i];
+		ctx->tx_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	// without the hold time, the event is activated by hand.
+	ctx->tx_ev = event_new(ctx->net_ctx->base, -1, 0,
+	    netinet_tx_timeout, ctx);
+	if (ctx->tx_ev == NULL) {
+		p_err("Cannot create timer.\n");
+		return -1;
+	}
+	ctx->tx_hold.tv_sec = hold_us / 1000000;
+	ctx->tx_hold.tv_usec = hold_us % 1000000;
+	ctx->tx_gso = true;
+
+	return 0;
+}
+#endif
+
+static void
+netinet_tx_queue_free(struct netinet_tx_context *ctx)
+{
+	assert(ctx);
+
+	if (ctx->tx_ev) {
+		event_free(ctx->tx_ev);
+		ctx->tx_ev = NULL;
+	}
+	free(ctx->tx_buf);
+	ctx->tx_buf = NULL;
+#ifdef __linux__
+	free(ctx->tx_msgs);
+	ctx->tx_msgs = NULL;
+#endif
+}
+
 int
 netinet_tx_initialize(struct netinet_tx_context *ctx,
-    struct netcore_context *net_ctx, const char *dev)
+    struct netcore_context *net_ctx, const char *dev, int hold_us)
 {
 	assert(ctx);
 	assert(dev);
@@ -193,11 +587,28 @@ netinet_tx_initialize(struct netinet_tx_context *ctx,
 	ctx->dev = dev;
 	ctx->tx_sock = -1;
 
+#ifdef __linux__
+	if (netinet_tx_queue_alloc(ctx, hold_us) < 0) {
+		netinet_tx_queue_free(ctx);
+		return -1;
+	}
+#else
+	p_debug("sendmmsg() is not supported. Tx queue disabled.\n");
+#endif
+
 	netcore_reload_hook_add(net_ctx, netinet_tx_socket_open, ctx);
 
 	return netinet_tx_socket_open(ctx);
 }
 
+void
+netinet_rx_set_pipe(struct netinet_rx_context *ctx, struct rx_pipe *pipe)
+{
+	assert(ctx);
+
+	ctx->pipe = pipe;
+}
+
 void
 netinet_rx_deinitialize(struct netinet_rx_context *ctx)
 {
@@ -211,6 +622,7 @@ netinet_rx_deinitialize(struct netinet_rx_context *ctx)
 		close(ctx->rx_sock);
 		ctx->rx_sock = -1;
 	}
+	netinet_rx_mmsg_free(ctx);
 }
 
 void
@@ -218,6 +630,8 @@ netinet_tx_deinitialize(struct netinet_tx_context *ctx)
 {
 	assert(ctx);
 
+	netinet_tx_flush(ctx);
+	netinet_tx_queue_free(ctx);
 	if (ctx->tx_sock >= 0) {
 		close(ctx->tx_sock);
 		ctx->tx_sock = -1;
@@ -1,8 +1,10 @@
 #ifndef __NET_INET6_H__
 #define __NET_INET6_H__
 #include <stdint.h>
+#include <stdbool.h>
 #include <unistd.h>
 #include <sys/uio.h>
+#include <sys/socket.h>
 #include <netinet/in.h>
 #include <event2/event.h>
 
@@ -10,6 +12,8 @@
 #include "net_core.h"
 #include "rx_core.h"
 
+struct rx_pipe;
+
 struct netinet_rx_context {
 	struct netcore_context *net_ctx;
 	struct rx_context *rx_ctx;
@@ -18,22 +22,47 @@ struct netinet_rx_context {
 	bool multicast_rx;
 	int rx_sock;
 	struct event *rx_ev;
+	struct rx_pipe *pipe; // optional. pipelined mode.
 
 	uint8_t rxbuf[INET6_MTU];
+
+	/* batched receive (recvmmsg) */
+	int rx_batch;
+	uint8_t (*rxbufs)[INET6_MTU];
+	struct sockaddr_storage *rx_ss;
+	struct iovec *rx_iov;
+#ifdef __linux__
+	struct mmsghdr *rx_msgs;
+#endif
 };
 
 struct netinet_tx_context {
 	struct netcore_context *net_ctx;
 	const char *dev;
 	int tx_sock;
+
+	/* batched transmit (sendmmsg/UDP_SEGMENT) */
+	struct timeval tx_hold;
+	struct event *tx_ev;
+	bool tx_gso;
+	int tx_qlen;
+	size_t tx_used;
+	uint8_t *tx_buf;
+	size_t tx_len[NETINET_TX_QUEUE];
+	struct iovec tx_iov[NETINET_TX_QUEUE];
+#ifdef __linux__
+	struct mmsghdr *tx_msgs;
+#endif
 };
 
 extern int netinet_rx_initialize(struct netinet_rx_context *ctx,
     struct netcore_context *core_ctx,
     struct rx_context *rx_ctx,
-    const char *dev);
+    const char *dev, int batch);
 extern int netinet_tx_initialize(struct netinet_tx_context *ctx,
-    struct netcore_context *core_ctx, const char *dev);
+    struct netcore_context *core_ctx, const char *dev, int hold_us);
+extern void netinet_rx_set_pipe(struct netinet_rx_context *ctx,
+    struct rx_pipe *pipe);
 extern void netinet_rx_deinitialize(struct netinet_rx_context *ctx);
 extern void netinet_tx_deinitialize(struct netinet_tx_context *ctx);
 
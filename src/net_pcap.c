@@ -9,6 +9,7 @@
 
 #include "net_core.h"
 #include "rx_core.h"
+#include "rx_pipe.h"
 #include "net_pcap.h"
 #include "util_msg.h"
 
@@ -44,28 +45,42 @@ netpcap_rx(evutil_socket_t fd, short event, void *arg)
 		return;
 	}
 
+	if (ctx->pipe) {
+		rx_pipe_push(ctx->pipe, RX_PIPE_PCAP, ctx->adapter,
+		    NULL, rxbuf, rxlen);
+		return;
+	}
+	ctx->rx_ctx->rx_adapter = ctx->adapter;
 	rx_frame_pcap(ctx->rx_ctx, rxbuf, rxlen);
 
 	return;
 }
 
-static int
-netpcap_filter_initialize(pcap_t *pcap, uint32_t channel_id)
+static void
+netpcap_filter_string(char *str_pg, size_t len, uint32_t channel_id)
 {
-	struct bpf_program bpf_pg;
-	char str_pg[BUFSIZ];
-
-	assert(pcap);
+	assert(str_pg);
 
 	if (channel_id > 0) {
-		snprintf(str_pg, sizeof(str_pg),
+		snprintf(str_pg, len,
 		    "ether[0xa:2] == 0x%04x && ether[0x0c:4] == 0x%08x",
 		    WFB_SIG, channel_id);
 	}
 	else {
-		snprintf(str_pg, sizeof(str_pg), "ether[0xa:2] == 0x%04x",
+		snprintf(str_pg, len, "ether[0xa:2] == 0x%04x",
 		    WFB_SIG);
 	}
+}
+
+static int
+netpcap_filter_initialize(pcap_t *pcap, uint32_t channel_id)
+{
+	struct bpf_program bpf_pg;
+	char str_pg[BUFSIZ];
+
+	assert(pcap);
+
+	netpcap_filter_string(str_pg, sizeof(str_pg), channel_id);
 
 	if (pcap_compile(pcap, &bpf_pg, str_pg, 1, 0) == -1) {
 		p_err("%s: %s\n", pcap_geterr(pcap), str_pg);
@@ -82,11 +97,37 @@ netpcap_filter_initialize(pcap_t *pcap, uint32_t channel_id)
 	return 0;
 }
 
+int
+netpcap_filter_compile(struct bpf_program *bpf_pg, uint32_t channel_id)
+{
+	pcap_t *pcap;
+	char str_pg[BUFSIZ];
+
+	assert(bpf_pg);
+
+	pcap = pcap_open_dead(DLT_IEEE802_11_RADIO, PCAP_MTU);
+	if (pcap == NULL) {
+		p_err("pcap_open_dead() failed.\n");
+		return -1;
+	}
+
+	netpcap_filter_string(str_pg, sizeof(str_pg), channel_id);
+
+	if (pcap_compile(pcap, bpf_pg, str_pg, 1, 0) == -1) {
+		p_err("%s: %s\n", pcap_geterr(pcap), str_pg);
+		pcap_close(pcap);
+		return -1;
+	}
+
+	pcap_close(pcap);
+	return 0;
+}
+
 int
 netpcap_initialize(struct netpcap_context *ctx,
     struct netcore_context *net_ctx,
     struct rx_context *rx_ctx,
-    const char *dev, bool use_monitor)
+    const char *dev, int adapter, bool use_monitor)
 {
 	pcap_t *pcap = NULL;
 	char errbuf[PCAP_ERRBUF_SIZE] = {'\0'};
@@ -102,6 +143,7 @@ netpcap_initialize(struct netpcap_context *ctx,
 	memset(ctx, 0, sizeof(*ctx));
 	ctx->net_ctx = net_ctx;
 	ctx->rx_ctx = rx_ctx;
+	ctx->adapter = adapter;
 	ctx->fd = -1;
 
 	pcap = pcap_create(dev, errbuf);
@@ -180,6 +222,14 @@ err:
 	return -1;
 }
 
+void
+netpcap_set_pipe(struct netpcap_context *ctx, struct rx_pipe *pipe)
+{
+	assert(ctx);
+
+	ctx->pipe = pipe;
+}
+
 void
 netpcap_deinitialize(struct netpcap_context *ctx)
 {
@@ -9,10 +9,15 @@
 #include "net_core.h"
 #include "rx_core.h"
 
+struct rx_pipe;
+
 struct netpcap_context {
 	struct netcore_context *net_ctx;
 	struct rx_context *rx_ctx;
 
+	int adapter;
+	struct rx_pipe *pipe; // optional. pipelined mode.
+
 	pcap_t *pcap;
 	int fd;
 	struct event *ev;
@@ -21,7 +26,11 @@ struct netpcap_context {
 extern int netpcap_initialize(struct netpcap_context *ctx,
     struct netcore_context *net_ctx,
     struct rx_context *rx_ctx,
-    const char *dev, bool use_monitor);
+    const char *dev, int adapter, bool use_monitor);
+extern void netpcap_set_pipe(struct netpcap_context *ctx,
+    struct rx_pipe *pipe);
 extern void netpcap_deinitialize(struct netpcap_context *ctx);
+extern int netpcap_filter_compile(struct bpf_program *bpf_pg,
+    uint32_t channel_id);
 
 #endif /* __NET_PCAP_H__ */
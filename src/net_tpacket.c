@@ -0,0 +1,396 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <assert.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <netinet/in.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+
+#include <pcap.h>
+
+#include "net_core.h"
+#include "net_pcap.h"
+#include "net_tpacket.h"
+#include "rx_core.h"
+#include "rx_pipe.h"
+#include "util_msg.h"
+
+#ifndef ARPHRD_IEEE80211_RADIOTAP
+#define ARPHRD_IEEE80211_RADIOTAP 803
+#endif
+
+static void
+nettpacket_drops(struct nettpacket_context *ctx)
+{
+	struct tpacket_stats_v3 st;
+	socklen_t len = sizeof(st);
+
+	if (getsockopt(ctx->fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) < 0) {
+		p_err("getsockopt(PACKET_STATISTICS) failed: %s\n",
+		    strerror(errno));
+		return;
+	}
+	// counters are cleared by reading.
+	__atomic_add_fetch(&wfb_stats.tpacket_drops, st.tp_drops,
+	    __ATOMIC_RELAXED);
+	__atomic_add_fetch(&wfb_stats.tpacket_freeze, st.tp_freeze_q_cnt,
+	    __ATOMIC_RELAXED);
+}
+
+static void
+nettpacket_walk_block(struct nettpacket_context *ctx,
+    struct tpacket_block_desc *bd)
+{
+	struct tpacket3_hdr *ppd;
+	uint32_t i;
+
+	if (ctx->pipe == NULL)
+		ctx->rx_ctx->rx_adapter = ctx->adapter;
+	ppd = (struct tpacket3_hdr *)((uint8_t *)bd +
+	    bd->hdr.bh1.offset_to_first_pkt);
+	for (i = 0; i < bd->hdr.bh1.num_pkts; i++) {
+		if (ppd->tp_snaplen < ppd->tp_len)
+			__atomic_add_fetch(&wfb_stats.tpacket_truncated, 1,
+			    __ATOMIC_RELAXED);
+		if (ctx->pipe) {
+			rx_pipe_push_ref(ctx->pipe, RX_PIPE_PCAP, ctx->adapter,
+			    (uint8_t *)ppd + ppd->tp_mac, ppd->tp_snaplen);
+		}
+		else {
+			rx_frame_pcap(ctx->rx_ctx,
+			    (uint8_t *)ppd + ppd->tp_mac, ppd->tp_snaplen);
+		}
+		ppd = (struct tpacket3_hdr *)((uint8_t *)ppd +
+		    ppd->tp_next_offset);
+	}
+	// capture threads of adapters share the counters.
+	__atomic_add_fetch(&wfb_stats.tpacket_frames, bd->hdr.bh1.num_pkts,
+	    __ATOMIC_RELAXED);
+	__atomic_add_fetch(&wfb_stats.tpacket_blocks, 1, __ATOMIC_RELAXED);
+}
+
+static struct tpacket_block_desc *
+nettpacket_block(struct nettpacket_context *ctx, unsigned int idx)
+{
+	return (struct tpacket_block_desc *)(ctx->ring +
+	    idx * ctx->req.tp_block_size);
+}
+
+static void
+nettpacket_block_return(struct tpacket_block_desc *bd)
+{
+	__atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL,
+	    __ATOMIC_RELEASE);
+}
+
+static void
+nettpacket_reclaim(struct nettpacket_context *ctx)
+{
+	while (ctx->block_held > 0 &&
+	    rx_pipe_consumed(ctx->pipe, ctx->block_pos[ctx->block_done])) {
+		nettpacket_block_return(nettpacket_block(ctx,
+		    ctx->block_done));
+		ctx->block_done = (ctx->block_done + 1) % ctx->req.tp_block_nr;
+		ctx->block_held--;
+	}
+}
+
+static bool
+nettpacket_hold(struct nettpacket_context *ctx)
+{
+	if (ctx->block_held == 0) {
+		if (!ctx->polling) {
+			(void)event_add(ctx->ev, NULL);
+			ctx->polling = true;
+		}
+		return true;
+	}
+	if (!rx_pipe_wait(ctx->pipe, ctx->block_pos[ctx->block_done]))
+		return false;
+
+	/*
+	 * the socket stays readable while we hold a block. stop polling
+	 * it until the processing thread passes the oldest one.
+	 */
+	if (ctx->polling) {
+		(void)event_del(ctx->ev);
+		ctx->polling = false;
+	}
+	return true;
+}
+
+static void
+nettpacket_rx(evutil_socket_t fd, short event, void *arg)
+{
+	struct nettpacket_context *ctx = (struct nettpacket_context *)arg;
+	struct tpacket_block_desc *bd;
+	bool losing = false;
+
+	assert(ctx);
+
+again:
+	if (ctx->pipe)
+		nettpacket_reclaim(ctx);
+	for (;;) {
+		if (ctx->block_held == ctx->req.tp_block_nr)
+			break; // all blocks are in the pipe.
+		bd = nettpacket_block(ctx, ctx->block_cur);
+		if ((__atomic_load_n(&bd->hdr.bh1.block_status,
+		    __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0)
+			break;
+		if (bd->hdr.bh1.block_status & TP_STATUS_LOSING)
+			losing = true;
+
+		nettpacket_walk_block(ctx, bd);
+
+		if (ctx->pipe) {
+			ctx->block_pos[ctx->block_cur] =
+			    rx_pipe_head(ctx->pipe);
+			ctx->block_held++;
+		}
+		else {
+			// return the block to the kernel.
+			nettpacket_block_return(bd);
+		}
+		ctx->block_cur = (ctx->block_cur + 1) % ctx->req.tp_block_nr;
+	}
+
+	if (losing)
+		nettpacket_drops(ctx);
+	if (ctx->pipe && !nettpacket_hold(ctx)) {
+		losing = false;
+		goto again;
+	}
+
+	return;
+}
+
+static void
+nettpacket_release(evutil_socket_t fd, short event, void *arg)
+{
+	struct nettpacket_context *ctx = (struct nettpacket_context *)arg;
+
+	assert(ctx);
+
+	rx_pipe_wait_done(ctx->pipe);
+	nettpacket_rx(ctx->fd, EV_READ, ctx);
+}
+
+static int
+nettpacket_filter_initialize(int fd, uint32_t channel_id)
+{
+	struct bpf_program bpf_pg;
+	struct sock_fprog fprog;
+
+	if (netpcap_filter_compile(&bpf_pg, channel_id) < 0)
+		return -1;
+
+	fprog.len = bpf_pg.bf_len;
+	fprog.filter = (struct sock_filter *)bpf_pg.bf_insns;
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER,
+	    &fprog, sizeof(fprog)) < 0) {
+		p_err("setsockopt(SO_ATTACH_FILTER) failed: %s\n",
+		    strerror(errno));
+		pcap_freecode(&bpf_pg);
+		return -1;
+	}
+
+	pcap_freecode(&bpf_pg);
+	return 0;
+}
+
+static int
+nettpacket_check_link(int fd, const char *dev)
+{
+	struct ifreq ifr;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, dev, sizeof(ifr.ifr_name) - 1);
+	if (ioctl(fd, SIOCGIFHWADDR, &ifr) < 0) {
+		p_err("ioctl(SIOCGIFHWADDR) failed: %s\n", strerror(errno));
+		return -1;
+	}
+	if (ifr.ifr_hwaddr.sa_family != ARPHRD_IEEE80211_RADIOTAP) {
+		p_err("%s is not an IEEE802.11 monitor device.\n", dev);
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+nettpacket_initialize(struct nettpacket_context *ctx,
+    struct netcore_context *net_ctx,
+    struct rx_context *rx_ctx,
+    const char *dev, int adapter, bool use_monitor)
+{
+	struct sockaddr_ll sll;
+	struct packet_mreq mreq;
+	int version = TPACKET_V3;
+	unsigned int ifindex;
+	int s = -1;
+
+	assert(ctx);
+	assert(net_ctx);
+	assert(rx_ctx);
+	assert(dev);
+
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->net_ctx = net_ctx;
+	ctx->rx_ctx = rx_ctx;
+	ctx->adapter = adapter;
+	ctx->fd = -1;
+
+	ifindex = if_nametoindex(dev);
+	if (ifindex == 0) {
+		p_err("Unknown device %s: %s\n", dev, strerror(errno));
+		goto err;
+	}
+
+	// don't receive anything until the filter is attached.
+	s = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, 0);
+	if (s < 0) {
+		p_err("socket(AF_PACKET) failed: %s\n", strerror(errno));
+		goto err;
+	}
+	if (nettpacket_check_link(s, dev) < 0)
+		goto err;
+	if (use_monitor) {
+		/* libpcap creates monN interface, but we don't. */
+		p_err("TPACKET: RFMonitor mode is not supported. "
+		    "Set %s to monitor mode by iw(8).\n", dev);
+		goto err;
+	}
+	if (nettpacket_filter_initialize(s, rx_ctx->channel_id) < 0) {
+		p_err("Cannot initialize filter.\n");
+		goto err;
+	}
+	if (setsockopt(s, SOL_PACKET, PACKET_VERSION,
+	    &version, sizeof(version)) < 0) {
+		p_err("setsockopt(PACKET_VERSION) failed: %s\n",
+		    strerror(errno));
+		goto err;
+	}
+
+	ctx->req.tp_block_size = TPACKET_BLOCK_SIZE;
+	ctx->req.tp_block_nr = TPACKET_BLOCK_NR;
+	ctx->req.tp_frame_size = TPACKET_FRAME_SIZE;
+	ctx->req.tp_frame_nr = (TPACKET_BLOCK_SIZE / TPACKET_FRAME_SIZE) *
+	    TPACKET_BLOCK_NR;
+	ctx->req.tp_retire_blk_tov = TPACKET_RETIRE_TOV;
+	ctx->req.tp_feature_req_word = 0;
+	if (setsockopt(s, SOL_PACKET, PACKET_RX_RING,
+	    &ctx->req, sizeof(ctx->req)) < 0) {
+		p_err("setsockopt(PACKET_RX_RING) failed: %s\n",
+		    strerror(errno));
+		goto err;
+	}
+
+	ctx->ring_len = (size_t)ctx->req.tp_block_size * ctx->req.tp_block_nr;
+	ctx->ring = mmap(NULL, ctx->ring_len, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_LOCKED, s, 0);
+	if (ctx->ring == MAP_FAILED) {
+		// MAP_LOCKED requires CAP_IPC_LOCK or enough RLIMIT_MEMLOCK.
+		ctx->ring = mmap(NULL, ctx->ring_len, PROT_READ | PROT_WRITE,
+		    MAP_SHARED, s, 0);
+	}
+	if (ctx->ring == MAP_FAILED) {
+		p_err("mmap() failed: %s\n", strerror(errno));
+		ctx->ring = NULL;
+		goto err;
+	}
+
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_ALL);
+	sll.sll_ifindex = ifindex;
+	if (bind(s, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+		p_err("bind(%s) failed: %s\n", dev, strerror(errno));
+		goto err;
+	}
+
+	if (!use_monitor) {
+		memset(&mreq, 0, sizeof(mreq));
+		mreq.mr_ifindex = ifindex;
+		mreq.mr_type = PACKET_MR_PROMISC;
+		if (setsockopt(s, SOL_PACKET, PACKET_ADD_MEMBERSHIP,
+		    &mreq, sizeof(mreq)) < 0) {
+			p_err("Cannot set promisc: %s\n", strerror(errno));
+			goto err;
+		}
+	}
+
+	ctx->fd = s;
+	ctx->ev = netcore_rx_event_add(net_ctx, ctx->fd, nettpacket_rx, ctx);
+	if (ctx->ev == NULL) {
+		p_err("Cannot register event.\n");
+		goto err;
+	}
+	ctx->polling = true;
+	p_debug("TPACKET_V3 ring: %u blocks x %u bytes\n",
+	    ctx->req.tp_block_nr, ctx->req.tp_block_size);
+
+	return ctx->fd;
+err:
+	if (ctx->ring) {
+		munmap(ctx->ring, ctx->ring_len);
+		ctx->ring = NULL;
+	}
+	if (s >= 0)
+		close(s);
+	ctx->fd = -1;
+	return -1;
+}
+
+int
+nettpacket_set_pipe(struct nettpacket_context *ctx, struct rx_pipe *pipe)
+{
+	assert(ctx);
+	assert(pipe);
+
+	// called before the capture thread starts.
+	ctx->release_ev = netcore_rx_event_add(ctx->net_ctx,
+	    pipe->release[0], nettpacket_release, ctx);
+	if (ctx->release_ev == NULL) {
+		p_err("Cannot register event.\n");
+		return -1;
+	}
+	ctx->pipe = pipe;
+
+	return 0;
+}
+
+void
+nettpacket_deinitialize(struct nettpacket_context *ctx)
+{
+	assert(ctx);
+
+	if (ctx->release_ev) {
+		netcore_rx_event_del(ctx->net_ctx, ctx->release_ev);
+		ctx->release_ev = NULL;
+	}
+	if (ctx->ev) {
+		netcore_rx_event_del(ctx->net_ctx, ctx->ev);
+		ctx->ev = NULL;
+	}
+	if (ctx->ring) {
+		munmap(ctx->ring, ctx->ring_len);
+		ctx->ring = NULL;
+	}
+	if (ctx->fd >= 0) {
+		close(ctx->fd);
+		ctx->fd = -1;
+	}
+}
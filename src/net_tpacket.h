@@ -0,0 +1,55 @@
+#ifndef __NET_TPACKET_H__
+#define __NET_TPACKET_H__
+#include <stdint.h>
+#include <stdbool.h>
+#include <linux/if_packet.h>
+#include <event2/event.h>
+
+#include "wfb_params.h"
+#include "net_core.h"
+#include "rx_core.h"
+
+/*
+ * AF_PACKET TPACKET_V3 capture backend (Linux only).
+ *
+ * The kernel fills a memory mapped ring of blocks, each block holds
+ * multiple frames. One wakeup processes all blocks handed over to
+ * the user space, frames are passed to rx_frame_pcap() in place.
+ * In pipelined mode, references to the frames are pushed to the pipe,
+ * and the block is returned to the kernel after the processing thread
+ * passed it.
+ */
+struct rx_pipe;
+
+struct nettpacket_context {
+	struct netcore_context *net_ctx;
+	struct rx_context *rx_ctx;
+
+	int adapter;
+	struct rx_pipe *pipe; // optional. pipelined mode.
+
+	int fd;
+	struct event *ev;
+
+	struct tpacket_req3 req;
+	uint8_t *ring;
+	size_t ring_len;
+	unsigned int block_cur;
+
+	/* pipelined mode */
+	struct event *release_ev;
+	bool polling; // ev is added
+	unsigned int block_done; // oldest block held by us
+	unsigned int block_held;
+	uint32_t block_pos[TPACKET_BLOCK_NR]; // pipe head after the block
+};
+
+extern int nettpacket_initialize(struct nettpacket_context *ctx,
+    struct netcore_context *net_ctx,
+    struct rx_context *rx_ctx,
+    const char *dev, int adapter, bool use_monitor);
+extern int nettpacket_set_pipe(struct nettpacket_context *ctx,
+    struct rx_pipe *pipe);
+extern void nettpacket_deinitialize(struct nettpacket_context *ctx);
+
+#endif /* __NET_TPACKET_H__ */
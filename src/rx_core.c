@@ -8,12 +8,16 @@
 #include <unistd.h>
 #include <sys/uio.h>
 
+#include <event2/event.h>
+
 #include "compat.h"
 
 #include "rx_core.h"
 #include "rx_session.h"
 #include "rx_data.h"
 #include "rx_log.h"
+#include "rx_worker.h"
+#include "net_core.h"
 #include "util_msg.h"
 
 int
@@ -23,6 +27,7 @@ rx_context_initialize(struct rx_context *ctx, uint32_t channel_id)
 
 	memset(ctx, 0, sizeof(*ctx));
 	ctx->channel_id = channel_id;
+	ctx->rx_adapter = RX_ADAPTER_NONE;
 
 	return 0;
 }
@@ -32,10 +37,20 @@ rx_context_deinitialize(struct rx_context *ctx)
 {
 	assert(ctx);
 
+	if (ctx->workers) {
+		rx_worker_destroy(ctx->workers);
+		ctx->workers = NULL;
+	}
+	if (ctx->reorder_ev) {
+		evtimer_del(ctx->reorder_ev);
+		event_free(ctx->reorder_ev);
+		ctx->reorder_ev = NULL;
+	}
 	if (ctx->rx_ring) {
 		rbuf_free(ctx->rx_ring);
 		ctx->rx_ring = NULL;
 	}
+	rx_log_close(ctx);
 }
 
 int
@@ -97,6 +112,90 @@ rx_context_set_mirror(struct rx_context *ctx,
 	return -1;
 }
 
+int
+rx_context_set_workers(struct rx_context *ctx,
+    struct netcore_context *net_ctx, int n)
+{
+	assert(ctx);
+	assert(net_ctx);
+
+	if (n <= 1)
+		return 0; // decrypt inline.
+
+	ctx->workers = rx_worker_create(net_ctx, ctx, n);
+	if (ctx->workers == NULL)
+		return -1;
+
+	return 0;
+}
+
+int
+rx_context_set_reorder(struct rx_context *ctx,
+    struct netcore_context *net_ctx, int msec)
+{
+	assert(ctx);
+	assert(net_ctx);
+
+	if (msec <= 0)
+		return 0; // purge stale blocks immediately.
+
+	ctx->reorder_ev = evtimer_new(net_ctx->base, rx_data_timeout, ctx);
+	if (ctx->reorder_ev == NULL) {
+		p_err("Cannot create reorder timer.\n");
+		return -1;
+	}
+	ctx->reorder_us = (uint64_t)msec * 1000;
+
+	return 0;
+}
+
+int
+rx_context_set_relay(struct rx_context *ctx, bool relay)
+{
+	assert(ctx);
+
+	if (relay && ctx->n_decode_handler > 0) {
+		p_err("Cannot relay frames with decoders.\n");
+		return -1;
+	}
+	ctx->relay = relay;
+
+	return 0;
+}
+
+/*
+ * the same fragment is captured by every adapter. mirror it only once.
+ * the check needs the clear text header only, so it works in relay mode.
+ */
+static bool
+rx_mirror_duplicate(struct rx_context *ctx, uint8_t *data, size_t size)
+{
+	struct wfb_ng_hdr *hdr = (struct wfb_ng_hdr *)data;
+	struct rx_mirror_seen *seen;
+	uint64_t nonce;
+	uint32_t tag;
+
+	if (size < MIN_DATA_PACKET_LEN ||
+	    hdr->packet_type != WFB_PACKET_DATA)
+		return false;
+
+	memcpy(&nonce, hdr->u.data.nonce, sizeof(nonce));
+	nonce = be64toh(nonce);
+	memcpy(&tag, data + size - crypto_aead_chacha20poly1305_ABYTES,
+	    sizeof(tag));
+
+	// block_idx in upper bits, fragment_idx (< 32 in practice) in lower.
+	seen = &ctx->mirror_seen[((nonce >> 8) << 5 ^ nonce) &
+	    (RX_MIRROR_SEEN - 1)];
+	if (seen->used && seen->nonce == nonce && seen->tag == tag)
+		return true;
+	seen->nonce = nonce;
+	seen->tag = tag;
+	seen->used = true;
+
+	return false;
+}
+
 void
 rx_mirror_frame(struct rx_context *ctx, uint8_t *data, size_t size)
 {
@@ -112,6 +211,10 @@ rx_mirror_frame(struct rx_context *ctx, uint8_t *data, size_t size)
 		flags |= UDP_FLAG_CORRUPT;
 		iovcnt = 1;
 	}
+	else if (rx_mirror_duplicate(ctx, data, size)) {
+		wfb_stats.mirror_duplicate++;
+		return;
+	}
 
 	ctx->udp.freq = ctx->freq;
 	ctx->udp.dbm = ctx->dbm;
@@ -155,10 +258,10 @@ rx_context_dump(struct rx_context *ctx)
 	p_info("FEC Type: %u\n", ctx->fec_type);
 	p_info("FEC K: %u\n", ctx->fec_k);
 	p_info("FEC N: %u\n", ctx->fec_n);
-	if (ctx->has_session_key) {
+	if (ctx->crypto.has_session_key) {
 		p_info("Session Key : ");
-		for (i = 0; i < sizeof(ctx->session_key); i++)
-			p_info("%02x", ctx->session_key[i]);
+		for (i = 0; i < sizeof(ctx->crypto.session_key); i++)
+			p_info("%02x", ctx->crypto.session_key[i]);
 		p_info("\n");
 	}
 	else {
@@ -189,6 +292,7 @@ rx_frame_pcap(struct rx_context *ctx, void *rxbuf, size_t rxlen)
 	assert(rxbuf);
 	assert(ctx);
 
+	// NOTE: ctx->rx_adapter is set by net_pcap.c or net_tpacket.c
 	ctx->rx_src.sin6_family = AF_UNSPEC;
 
 	parsed = pcap_frame_parse(rxbuf, rxlen, &ctx->pcap);
@@ -230,6 +334,11 @@ rx_frame_pcap(struct rx_context *ctx, void *rxbuf, size_t rxlen)
 	}
 
 	rx_mirror_frame(ctx, rxbuf, rxlen);
+	if (ctx->relay) {
+		// nobody consumes the payload.
+		wfb_stats.pcap_relayed++;
+		return 0;
+	}
 
 	parsed = wfb_frame_parse(rxbuf, rxlen, &ctx->wfb);
 	if (parsed < 0) {
@@ -239,6 +348,8 @@ rx_frame_pcap(struct rx_context *ctx, void *rxbuf, size_t rxlen)
 	rxbuf += parsed;
 	rxlen -= parsed;
 	wfb_stats.pcap_accept++;
+	if (ctx->rx_adapter >= 0)
+		wfb_stats.pcap_adapter_accept[ctx->rx_adapter]++;
 
 	return rx_wfb(ctx);
 }
@@ -252,6 +363,7 @@ rx_frame_udp(struct rx_context *ctx, void *rxbuf, size_t rxlen)
 	assert(ctx);
 
 	// NOTE: ctx->rx_src is set by net_inet6.c
+	ctx->rx_adapter = RX_ADAPTER_NONE;
 
 	parsed = udp_frame_parse(rxbuf, rxlen, &ctx->udp);
 	if (parsed < 0) {
@@ -12,24 +12,45 @@
 #include "frame_wfb.h"
 #include "frame_udp.h"
 #include "fec_wfb.h"
+#include "crypto_wfb.h"
 
 struct rx_mirror_handler {
 	void (*func)(struct iovec *iov, int iovcnt, void *arg);
 	void *arg;
 };
 
+struct rx_mirror_seen {
+	uint64_t nonce;
+	uint32_t tag; // head of the MAC. differs between sessions.
+	bool used;
+};
+
 struct rx_decode_handler {
 	void (*func)(int8_t rssi, uint8_t *data, size_t size, void *arg);
 	void *arg;
 };
 
+struct wbuf;
+
+/*
+ * the log is written by one wbuf for the life of the process. frames and
+ * messages are put from any thread, so the wbuf is never freed while
+ * they run. a rotation is a marker record handled by the writer thread.
+ */
 struct rx_log_handler {
-	char file_name[PATH_MAX];
-	int seq;
-	FILE *fp;
+	char file_name[PATH_MAX]; // first segment
+	struct wbuf *wbuf; // set once
+	uint64_t rotate; // header of the next segment, 0 if none
+	uint64_t msg_seq;
 };
 
 
+#define RX_ADAPTER_NONE (-1)
+
+struct netcore_context;
+struct rx_worker_pool;
+struct event;
+
 struct rx_context {
 	struct pcap_context pcap;
 	struct radiotap_context radiotap;
@@ -46,20 +67,32 @@ struct rx_context {
 	uint8_t fec_type;
 	uint8_t fec_k;
 	uint8_t fec_n;
-	uint8_t session_key[crypto_aead_chacha20poly1305_KEYBYTES];
-	bool has_session_key;
+	uint8_t session_pkt[MAX_SESSION_PACKET_SIZE]; // last accepted
+	size_t session_pktlen;
+	struct crypto_wfb_context crypto;
+
+	/* hitless rekey. frames of both sessions are mixed for a while. */
+	bool rekey_check; // find the session of each frame by its MAC
+	uint64_t rekey_prev_block; // last block of the previous session
+	uint64_t rekey_end_block; // BLOCK_INVAL until the ring is rebased
 
 	/* meta data */
 	struct sockaddr_in6 rx_src;
+	int rx_adapter; // index of wireless adapter, or RX_ADAPTER_NONE
 	uint16_t freq;
 	int16_t dbm;
 
 	/* data */
 	struct rbuf *rx_ring;
+	struct rx_worker_pool *workers; // NULL if decrypt inline
+	uint64_t reorder_us; // 0 if purge stale blocks immediately
+	struct event *reorder_ev;
+	bool relay; // mirror only. no session, crypto, FEC.
 
 	/* callback */
 	struct rx_mirror_handler mirror_handler[RX_MAX_MIRROR];
 	int n_mirror_handler;
+	struct rx_mirror_seen mirror_seen[RX_MIRROR_SEEN];
 
 	struct rx_decode_handler decode_handler[RX_MAX_DECODE];
 	int n_decode_handler;
@@ -91,6 +124,11 @@ extern void rx_decode_frame(int8_t rssi,
 extern int rx_context_set_mirror(struct rx_context *ctx,
     void (*mirror)(struct iovec *iov, int iovcnt, void *arg), void *decode_arg);
 extern void rx_mirror_frame(struct rx_context *ctx, uint8_t *data, size_t size);
+extern int rx_context_set_workers(struct rx_context *ctx,
+    struct netcore_context *net_ctx, int n);
+extern int rx_context_set_reorder(struct rx_context *ctx,
+    struct netcore_context *net_ctx, int msec);
+extern int rx_context_set_relay(struct rx_context *ctx, bool relay);
 extern void rx_context_dump(struct rx_context *ctx);
 extern int rx_frame_pcap(struct rx_context *ctx, void *rxbuf, size_t rxlen);
 extern int rx_frame_udp(struct rx_context *ctx, void *rxbuf, size_t rxlen);
@@ -4,9 +4,13 @@
 #include <stdint.h>
 #include <inttypes.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
 #include <alloca.h>
 #include <assert.h>
 
+#include <event2/event.h>
+
 #include "compat.h"
 #include "wfb_params.h"
 
@@ -15,6 +19,7 @@
 #include "rx_core.h"
 #include "rx_data.h"
 #include "rx_log.h"
+#include "rx_worker.h"
 #include "util_rbuf.h"
 #include "util_msg.h"
 
@@ -111,34 +116,172 @@ send_data_recovered(struct rx_context *ctx, struct rbuf_block *blk)
 }
 
 static void
+data_free_block(struct rx_context *ctx, struct rbuf_block *blk)
+{
+	int i;
+
+	for (i = ctx->fec_k; i < ctx->fec_n; i++) {
+		if (blk->fragment_len[i] &&
+		    (blk->fragment_flags[i] & RBUF_F_SEALED))
+			wfb_stats.rx_decrypt_avoided++;
+	}
+	rbuf_free_block(blk);
+}
+
+/*
+ * a block held behind a block under FEC would have been released
+ * already if the FEC were done in place.
+ */
+static bool
+data_held_done(struct rx_context *ctx, struct rbuf_block *blk)
+{
+	int i;
+
+	if (blk->flags & RBUF_B_DONE)
+		return true;
+	if (!(blk->flags & RBUF_B_CUT))
+		return false;
+	for (i = 0; i < ctx->fec_k; i++) {
+		if (blk->fragment_len[i] == 0)
+			return false;
+	}
+
+	return true; // cut through to the end.
+}
+
+/*
+ * release blocks before blk. returns false if a block under FEC is in
+ * the way. blocks behind it are marked and take no more fragments, as
+ * if they were released here. data_resume() releases them later. blk
+ * is marked to be cut through if nothing was purged for it.
+ */
+static bool
 purge_stale(struct rx_context *ctx, struct rbuf_block *blk)
 {
+	struct rbuf *rbuf = blk->rbuf;
+	struct rbuf_block *stale;
+	bool cut = true;
+	uint64_t i;
+
 	while (!rbuf_block_is_front(blk)) {
-		struct rbuf_block *stale = rbuf_get_front(blk->rbuf);
+		stale = rbuf_get_front(rbuf);
+		if (stale->flags & RBUF_B_RECOVERING)
+			break;
+		if (stale->flags & RBUF_B_RECOVERED)
+			send_data_recovered(ctx, stale);
+		else
+			send_data_stale(ctx, stale);
+		data_free_block(ctx, stale);
+	}
+	if (rbuf_block_is_front(blk))
+		return true;
+
+	for (i = rbuf->front_block + 1; i < blk->index; i++) {
+		stale = rbuf_slot(rbuf, i);
+		if (stale->index == i && !data_held_done(ctx, stale)) {
+			stale->flags |= RBUF_B_STALE;
+			cut = false;
+		}
+	}
+	if (cut)
+		blk->flags |= RBUF_B_CUT;
+
+	return false;
+}
 
-		send_data_stale(ctx, stale);
-		rbuf_free_block(stale);
+/*
+ * parity fragments are stored as cipher text, and decrypted in place
+ * only when FEC needs them. the header is rebuilt from the index. the
+ * fragment is dropped if it's broken. returns 1 if it's decrypted by
+ * the previous session key.
+ */
+static int
+data_unseal(struct rx_context *ctx, const struct crypto_wfb_context *crypto,
+    struct rbuf_block *blk, int idx)
+{
+	uint8_t ad[WFB_DATA_BLOCK_HDRLEN];
+	struct wfb_ng_hdr *hdr = (struct wfb_ng_hdr *)ad;
+	unsigned long long plain_len = ctx->rx_ring->fragment_size;
+	uint64_t v64;
+	int r;
+
+	hdr->packet_type = WFB_PACKET_DATA;
+	v64 = htobe64((blk->index << 8) | (uint8_t)idx);
+	memcpy(hdr->u.data.nonce, &v64, sizeof(hdr->u.data.nonce));
+
+	r = crypto_wfb_data_decrypt(crypto,
+	    blk->fragment[idx], &plain_len, ad, sizeof(ad),
+	    blk->fragment[idx], blk->fragment_len[idx], hdr->u.data.nonce);
+	blk->fragment_flags[idx] &= ~RBUF_F_SEALED;
+	if (r < 0 || plain_len == 0) {
+		blk->fragment_len[idx] = 0;
+		blk->fragment_used--;
+		return -1;
 	}
+
+	// need to clear rest of buffer to perform FEC.
+	memset(blk->fragment[idx] + plain_len, 0,
+	    ctx->rx_ring->fragment_size - plain_len);
+	blk->fragment_len[idx] = plain_len;
+
+	return r;
 }
 
-static void
-data_recovery(struct rx_context *ctx, struct rbuf_block *blk)
+/*
+ * decrypt parities picked by rx_data_fec_prepare(). returns -1 if
+ * there are not enough fragments, or the number of parities decrypted
+ * by the previous session key. FEC jobs call this on a worker, so
+ * statistics are left to the caller.
+ */
+int
+rx_data_unseal_parity(struct rx_context *ctx,
+    const struct crypto_wfb_context *crypto, struct rbuf_block *blk)
 {
-	int i, j, k;
-	const uint8_t **in;
-	uint8_t **out;
-	unsigned *index;
-	size_t pktsiz = 0;
+	int i, j, r;
+	int prev = 0;
 
-	in = alloca(sizeof(uint8_t *) * ctx->fec_k);
-	out = alloca(sizeof(uint8_t *) *
-	    (ctx->fec_n - ctx->fec_k));
-	index = alloca(sizeof(unsigned) * ctx->fec_k);
-	if (!in || !out || !index) {
-		p_err("insufficient stack.\n");
-		exit(0);
+	j = ctx->fec_k;
+	for (i = 0; i < ctx->fec_k; i++) {
+		if (blk->fragment_len[i])
+			continue;
+		for (; j < ctx->fec_n; j++) {
+			if (blk->fragment_len[j] == 0)
+				continue;
+			if (!(blk->fragment_flags[j] & RBUF_F_SEALED))
+				break;
+			r = data_unseal(ctx, crypto, blk, j);
+			if (r >= 0) {
+				prev += r;
+				break;
+			}
+		}
+		if (j == ctx->fec_n)
+			return -1;
+		j++;
 	}
 
+	return prev;
+}
+
+static int
+data_unseal_parity(struct rx_context *ctx, struct rbuf_block *blk)
+{
+	int r;
+
+	r = rx_data_unseal_parity(ctx, &ctx->crypto, blk);
+	if (r > 0)
+		wfb_stats.session_prev_key += r;
+
+	return r;
+}
+
+size_t
+rx_data_fec_prepare(struct rx_context *ctx, struct rbuf_block *blk,
+    const uint8_t **in, uint8_t **out, unsigned *index)
+{
+	int i, j, k;
+	size_t pktsiz = 0;
+
 	j = ctx->fec_k;
 	k = 0;
 	for (i = 0; i < ctx->fec_k; i++) {
@@ -158,26 +301,376 @@ data_recovery(struct rx_context *ctx, struct rbuf_block *blk)
 		}
 	}
 
+	return pktsiz;
+}
+
+static void
+data_recovery(struct rx_context *ctx, struct rbuf_block *blk)
+{
+	const uint8_t **in;
+	uint8_t **out;
+	unsigned *index;
+	size_t pktsiz;
+
+	in = alloca(sizeof(uint8_t *) * ctx->fec_k);
+	out = alloca(sizeof(uint8_t *) *
+	    (ctx->fec_n - ctx->fec_k));
+	index = alloca(sizeof(unsigned) * ctx->fec_k);
+	if (!in || !out || !index) {
+		p_err("insufficient stack.\n");
+		exit(0);
+	}
+
+	pktsiz = rx_data_fec_prepare(ctx, blk, in, out, index);
 	fec_wfb_apply(&ctx->fec, in, out, index, pktsiz);
 }
 
+static int
+data_fec_count(struct rx_context *ctx, struct rbuf_block *blk)
+{
+	int fec_count = 0;
+	int i;
+
+	for (i = blk->fragment_to_send; i < ctx->fec_k; i++) {
+		if (blk->fragment_len[i] == 0)
+			fec_count++;
+	}
+
+	return fec_count;
+}
+
+/*
+ * release the front block using FEC. returns 1 if the recovery is
+ * handed to the worker pool, rx_data_recovered() is called later.
+ * returns -1 if a parity is broken and the block is kept.
+ */
+static int
+data_release_fec(struct rx_context *ctx, struct rbuf_block *blk)
+{
+	int fec_count;
+
+	fec_count = data_fec_count(ctx, blk);
+	if (fec_count) {
+		p_debug("Recover %d frames using FEC\n", fec_count);
+		if (ctx->workers) {
+			// the worker decrypts the parities too.
+			blk->flags |= RBUF_B_RECOVERING;
+			rx_worker_submit_fec(ctx->workers, blk);
+			return 1;
+		}
+		if (data_unseal_parity(ctx, blk) < 0) {
+			p_info("Broken parity frame. FEC postponed.\n");
+			return -1;
+		}
+		data_recovery(ctx, blk);
+	}
+
+	// the block is completed, or recovered now.
+	send_data_recovered(ctx, blk);
+	data_free_block(ctx, blk);
+
+	return 0;
+}
+
+/*
+ * start FEC of a block behind the front, which is held until the
+ * blocks before it are released. the worker pool recovers it
+ * meanwhile, and it's delivered in order as RBUF_B_RECOVERED.
+ */
+static void
+data_fec_ahead(struct rx_context *ctx, struct rbuf_block *blk)
+{
+	if (ctx->workers == NULL || wfb_options.no_fec)
+		return;
+	if (blk->flags & RBUF_B_DONE)
+		return;
+	if (blk->fragment_used < ctx->fec_k || data_fec_count(ctx, blk) == 0)
+		return;
+
+	blk->flags |= RBUF_B_RECOVERING;
+	rx_worker_submit_fec(ctx->workers, blk);
+}
+
+static uint64_t
+data_now(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+		p_err("clock_gettime() failed: %s\n", strerror(errno));
+		return 0;
+	}
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void
+data_arm_timer(struct rx_context *ctx, uint64_t timeout_us)
+{
+	struct timeval tv;
+
+	tv.tv_sec = timeout_us / 1000000;
+	tv.tv_usec = timeout_us % 1000000;
+	evtimer_add(ctx->reorder_ev, &tv);
+}
+
+/*
+ * release blocks from the front of the ring in order. an incomplete
+ * block is kept until its deadline, so late fragments and parities can
+ * still complete it.
+ */
+static void
+data_flush(struct rx_context *ctx)
+{
+	struct rbuf *rbuf = ctx->rx_ring;
+	struct rbuf_block *blk;
+	uint64_t now = 0;
+	bool waited;
+	int r;
+
+	if (rbuf->last_block == BLOCK_INVAL)
+		return; // no block yet.
+
+	while (rbuf->front_block <= rbuf->last_block) {
+		blk = rbuf_get_front(rbuf);
+		// legacy mode would have dropped this block already.
+		waited = (rbuf->front_block != rbuf->last_block);
+
+		if (blk->flags & RBUF_B_RECOVERING)
+			return; // resumed by rx_data_recovered().
+		if (blk->flags & RBUF_B_RECOVERED) {
+			if (waited)
+				wfb_stats.rx_reorder_recovered++;
+			send_data_recovered(ctx, blk);
+			data_free_block(ctx, blk);
+			continue;
+		}
+
+		send_data_seq(ctx, blk);
+		if (blk->fragment_to_send == ctx->fec_k) {
+			if (waited)
+				wfb_stats.rx_reorder_recovered++;
+			data_free_block(ctx, blk);
+			continue;
+		}
+		if (blk->fragment_used >= ctx->fec_k &&
+		    !wfb_options.no_fec) {
+			r = data_release_fec(ctx, blk);
+			if (r > 0)
+				return; // counted when it's delivered.
+			if (r == 0) {
+				if (waited)
+					wfb_stats.rx_reorder_recovered++;
+				continue;
+			}
+			// a parity is broken. wait for more.
+		}
+
+		if (now == 0)
+			now = data_now();
+		if (blk->deadline == 0) {
+			// no fragment is received. start waiting from now.
+			blk->deadline = now + ctx->reorder_us;
+		}
+		if (now < blk->deadline) {
+			data_arm_timer(ctx, blk->deadline - now);
+			return;
+		}
+
+		// give up.
+		wfb_stats.rx_reorder_expired++;
+		send_data_stale(ctx, blk);
+		data_free_block(ctx, blk);
+	}
+}
+
+/*
+ * release blocks held behind a block under FEC, as data_add() would
+ * have done if the FEC were done in place. the newest block is kept
+ * for more fragments.
+ */
+static void
+data_resume(struct rx_context *ctx)
+{
+	struct rbuf *rbuf = ctx->rx_ring;
+	struct rbuf_block *blk;
+
+	if (rbuf->last_block == BLOCK_INVAL)
+		return; // no block yet.
+
+	while (rbuf->front_block <= rbuf->last_block) {
+		blk = rbuf_get_front(rbuf);
+		if (blk->flags & RBUF_B_RECOVERING)
+			return; // resumed by rx_data_recovered().
+		if (blk->flags & RBUF_B_RECOVERED) {
+			send_data_recovered(ctx, blk);
+			data_free_block(ctx, blk);
+			continue;
+		}
+		if (blk->flags & RBUF_B_STALE) {
+			send_data_stale(ctx, blk);
+			data_free_block(ctx, blk);
+			continue;
+		}
+
+		if (rbuf->front_block == rbuf->last_block) {
+			// it has purged blocks before it, not cut through yet.
+			if (!(blk->flags & RBUF_B_CUT))
+				return;
+			send_data_seq(ctx, blk);
+			if (blk->fragment_to_send == ctx->fec_k)
+				data_free_block(ctx, blk);
+			else if (blk->fragment_used >= ctx->fec_k &&
+			    !wfb_options.no_fec)
+				data_release_fec(ctx, blk);
+			return;
+		}
+		send_data_stale(ctx, blk);
+		data_free_block(ctx, blk);
+	}
+}
+
+/*
+ * FEC of the block is done on a worker. FEC jobs are applied in
+ * submission order, the ring releases blocks in block order. if a
+ * parity is broken, the block takes fragments again and waits for more.
+ */
+void
+rx_data_recovered(struct rx_context *ctx, struct rbuf_block *blk,
+    bool recovered)
+{
+	blk->flags &= ~RBUF_B_RECOVERING;
+	if (recovered)
+		blk->flags |= RBUF_B_RECOVERED;
+	else
+		p_info("Broken parity frame. FEC postponed.\n");
+	if (ctx->reorder_us)
+		data_flush(ctx);
+	else
+		data_resume(ctx);
+}
+
+void
+rx_data_timeout(evutil_socket_t fd, short event, void *arg)
+{
+	struct rx_context *ctx = (struct rx_context *)arg;
+
+	assert(ctx);
+
+	if (!ctx->crypto.has_session_key || ctx->rx_ring == NULL)
+		return;
+
+	data_flush(ctx);
+}
+
+/*
+ * the new session restarted the block index after a hitless rekey.
+ * release blocks of the previous session and start the window over.
+ */
+static void
+data_rebase(struct rx_context *ctx)
+{
+	struct rbuf *rbuf = ctx->rx_ring;
+	struct rbuf_block *blk;
+
+	if (ctx->workers)
+		rx_worker_drain(ctx->workers);
+
+	while (rbuf->last_block != BLOCK_INVAL &&
+	    rbuf->front_block <= rbuf->last_block) {
+		blk = rbuf_get_front(rbuf);
+		send_data_seq(ctx, blk);
+		if (blk->flags & RBUF_B_RECOVERED)
+			send_data_recovered(ctx, blk);
+		else if (!(blk->flags & RBUF_B_STALE) &&
+		    blk->fragment_to_send < ctx->fec_k &&
+		    blk->fragment_used >= ctx->fec_k &&
+		    !wfb_options.no_fec &&
+		    data_unseal_parity(ctx, blk) >= 0) {
+			data_recovery(ctx, blk);
+			send_data_recovered(ctx, blk);
+		}
+		send_data_stale(ctx, blk);
+		data_free_block(ctx, blk);
+	}
+	rbuf_reset(rbuf);
+	wfb_stats.session_rebase++;
+}
+
+/*
+ * after a hitless rekey, find which session the frame belongs to.
+ * returns -1 if the frame must be dropped.
+ */
+static int
+data_rekey_check(struct rx_context *ctx)
+{
+	int r;
+
+	r = crypto_wfb_data_verify(&ctx->crypto,
+	    (uint8_t *)ctx->wfb.hdr, ctx->wfb.hdrlen,
+	    ctx->wfb.cipher, ctx->wfb.cipherlen, ctx->wfb.nonce);
+	if (r < 0)
+		return 0; // broken. the usual path handles it.
+
+	if (ctx->rekey_end_block == BLOCK_INVAL) {
+		if (r > 0)
+			return 0; // the ring still holds the previous session.
+		if (ctx->wfb.block_idx > ctx->rekey_prev_block) {
+			// the index continues. both sessions share the ring.
+			ctx->rekey_check = false;
+			return 0;
+		}
+		data_rebase(ctx);
+		// frames of the previous session are dropped for a while.
+		ctx->rekey_end_block = ctx->wfb.block_idx +
+		    ctx->rx_ring->ring_size;
+		return 0;
+	}
+
+	if (r > 0) {
+		// the ring is rebased. the block is gone.
+		wfb_stats.session_prev_late++;
+		return -1;
+	}
+	if (ctx->wfb.block_idx >= ctx->rekey_end_block) {
+		// no more frames from the previous session.
+		ctx->crypto.has_prev_session_key = false;
+		if (ctx->workers)
+			rx_worker_set_key(ctx->workers, &ctx->crypto);
+		ctx->rekey_check = false;
+	}
+
+	return 0;
+}
+
 static int
 data_add(struct rx_context *ctx, struct rbuf_block *blk)
 {
+	if (ctx->reorder_us) {
+		if (!rbuf_block_is_front(blk))
+			data_fec_ahead(ctx, blk);
+		data_flush(ctx);
+		return 0;
+	}
+
 	if (rbuf_block_is_front(blk)) {
 		// cut through sequencial data.
 		send_data_seq(ctx, blk);
 
 		if (blk->fragment_to_send == ctx->fec_k) {
 			// all data received. we can drop parity frames.
-			rbuf_free_block(blk);
+			data_free_block(ctx, blk);
 			return 0;
 		}
 	}
 	else {
 		// new block is arrived. let's forget old blocks, because
-		// we prefer latency to processing reordering.
-		purge_stale(ctx, blk);
+		// we prefer latency to processing reordering. a block under
+		// FEC is kept, and this one is recovered meanwhile.
+		if (!purge_stale(ctx, blk)) {
+			data_fec_ahead(ctx, blk);
+			return 0;
+		}
 	}
 
 	assert(rbuf_block_is_front(blk));
@@ -186,26 +679,96 @@ data_add(struct rx_context *ctx, struct rbuf_block *blk)
 	    blk->fragment_used == ctx->fec_k &&
 	    !wfb_options.no_fec) {
 		// some frames are lost, but we can recover those using FEC.
-		int fec_count = 0;
-		int i;
-	
-		for (i = blk->fragment_to_send; i < ctx->fec_k; i++) {
-			if (blk->fragment_len[i] == 0)
-				fec_count++;
-		}
-		if (fec_count) {
-			p_debug("Recover %d frames using FEC\n", fec_count);
-			data_recovery(ctx, blk);
+		data_release_fec(ctx, blk);
+		return 0;
+	}
+
+	return 0;
+}
+
+/*
+ * the ring is going to slide over blocks still waiting for the
+ * deadline. release them now.
+ */
+static void
+data_make_room(struct rx_context *ctx, uint64_t block_idx)
+{
+	struct rbuf *rbuf = ctx->rx_ring;
+	struct rbuf_block *blk;
+
+	if (rbuf->last_block == BLOCK_INVAL)
+		return;
+
+	while (rbuf->front_block <= rbuf->last_block &&
+	    block_idx - rbuf->front_block >= rbuf->ring_size &&
+	    block_idx > rbuf->last_block) {
+		blk = rbuf_get_front(rbuf);
+		if ((blk->flags & RBUF_B_RECOVERED) ||
+		    data_fec_count(ctx, blk) == 0) {
+			send_data_recovered(ctx, blk);
+			data_free_block(ctx, blk);
+			continue;
 		}
+		// the worker pool has recovered such blocks ahead.
+		if (ctx->workers == NULL && blk->fragment_used >= ctx->fec_k &&
+		    !wfb_options.no_fec && data_release_fec(ctx, blk) == 0)
+			continue;
+		wfb_stats.rx_reorder_expired++;
+		send_data_stale(ctx, blk);
+		data_free_block(ctx, blk);
+	}
+}
 
-		// the block is completed, or recovered now.
-		send_data_recovered(ctx, blk);
-		rbuf_free_block(blk);
+static struct rbuf_block *
+data_lookup(struct rx_context *ctx, uint64_t block_idx,
+    uint8_t fragment_idx, int16_t dbm, int adapter)
+{
+	struct rbuf *rbuf = ctx->rx_ring;
+	struct rbuf_block *blk;
 
-		return 0;
+	if (ctx->workers && rx_worker_fec_pending(ctx->workers) &&
+	    rbuf->last_block != BLOCK_INVAL && block_idx > rbuf->last_block &&
+	    block_idx - rbuf->front_block >= rbuf->ring_size) {
+		// the window slides over blocks under FEC. finish them.
+		rx_worker_fec_sync(ctx->workers);
+	}
+	if (ctx->reorder_us)
+		data_make_room(ctx, block_idx);
+	blk = rbuf_get_block(rbuf, block_idx);
+	if (blk == NULL)
+		return NULL; // the frame is out of window. silent discard.
+	if (ctx->reorder_us && blk->deadline == 0)
+		blk->deadline = data_now() + ctx->reorder_us;
+	if (blk->rssi[fragment_idx] < dbm)
+		blk->rssi[fragment_idx] = dbm;
+	if (blk->flags & RBUF_B_DONE)
+		return NULL; // FEC has filled the block, or it's purged.
+	if (blk->fragment_len[fragment_idx] != 0) {
+		if (adapter >= 0)
+			wfb_stats.pcap_adapter_duplicate[adapter]++;
+		return NULL; // duplicated frame. silent discard.
 	}
 
-	return 0;
+	return blk;
+}
+
+static int
+data_commit(struct rx_context *ctx, struct rbuf_block *blk,
+    uint8_t fragment_idx, size_t plain_len, int adapter, bool sealed)
+{
+	// need to clear rest of buffer to perform FEC.
+	if (!sealed) {
+		memset(blk->fragment[fragment_idx] + plain_len, 0,
+		    ctx->rx_ring->fragment_size - plain_len);
+	}
+	// the ring doesn't clear flags of a new block.
+	blk->fragment_flags[fragment_idx] = sealed ? RBUF_F_SEALED : 0;
+	blk->fragment_len[fragment_idx] = plain_len;
+	blk->fragment_used++;
+	if (adapter >= 0)
+		wfb_stats.pcap_adapter_unique[adapter]++;
+
+	return data_add(ctx, blk);
 }
 
 int
@@ -215,12 +778,13 @@ rx_data(struct rx_context *ctx)
 	unsigned long long plain_len;
 	uint8_t *fragment_data;
 	uint8_t fragment_idx;
+	int r;
 
 	assert(ctx);
 	assert(ctx->wfb.hdr);
 	assert(ctx->wfb.pktlen);
 
-	if (!ctx->has_session_key)
+	if (!ctx->crypto.has_session_key)
 		return 0;
 
 	assert(ctx->rx_ring);
@@ -239,34 +803,134 @@ rx_data(struct rx_context *ctx)
 	}
 	rx_log_frame(ctx,
 	    ctx->wfb.block_idx, ctx->wfb.fragment_idx, ctx->wfb.pktlen);
+	if (ctx->rekey_check && data_rekey_check(ctx) < 0)
+		return 0;
+
+	if (ctx->workers)
+		return rx_worker_submit(ctx->workers, ctx);
 
 	fragment_idx = ctx->wfb.fragment_idx;
 
-	blk = rbuf_get_block(ctx->rx_ring, ctx->wfb.block_idx);
+	blk = data_lookup(ctx, ctx->wfb.block_idx, fragment_idx,
+	    ctx->dbm, ctx->rx_adapter);
 	if (blk == NULL)
-		return 0; // the frame is out of window. silent discard.
-	if (blk->rssi[fragment_idx] < ctx->dbm)
-		blk->rssi[fragment_idx] = ctx->dbm;
-	if (blk->fragment_len[fragment_idx] != 0)
-		return 0; // duplicated frame. silent discard.
+		return 0;
 	
 	fragment_data = blk->fragment[fragment_idx];
+	if (fragment_idx >= ctx->fec_k) {
+		// decrypted later if FEC needs it.
+		if (ctx->wfb.cipherlen > ctx->rx_ring->fragment_size) {
+			p_err("Buffer exhausted.\n");
+			return -1;
+		}
+		memcpy(fragment_data, ctx->wfb.cipher, ctx->wfb.cipherlen);
+		return data_commit(ctx, blk, fragment_idx, ctx->wfb.cipherlen,
+		    ctx->rx_adapter, true);
+	}
 	plain_len = ctx->rx_ring->fragment_size;
 
-	if (crypto_wfb_data_decrypt(fragment_data, &plain_len,
-	    (uint8_t *)ctx->wfb.hdr, ctx->wfb.pktlen, ctx->wfb.hdrlen,
-	    (uint8_t *)ctx->wfb.nonce) < 0) {
+	// decrypt into the ring directly.
+	r = crypto_wfb_data_decrypt(&ctx->crypto, fragment_data, &plain_len,
+	    (uint8_t *)ctx->wfb.hdr, ctx->wfb.hdrlen,
+	    ctx->wfb.cipher, ctx->wfb.cipherlen, ctx->wfb.nonce);
+	if (r < 0) {
 		// invalidate session
-		ctx->has_session_key = false;
+		ctx->crypto.has_session_key = false;
 		rx_context_dump(ctx);
 		return -1;
 	}
+	if (r > 0)
+		wfb_stats.session_prev_key++;
 
-	// need to clear rest of buffer to perform FEC.
-	memset(fragment_data + plain_len, 0,
-	    ctx->rx_ring->fragment_size - plain_len);
-	blk->fragment_len[fragment_idx] = plain_len;
-	blk->fragment_used++;
+	return data_commit(ctx, blk, fragment_idx, plain_len, ctx->rx_adapter,
+	    false);
+}
 
-	return data_add(ctx, blk);
+int
+rx_data_complete(struct rx_context *ctx, uint64_t block_idx,
+    uint8_t fragment_idx, int16_t dbm, int adapter,
+    const uint8_t *plain, size_t plain_len)
+{
+	struct rbuf_block *blk;
+
+	assert(ctx);
+	assert(plain);
+
+	if (!ctx->crypto.has_session_key)
+		return 0;
+
+	assert(ctx->rx_ring);
+
+	blk = data_lookup(ctx, block_idx, fragment_idx, dbm, adapter);
+	if (blk == NULL)
+		return 0;
+	if (plain_len > ctx->rx_ring->fragment_size) {
+		p_err("Buffer exhausted.\n");
+		return -1;
+	}
+	// a worker may have decrypted it into the ring already.
+	if (plain != blk->fragment[fragment_idx])
+		memcpy(blk->fragment[fragment_idx], plain, plain_len);
+
+	return data_commit(ctx, blk, fragment_idx, plain_len, adapter, false);
+}
+
+/*
+ * returns the ring slot a worker can decrypt the data fragment into,
+ * or NULL if the block is not in the window, or the fragment is not
+ * needed. the worker pool checks jobs in flight.
+ */
+uint8_t *
+rx_data_slot(struct rx_context *ctx, uint64_t block_idx,
+    uint8_t fragment_idx)
+{
+	struct rbuf *rbuf = ctx->rx_ring;
+	struct rbuf_block *blk;
+
+	if (rbuf == NULL || rbuf->last_block == BLOCK_INVAL)
+		return NULL;
+	if (block_idx < rbuf->front_block ||
+	    block_idx - rbuf->front_block >= rbuf->ring_size)
+		return NULL;
+
+	blk = rbuf_slot(rbuf, block_idx);
+	if (block_idx > rbuf->last_block && blk->index == BLOCK_INVAL)
+		return blk->fragment[fragment_idx]; // not allocated yet.
+	if (blk->index != block_idx)
+		return NULL; // released already.
+	// a FEC job may be writing the block.
+	if ((blk->flags & RBUF_B_DONE) ||
+	    blk->fragment_len[fragment_idx] != 0)
+		return NULL;
+
+	return blk->fragment[fragment_idx];
+}
+
+int
+rx_data_sealed(struct rx_context *ctx, uint64_t block_idx,
+    uint8_t fragment_idx, int16_t dbm, int adapter,
+    const uint8_t *cipher, size_t cipherlen)
+{
+	struct rbuf_block *blk;
+
+	assert(ctx);
+	assert(cipher);
+
+	if (!ctx->crypto.has_session_key)
+		return 0;
+
+	assert(ctx->rx_ring);
+
+	blk = data_lookup(ctx, block_idx, fragment_idx, dbm, adapter);
+	if (blk == NULL)
+		return 0;
+	if (cipherlen > ctx->rx_ring->fragment_size) {
+		p_err("Buffer exhausted.\n");
+		return -1;
+	}
+	// the worker pool may have stored it into the ring already.
+	if (cipher != blk->fragment[fragment_idx])
+		memcpy(blk->fragment[fragment_idx], cipher, cipherlen);
+
+	return data_commit(ctx, blk, fragment_idx, cipherlen, adapter, true);
 }
@@ -1,6 +1,24 @@
 #ifndef __RX_DATA_H__
 #define __RX_DATA_H__
+#include <event2/event.h>
+
 #include "rx_core.h"
 
 extern int rx_data(struct rx_context *ctx);
+extern int rx_data_complete(struct rx_context *ctx, uint64_t block_idx,
+    uint8_t fragment_idx, int16_t dbm, int adapter,
+    const uint8_t *plain, size_t plain_len);
+extern int rx_data_sealed(struct rx_context *ctx, uint64_t block_idx,
+    uint8_t fragment_idx, int16_t dbm, int adapter,
+    const uint8_t *cipher, size_t cipherlen);
+extern uint8_t *rx_data_slot(struct rx_context *ctx, uint64_t block_idx,
+    uint8_t fragment_idx);
+extern int rx_data_unseal_parity(struct rx_context *ctx,
+    const struct crypto_wfb_context *crypto, struct rbuf_block *blk);
+extern size_t rx_data_fec_prepare(struct rx_context *ctx,
+    struct rbuf_block *blk, const uint8_t **in, uint8_t **out,
+    unsigned *index);
+extern void rx_data_recovered(struct rx_context *ctx, struct rbuf_block *blk,
+    bool recovered);
+extern void rx_data_timeout(evutil_socket_t fd, short event, void *arg);
 #endif /* __RX_DATA_H__ */
@@ -1,3 +1,6 @@
+#ifdef __linux__
+#define _GNU_SOURCE /* fallocate() */
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -5,48 +8,283 @@
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <inttypes.h>
 #include <sys/stat.h>
 
 #include "rx_core.h"
 #include "rx_log.h"
 #include "util_msg.h"
+#include "util_wbuf.h"
 
 #include "compat.h"
 
+#ifdef ENABLE_ZSTD
+#include <zstd.h>
+#endif
+
+/*
+ * segments of the log. runs on the writer thread after created.
+ *
+ * segment N is named <log_file>.N (or <log_file> if N is 0), and the last
+ * used N is kept in <log_file>.seq across restarts. the next segment is
+ * created and preallocated right after a rotation, so the rotation itself
+ * is just a switch of the file descriptor.
+ */
+struct rx_log_writer {
+	const char *base;
+	int seq;
+	int fd;
+	int next_seq;
+	int next_fd; // -1 if not prepared
+	int retain_seq; // segments below this are already removed
+	uint64_t seg_bytes; // also the offset of the next chunk
+	time_t seg_start; // [s]
+	struct rx_log_file_header hd;
+
+	/* version 2 */
+	int codec;
+	uint8_t *zbuf;
+	size_t zsize;
+#ifdef ENABLE_ZSTD
+	ZSTD_CCtx *zctx;
+#endif
+
+	struct rx_log_index_entry *index;
+	size_t n_index;
+	size_t max_index;
+};
+
+/*
+ * internal record. asks the writer thread to start the next segment.
+ * seq holds the packed header of the new segment. never written.
+ */
+#define RX_LOG_TYPE_ROTATE	FRAME_TYPE_MAX
+
+static struct rx_log_writer *rx_log_writer_alloc(int version);
+static void rx_log_writer_free(struct rx_log_writer *w);
+
+static inline struct wbuf *
+rx_log_wbuf(struct rx_log_handler *log)
+{
+	return __atomic_load_n(&log->wbuf, __ATOMIC_ACQUIRE);
+}
+
 static void
-sync_fp(FILE *fp)
+rx_log_rotate_put(struct rx_log_handler *log, struct wbuf *wbuf)
 {
-	if (!fp)
-		return;
+	struct rx_log_frame_header hd;
+	uint64_t rotate;
+
+	rotate = __atomic_exchange_n(&log->rotate, 0, __ATOMIC_ACQ_REL);
+	if (rotate == 0)
+		return; // taken by another thread.
 
-	while (fflush(fp) != 0) {
-		;
+	memset(&hd, 0, sizeof(hd));
+	hd.type = RX_LOG_TYPE_ROTATE;
+	hd.seq = rotate;
+	if (wbuf_write(wbuf, &hd, sizeof(hd)) < 0) {
+		// both buffers are busy. retried by the next record.
+		uint64_t none = 0;
+
+		__atomic_compare_exchange_n(&log->rotate, &none, rotate,
+		    false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
 	}
-	//fsync(fileno(fp));
 }
 
 static void
-fixup_filename(struct rx_log_handler *log)
+rx_log_put(struct rx_log_handler *log, const void *hd, size_t hdlen,
+    const void *data, size_t size)
+{
+	struct wbuf *wbuf = rx_log_wbuf(log);
+	struct iovec iov[2];
+
+	if (wbuf == NULL)
+		return;
+	if (__atomic_load_n(&log->rotate, __ATOMIC_RELAXED))
+		rx_log_rotate_put(log, wbuf);
+
+	iov[0].iov_base = (void *)hd;
+	iov[0].iov_len = hdlen;
+	iov[1].iov_base = (void *)data;
+	iov[1].iov_len = size;
+
+	// header and data are one record, never split.
+	if (wbuf_writev(wbuf, iov, size ? 2 : 1) < 0)
+		__atomic_add_fetch(&wfb_stats.rx_log_dropped, 1,
+		    __ATOMIC_RELAXED);
+}
+
+static time_t
+rx_log_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec;
+}
+
+static void
+rx_log_segment_name(char *name, size_t len, const char *base, int seq)
+{
+	if (seq == 0)
+		snprintf(name, len, "%s", base);
+	else
+		snprintf(name, len, "%s.%d", base, seq);
+}
+
+static int
+rx_log_seq_load(const char *base)
 {
+	char name[PATH_MAX];
 	struct stat st;
-	int rc;
+	FILE *fp;
+	int seq;
+
+	snprintf(name, sizeof(name), "%s.seq", base);
+	fp = fopen(name, "r");
+	if (fp) {
+		if (fscanf(fp, "%d", &seq) != 1 || seq < 0)
+			seq = -1;
+		fclose(fp);
+		if (seq >= 0)
+			return seq + 1;
+	}
+
+	// no counter yet. skip existing logs.
+	for (seq = 0; ; seq++) {
+		rx_log_segment_name(name, sizeof(name), base, seq);
+		if (stat(name, &st) < 0)
+			break;
+	}
+
+	return seq;
+}
+
+static void
+rx_log_seq_store(const char *base, int seq)
+{
+	char name[PATH_MAX], tmp[PATH_MAX];
+	FILE *fp;
+
+	snprintf(name, sizeof(name), "%s.seq", base);
+	snprintf(tmp, sizeof(tmp), "%s.seq.tmp", base);
+	fp = fopen(tmp, "w");
+	if (fp == NULL) {
+		p_err("Cannot write %s: %s\n", tmp, strerror(errno));
+		return;
+	}
+	fprintf(fp, "%d\n", seq);
+	fclose(fp);
+	if (rename(tmp, name) < 0)
+		p_err("Cannot rename %s: %s\n", tmp, strerror(errno));
+}
+
+static int
+rx_log_segment_create(const char *base, int *seq)
+{
+	char name[PATH_MAX];
+	int fd, retry;
 
-	assert(log);
+	for (retry = 0; retry < 100; retry++, (*seq)++) {
+		rx_log_segment_name(name, sizeof(name), base, *seq);
+		fd = open(name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+		if (fd >= 0)
+			break;
+		if (errno != EEXIST) {
+			p_err("Failed to create File %s: %s\n",
+			    name, strerror(errno));
+			return -1;
+		}
+	}
+	if (fd < 0) {
+		p_err("Failed to create File %s: %s\n", name, strerror(errno));
+		return -1;
+	}
+	rx_log_seq_store(base, *seq);
+
+#if defined(__linux__) && defined(FALLOC_FL_KEEP_SIZE)
+	// reserve blocks. the size of the file is unchanged.
+	if (wfb_options.log_rotate_size > 0 &&
+	    fallocate(fd, FALLOC_FL_KEEP_SIZE, 0,
+	    wfb_options.log_rotate_size) < 0)
+		p_debug("fallocate() failed: %s\n", strerror(errno));
+#endif
+	p_debug("New LOG File: %s\n", name);
+
+	return fd;
+}
 
-	if (log->seq == 0) {
-		strlcpy(log->file_name, wfb_options.log_file,
-		    sizeof(log->file_name));
+static void
+rx_log_segment_prepare(struct rx_log_writer *w)
+{
+	if (w->next_fd >= 0)
+		return;
+	if (wfb_options.log_rotate_size == 0 && wfb_options.log_rotate_time == 0)
+		return;
+
+	w->next_seq = w->seq + 1;
+	w->next_fd = rx_log_segment_create(w->base, &w->next_seq);
+}
+
+static int
+rx_log_segment_start(struct rx_log_writer *w)
+{
+	char name[PATH_MAX];
+	struct iovec iov;
+
+	if (w->next_fd >= 0) {
+		w->fd = w->next_fd;
+		w->seq = w->next_seq;
+		w->next_fd = -1;
 	}
-	p_debug("try file name: %s\n", log->file_name);
+	else {
+		w->seq++;
+		w->fd = rx_log_segment_create(w->base, &w->seq);
+		if (w->fd < 0)
+			return -1;
+	}
+	w->seg_bytes = 0;
+	w->seg_start = rx_log_now();
 
-	while ( (rc = stat(log->file_name, &st)) == 0) {
-		p_debug("stat() => %d\n", rc);
-		log->seq++;
-		snprintf(log->file_name, sizeof(log->file_name),
-		  "%s.%d", wfb_options.log_file, log->seq);
+	iov.iov_base = &w->hd;
+	iov.iov_len = sizeof(w->hd);
+	if (wbuf_write_fd(w->fd, &iov, 1) < 0) {
+		p_err("write failed: %s\n", strerror(errno));
+		close(w->fd);
+		w->fd = -1;
+		return -1;
+	}
+	w->seg_bytes = sizeof(w->hd);
+
+	// keep the last log_retain segments. the first scan also removes
+	// segments left by previous runs.
+	for (; wfb_options.log_retain > 0 &&
+	    w->retain_seq <= w->seq - wfb_options.log_retain;
+	    w->retain_seq++) {
+		rx_log_segment_name(name, sizeof(name), w->base,
+		    w->retain_seq);
+		if (unlink(name) == 0)
+			p_debug("Old LOG File removed: %s\n", name);
 	}
-	p_debug("use file name: %s\n", log->file_name);
+
+	return 0;
+}
+
+static bool
+rx_log_segment_full(struct rx_log_writer *w, size_t size)
+{
+	if (w->seg_bytes <= sizeof(w->hd))
+		return false; // empty
+	if (wfb_options.log_rotate_size > 0 &&
+	    w->seg_bytes + size > wfb_options.log_rotate_size)
+		return true;
+	if (wfb_options.log_rotate_time > 0 &&
+	    rx_log_now() - w->seg_start >= wfb_options.log_rotate_time)
+		return true;
+
+	return false;
 }
 
 void
@@ -56,7 +294,7 @@ rx_log_corrupt(struct rx_context *ctx)
 	struct rx_log_handler *log = &ctx->log_handler;
 	struct timespec ts;
 
-	if (log->fp == NULL)
+	if (rx_log_wbuf(log) == NULL)
 		return;
 	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
 		p_err("clock_gettime() failed: %s\n", strerror(errno));
@@ -72,8 +310,7 @@ rx_log_corrupt(struct rx_context *ctx)
 	if (ctx->rx_src.sin6_family == AF_INET) {
 		memcpy(hd.rx_src, &ctx->rx_src.sin6_addr, sizeof(hd.rx_src));
 	}
-	(void)fwrite(&hd, sizeof(hd), 1, log->fp);
-	sync_fp(log->fp);
+	rx_log_put(log, &hd, sizeof(hd), NULL, 0);
 }
 
 void
@@ -84,7 +321,7 @@ rx_log_frame(struct rx_context *ctx,
 	struct rx_log_handler *log = &ctx->log_handler;
 	struct timespec ts;
 
-	if (log->fp == NULL)
+	if (rx_log_wbuf(log) == NULL)
 		return;
 	if (size == 0)
 		return;
@@ -110,8 +347,7 @@ rx_log_frame(struct rx_context *ctx,
 	p_debug("SEQ %" PRIu64 ", BLK %" PRIu64 ", FRAG %u, SIZE %lu\n",
 	    hd.seq, hd.block_idx, hd.fragment_idx, size);
 
-	(void)fwrite(&hd, sizeof(hd), 1, log->fp);
-	sync_fp(log->fp);
+	rx_log_put(log, &hd, sizeof(hd), NULL, 0);
 }
 
 void
@@ -122,7 +358,7 @@ rx_log_decode(struct rx_context *ctx,
 	struct rx_log_handler *log = &ctx->log_handler;
 	struct timespec ts;
 
-	if (log->fp == NULL)
+	if (rx_log_wbuf(log) == NULL)
 		return;
 	if (data == NULL)
 		return;
@@ -149,53 +385,360 @@ rx_log_decode(struct rx_context *ctx,
 	p_debug("SEQ %" PRIu64 ", BLK %" PRIu64 ", FRAG %u, SIZE %lu\n",
 	    hd.seq, hd.block_idx, hd.fragment_idx, size);
 
-	(void)fwrite(&hd, sizeof(hd), 1, log->fp);
-	(void)fwrite(data, size, 1, log->fp);
-	sync_fp(log->fp);
+	rx_log_put(log, &hd, sizeof(hd), data, size);
+}
+
+static void
+rx_log_chunk_scan(struct rx_log_index_entry *ent,
+    const uint8_t *data, size_t size)
+{
+	struct rx_log_frame_header hd;
+	uint64_t seq, block, ts;
+	size_t off = 0;
+
+	memset(ent, 0, sizeof(*ent));
+	ent->min_seq = ent->min_block = ent->min_ts = UINT64_MAX;
+
+	while (off + sizeof(hd) <= size) {
+		memcpy(&hd, data + off, sizeof(hd));
+		off += sizeof(hd) + rx_log_payload_size(&hd);
+		ent->n_records++;
+
+		ts = le64toh(hd.tv_sec) * 1000000000 + le64toh(hd.tv_nsec);
+		if (ent->min_ts > ts)
+			ent->min_ts = ts;
+		if (ent->max_ts < ts)
+			ent->max_ts = ts;
+
+		if (hd.type != FRAME_TYPE_INET6 && hd.type != FRAME_TYPE_DECODE)
+			continue; // message or corrupt. no seq.
+		seq = le64toh(hd.seq);
+		block = le64toh(hd.block_idx);
+		if (ent->min_seq > seq)
+			ent->min_seq = seq;
+		if (ent->max_seq < seq)
+			ent->max_seq = seq;
+		if (ent->min_block > block)
+			ent->min_block = block;
+		if (ent->max_block < block)
+			ent->max_block = block;
+	}
+	if (ent->min_seq == UINT64_MAX)
+		ent->min_seq = ent->min_block = 0;
+}
+
+static int
+rx_log_chunk_write(struct rx_log_writer *w, const uint8_t *data, size_t size)
+{
+	struct rx_log_chunk_header hd;
+	struct rx_log_index_entry *ent;
+	struct iovec iov[2];
+
+	if (w->n_index == w->max_index) {
+		size_t max = w->max_index ? w->max_index * 2 : 64;
+		void *p;
+
+		p = realloc(w->index, sizeof(*w->index) * max);
+		if (p == NULL)
+			return -1;
+		w->index = p;
+		w->max_index = max;
+	}
+	ent = &w->index[w->n_index];
+	rx_log_chunk_scan(ent, data, size);
+	ent->offset = w->seg_bytes;
+
+	memset(&hd, 0, sizeof(hd));
+	hd.signature = htole32(RX_LOG_CHUNK_SIGNATURE);
+	hd.codec = RX_LOG_CODEC_NONE;
+	hd.raw_size = htole32(size);
+	iov[1].iov_base = (void *)data;
+	iov[1].iov_len = size;
+#ifdef ENABLE_ZSTD
+	if (w->codec == RX_LOG_CODEC_ZSTD) {
+		size_t zlen;
+
+		zlen = ZSTD_compressCCtx(w->zctx, w->zbuf, w->zsize,
+		    data, size, RX_LOG_ZSTD_LEVEL);
+		if (!ZSTD_isError(zlen) && zlen < size) {
+			hd.codec = RX_LOG_CODEC_ZSTD;
+			iov[1].iov_base = w->zbuf;
+			iov[1].iov_len = zlen;
+		}
+	}
+#endif
+	hd.size = htole32(iov[1].iov_len);
+	iov[0].iov_base = &hd;
+	iov[0].iov_len = sizeof(hd);
+	w->seg_bytes += iov[0].iov_len + iov[1].iov_len;
+
+	if (wbuf_write_fd(w->fd, iov, 2) < 0)
+		return -1;
+
+	// to LE
+	ent->offset = htole64(ent->offset);
+	ent->min_seq = htole64(ent->min_seq);
+	ent->max_seq = htole64(ent->max_seq);
+	ent->min_block = htole64(ent->min_block);
+	ent->max_block = htole64(ent->max_block);
+	ent->min_ts = htole64(ent->min_ts);
+	ent->max_ts = htole64(ent->max_ts);
+	ent->n_records = htole32(ent->n_records);
+	w->n_index++;
+
+	return 0;
+}
+
+static void
+rx_log_chunk_index(struct rx_log_writer *w)
+{
+	struct rx_log_index_header hd;
+	struct rx_log_index_trailer tr;
+	struct iovec iov[3];
+
+	memset(&hd, 0, sizeof(hd));
+	hd.signature = htole32(RX_LOG_INDEX_SIGNATURE);
+	hd.n_chunks = htole32(w->n_index);
+	memset(&tr, 0, sizeof(tr));
+	tr.offset = htole64(w->seg_bytes);
+	tr.n_chunks = htole32(w->n_index);
+	tr.signature = htole32(RX_LOG_INDEX_SIGNATURE);
+
+	iov[0].iov_base = &hd;
+	iov[0].iov_len = sizeof(hd);
+	iov[1].iov_base = w->index;
+	iov[1].iov_len = sizeof(*w->index) * w->n_index;
+	iov[2].iov_base = &tr;
+	iov[2].iov_len = sizeof(tr);
+	if (wbuf_write_fd(w->fd, iov, 3) < 0)
+		p_err("Cannot write log index: %s\n", strerror(errno));
+	w->n_index = 0;
+}
+
+static void
+rx_log_segment_finish(struct rx_log_writer *w)
+{
+	off_t size;
+
+	if (w->fd < 0)
+		return;
+	if (w->hd.version == RX_LOG_VERSION_CHUNKED)
+		rx_log_chunk_index(w);
+	// give back blocks reserved by fallocate(), if not used.
+	size = lseek(w->fd, 0, SEEK_CUR);
+	if (size >= 0 && ftruncate(w->fd, size) < 0)
+		p_debug("ftruncate() failed: %s\n", strerror(errno));
+	close(w->fd);
+	w->fd = -1;
+}
+
+static uint64_t
+rx_log_rotate_pack(struct rx_context *ctx)
+{
+	// fec_k is never 0 in a session, so the result is never 0.
+	return (uint64_t)ctx->fec_type |
+	    (uint64_t)ctx->fec_k << 8 |
+	    (uint64_t)ctx->fec_n << 16 |
+	    (uint64_t)ctx->ieee80211.channel_id << 32;
+}
+
+static void
+rx_log_writer_rotate(struct rx_log_writer *w, uint64_t rotate)
+{
+	rx_log_segment_finish(w);
+
+	w->hd.fec_type = rotate & 0xff;
+	w->hd.fec_k = (rotate >> 8) & 0xff;
+	w->hd.fec_n = (rotate >> 16) & 0xff;
+	w->hd.channel_id = htole32(rotate >> 32);
+	if (rx_log_segment_start(w) < 0)
+		return;
+	rx_log_segment_prepare(w);
+}
+
+static int
+rx_log_writer_put(struct rx_log_writer *w, const uint8_t *data, size_t size)
+{
+	struct iovec iov;
+
+	if (size == 0)
+		return 0;
+	if (w->fd >= 0 && rx_log_segment_full(w, size))
+		rx_log_segment_finish(w);
+	if (w->fd < 0) {
+		if (rx_log_segment_start(w) < 0)
+			return -1;
+		rx_log_segment_prepare(w);
+	}
+
+	if (w->hd.version == RX_LOG_VERSION_CHUNKED)
+		return rx_log_chunk_write(w, data, size);
+
+	iov.iov_base = (void *)data;
+	iov.iov_len = size;
+	w->seg_bytes += size;
+
+	return wbuf_write_fd(w->fd, &iov, 1);
 }
 
+static int
+rx_log_writer_write(void *arg, int fd, const uint8_t *data, size_t size)
+{
+	struct rx_log_writer *w = arg;
+	struct rx_log_frame_header hd;
+	size_t off = 0, start = 0;
+	int rc = 0;
+
+	// split the buffer at rotation markers.
+	while (off + sizeof(hd) <= size) {
+		memcpy(&hd, data + off, sizeof(hd));
+		if (hd.type == RX_LOG_TYPE_ROTATE) {
+			if (rx_log_writer_put(w, data + start, off - start) < 0)
+				rc = -1;
+			rx_log_writer_rotate(w, hd.seq);
+			start = off + sizeof(hd);
+		}
+		off += sizeof(hd) + rx_log_payload_size(&hd);
+	}
+	if (rx_log_writer_put(w, data + start, size - start) < 0)
+		rc = -1;
+
+	return rc;
+}
+
+static void
+rx_log_writer_close(void *arg, int fd)
+{
+	struct rx_log_writer *w = arg;
+	char name[PATH_MAX];
+
+	rx_log_segment_finish(w);
+	if (w->next_fd >= 0) {
+		// not used. give the seq back.
+		close(w->next_fd);
+		rx_log_segment_name(name, sizeof(name), w->base, w->next_seq);
+		unlink(name);
+		rx_log_seq_store(w->base, w->seq);
+	}
+	rx_log_writer_free(w);
+}
+
+static const struct wbuf_ops rx_log_writer_ops = {
+	.write = rx_log_writer_write,
+	.close = rx_log_writer_close,
+};
+
+static void
+rx_log_writer_free(struct rx_log_writer *w)
+{
+	if (w == NULL)
+		return;
+#ifdef ENABLE_ZSTD
+	if (w->zctx)
+		ZSTD_freeCCtx(w->zctx);
+#endif
+	free(w->zbuf);
+	free(w->index);
+	free(w);
+}
+
+static struct rx_log_writer *
+rx_log_writer_alloc(int version)
+{
+	struct rx_log_writer *w;
+
+	w = (struct rx_log_writer *)malloc(sizeof(*w));
+	if (w == NULL)
+		return NULL;
+	memset(w, 0, sizeof(*w));
+	w->fd = -1;
+	w->next_fd = -1;
+	w->codec = RX_LOG_CODEC_NONE;
+#ifdef ENABLE_ZSTD
+	if (version == RX_LOG_VERSION_CHUNKED) {
+		w->zsize = ZSTD_compressBound(RX_LOG_BUFFER_SIZE);
+		w->zbuf = (uint8_t *)malloc(w->zsize);
+		w->zctx = ZSTD_createCCtx();
+		if (w->zbuf == NULL || w->zctx == NULL) {
+			rx_log_writer_free(w);
+			return NULL;
+		}
+		w->codec = RX_LOG_CODEC_ZSTD;
+	}
+#endif
+
+	return w;
+}
+
+/*
+ * the first call opens the log. later calls, on a tx reboot, only queue
+ * a rotation, so the caller never waits for the disk.
+ */
 void
 rx_log_create(struct rx_context *ctx)
 {
 	struct rx_log_handler *log = &ctx->log_handler;
-	struct rx_log_file_header hd;
+	struct rx_log_writer *w;
+	struct wbuf *wbuf;
 
-	if (log->fp) {
-		fclose(log->fp);
-		log->fp = NULL;
-	}
 	if (wfb_options.log_file == NULL) {
 		return;
 	}
-	fixup_filename(log);
-	log->fp = fopen(log->file_name, "w");
-	if (log->fp) {
-		p_debug("New LOG File: %s\n", log->file_name);
-	}
-	else {
-		p_err("Failed to create File %s: %s\n",
-		    log->file_name, strerror(errno));
+	wbuf = rx_log_wbuf(log);
+	if (wbuf) {
+		__atomic_store_n(&log->rotate, rx_log_rotate_pack(ctx),
+		    __ATOMIC_RELEASE);
+		rx_log_rotate_put(log, wbuf);
 		return;
 	}
 
-	if (fcntl(fileno(log->fp), F_SETFD, FD_CLOEXEC) < 0) {
-		p_err("fcntl(F_SETFD) failed: %s\n", strerror(errno));
+	w = rx_log_writer_alloc(wfb_options.log_version);
+	if (w == NULL) {
+		p_err("Cannot allocate log writer.\n");
 		return;
 	}
-
-	memset(&hd, 0, sizeof(hd));
-	hd.version = RX_LOG_VERSION;
-	hd.fec_type = ctx->fec_type;
-	hd.fec_k = ctx->fec_k;
-	hd.fec_n = ctx->fec_n;
-	hd.channel_id = htole32(ctx->ieee80211.channel_id);
-	hd.signature = htole32(RX_LOG_SIGNATURE);
-	if (fwrite(&hd, sizeof(hd), 1, log->fp) == 0) {
-		p_err("write failed: %s\n", strerror(errno));
-		fclose(log->fp);
-		log->fp = NULL;
+	w->base = wfb_options.log_file;
+	w->hd.version = wfb_options.log_version;
+	w->hd.fec_type = ctx->fec_type;
+	w->hd.fec_k = ctx->fec_k;
+	w->hd.fec_n = ctx->fec_n;
+	w->hd.channel_id = htole32(ctx->ieee80211.channel_id);
+	w->hd.signature = htole32(RX_LOG_SIGNATURE);
+
+	w->seq = rx_log_seq_load(w->base) - 1;
+	if (rx_log_segment_start(w) < 0)
+		goto err;
+	rx_log_segment_prepare(w);
+	rx_log_segment_name(log->file_name, sizeof(log->file_name),
+	    w->base, w->seq);
+
+	wbuf = wbuf_open(-1, RX_LOG_BUFFER_SIZE, RX_LOG_FLUSH_INTERVAL,
+	    &rx_log_writer_ops, w);
+	if (wbuf == NULL) {
+		p_err("Cannot start log writer.\n");
+		goto err;
 	}
-	sync_fp(log->fp);
+	__atomic_store_n(&log->wbuf, wbuf, __ATOMIC_RELEASE);
+
+	return;
+err:
+	rx_log_writer_close(w, -1);
+}
+
+/*
+ * called at exit, after threads which put records are stopped.
+ */
+void
+rx_log_close(struct rx_context *ctx)
+{
+	struct rx_log_handler *log = &ctx->log_handler;
+	struct wbuf *wbuf;
+
+	wbuf = __atomic_exchange_n(&log->wbuf, NULL, __ATOMIC_ACQ_REL);
+	if (wbuf == NULL)
+		return;
+
+	wbuf_close(wbuf); // writes the rest, and a pending rotation.
 }
 
 int
@@ -206,7 +749,6 @@ rx_log_hook(void *arg, enum msg_hook_type msg_type, const char *fmt, va_list ap)
 	struct rx_log_frame_header hd;
 	struct timespec ts;
 	uint8_t type;
-	static int seq = 0;
 
 	char buf[BUFSIZ];
 	int r;
@@ -216,7 +758,7 @@ rx_log_hook(void *arg, enum msg_hook_type msg_type, const char *fmt, va_list ap)
 	assert(ctx);
 	assert(fmt);
 
-	if (log->fp == NULL) {
+	if (rx_log_wbuf(log) == NULL) {
 		return 0;
 	}
 	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
@@ -244,13 +786,12 @@ rx_log_hook(void *arg, enum msg_hook_type msg_type, const char *fmt, va_list ap)
 	memset(&hd, 0, sizeof(hd));
 	hd.tv_sec = htole64(ts.tv_sec);
 	hd.tv_nsec = htole64(ts.tv_nsec);
-	hd.seq = seq++;
+	hd.seq = htole64(__atomic_fetch_add(&log->msg_seq, 1,
+	    __ATOMIC_RELAXED));
 	hd.type = type;
-	hd.size = r;
+	hd.size = htole32(r);
 
-	(void)fwrite(&hd, sizeof(hd), 1, log->fp);
-	(void)fwrite(buf, r, 1, log->fp); // exclude terminating '\0'
-	sync_fp(log->fp);
+	rx_log_put(log, &hd, sizeof(hd), buf, r); // exclude terminating '\0'
 
 	return r;
 }
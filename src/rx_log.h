@@ -4,9 +4,17 @@
 #include <inttypes.h>
 #include "rx_core.h"
 #include "util_msg.h"
+#include "compat.h"
 
 #define RX_LOG_VERSION		1
+#define RX_LOG_VERSION_CHUNKED	2
 #define RX_LOG_SIGNATURE	0xdeadbeef
+#define RX_LOG_CHUNK_SIGNATURE	0x4b4e4843 // "CHNK"
+#define RX_LOG_INDEX_SIGNATURE	0x58444e49 // "INDX"
+
+#define RX_LOG_CODEC_NONE	0
+#define RX_LOG_CODEC_ZSTD	1
+#define RX_LOG_ZSTD_LEVEL	3
 
 #define FRAME_TYPE_UNSPEC	0
 #define FRAME_TYPE_INET6	1
@@ -53,12 +61,77 @@ struct rx_log_frame_header {
 	uint8_t rx_src[16]; // in6_addr
 };
 
+/*
+ * Version 2 (chunked) log:
+ *
+ *   rx_log_file_header
+ *   rx_log_chunk_header, records (compressed) ...
+ *   rx_log_index_header, rx_log_index_entry[n_chunks]
+ *   rx_log_index_trailer
+ *
+ * records in a chunk are the same as version 1, and a chunk never splits
+ * a record. a chunk can be decompressed alone. the index is written when
+ * the log is closed; a reader may start from the trailer at the end of
+ * the file to seek, or read chunks until the index header.
+ */
+struct rx_log_chunk_header {
+	// LE
+	uint32_t signature;
+	uint8_t codec;
+	uint8_t pad[3];
+	uint32_t size; // stored
+	uint32_t raw_size; // decompressed
+};
+
+struct rx_log_index_header {
+	// LE
+	uint32_t signature;
+	uint32_t n_chunks;
+};
+
+struct rx_log_index_entry {
+	// LE
+	uint64_t offset; // of rx_log_chunk_header
+	uint64_t min_seq;
+	uint64_t max_seq;
+	uint64_t min_block;
+	uint64_t max_block;
+	uint64_t min_ts; // [ns]
+	uint64_t max_ts; // [ns]
+	uint32_t n_records;
+	uint32_t pad;
+};
+
+struct rx_log_index_trailer {
+	// LE
+	uint64_t offset; // of rx_log_index_header
+	uint32_t n_chunks;
+	uint32_t signature;
+};
+
+static inline size_t
+rx_log_payload_size(const struct rx_log_frame_header *hd)
+{
+	switch (hd->type) {
+		case FRAME_TYPE_DECODE:
+		case FRAME_TYPE_MSG_INFO:
+		case FRAME_TYPE_MSG_ERR:
+		case FRAME_TYPE_MSG_DEBUG:
+			return le32toh(hd->size);
+		default:
+			break;
+	}
+
+	return 0; // size of the received frame, not stored.
+}
+
 extern void rx_log_corrupt(struct rx_context *ctx);
 extern void rx_log_frame(struct rx_context *ctx,
     uint64_t block_idx, uint8_t fragment_idx, size_t size);
 extern void rx_log_decode(struct rx_context *ctx,
     uint64_t block_idx, uint8_t fragment_idx, uint8_t *data, size_t size);
 extern void rx_log_create(struct rx_context *ctx);
+extern void rx_log_close(struct rx_context *ctx);
 extern int rx_log_hook(void *arg, enum msg_hook_type msg_type, const char *fmt, va_list ap);
 
 #endif /* __RX_LOG_H__ */
@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <assert.h>
+
+#include <event2/event.h>
+
+#include "wfb_params.h"
+#include "net_core.h"
+#include "rx_core.h"
+#include "rx_pipe.h"
+#include "util_msg.h"
+
+static void
+rx_pipe_notify(struct rx_pipe *ctx)
+{
+	uint8_t c = 0;
+
+	// EAGAIN means the consumer has pending notifications already.
+	while (write(ctx->notify[1], &c, sizeof(c)) < 0 && errno == EINTR)
+		;
+}
+
+static struct rx_pipe_desc *
+rx_pipe_reserve(struct rx_pipe *ctx)
+{
+	uint32_t head, tail;
+
+	head = ctx->head; // only the producer writes head.
+	tail = __atomic_load_n(&ctx->tail, __ATOMIC_ACQUIRE);
+	if (head - tail >= ctx->size) {
+		wfb_stats.rx_pipe_overflow[ctx->id]++;
+		return NULL;
+	}
+
+	return &ctx->ring[head & (ctx->size - 1)];
+}
+
+static void
+rx_pipe_commit(struct rx_pipe *ctx)
+{
+	uint32_t head = ctx->head;
+
+	/*
+	 * publish the slot, then check if the consumer went idle. both
+	 * sides use seq_cst so that one of us always sees the other.
+	 */
+	__atomic_store_n(&ctx->head, head + 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ctx->tail, __ATOMIC_SEQ_CST) == head)
+		rx_pipe_notify(ctx);
+}
+
+int
+rx_pipe_push(struct rx_pipe *ctx, uint8_t type, int adapter,
+    const struct sockaddr_in6 *src, const void *data, size_t len)
+{
+	struct rx_pipe_desc *d;
+
+	assert(ctx);
+	assert(data);
+
+	if (len > sizeof(d->data)) {
+		p_info("frame too large for pipe: %zu bytes\n", len);
+		return -1;
+	}
+	d = rx_pipe_reserve(ctx);
+	if (d == NULL)
+		return -1;
+
+	d->type = type;
+	d->adapter = adapter;
+	if (src)
+		memcpy(&d->src, src, sizeof(d->src));
+	else
+		d->src.sin6_family = AF_UNSPEC;
+	d->len = len;
+	memcpy(d->data, data, len);
+	d->ptr = d->data;
+	rx_pipe_commit(ctx);
+
+	return 0;
+}
+
+int
+rx_pipe_push_ref(struct rx_pipe *ctx, uint8_t type, int adapter,
+    void *data, size_t len)
+{
+	struct rx_pipe_desc *d;
+
+	assert(ctx);
+	assert(data);
+
+	d = rx_pipe_reserve(ctx);
+	if (d == NULL)
+		return -1;
+
+	d->type = type;
+	d->adapter = adapter;
+	d->src.sin6_family = AF_UNSPEC;
+	d->len = len;
+	d->ptr = data;
+	rx_pipe_commit(ctx);
+
+	return 0;
+}
+
+bool
+rx_pipe_wait(struct rx_pipe *ctx, uint32_t pos)
+{
+	assert(ctx);
+
+	ctx->wait_pos = pos;
+	__atomic_store_n(&ctx->waiting, true, __ATOMIC_SEQ_CST);
+	if (!rx_pipe_consumed(ctx, pos))
+		return true;
+
+	// passed already. if the consumer took the flag, it writes to us.
+	return !__atomic_exchange_n(&ctx->waiting, false, __ATOMIC_SEQ_CST);
+}
+
+void
+rx_pipe_wait_done(struct rx_pipe *ctx)
+{
+	uint8_t buf[64];
+
+	assert(ctx);
+
+	while (read(ctx->release[0], buf, sizeof(buf)) > 0)
+		;
+}
+
+static void
+rx_pipe_release(struct rx_pipe *ctx, uint32_t tail)
+{
+	uint8_t c = 0;
+
+	if (!__atomic_load_n(&ctx->waiting, __ATOMIC_SEQ_CST))
+		return;
+	if ((int32_t)(tail - ctx->wait_pos) < 0)
+		return;
+	if (!__atomic_exchange_n(&ctx->waiting, false, __ATOMIC_SEQ_CST))
+		return;
+	while (write(ctx->release[1], &c, sizeof(c)) < 0 && errno == EINTR)
+		;
+}
+
+static void
+rx_pipe_drain(evutil_socket_t fd, short event, void *arg)
+{
+	struct rx_pipe *ctx = (struct rx_pipe *)arg;
+	struct rx_context *rx_ctx;
+	struct rx_pipe_desc *d;
+	uint32_t head, tail, used;
+	uint8_t buf[64];
+	int budget = RX_PIPE_BUDGET;
+
+	assert(ctx);
+	rx_ctx = ctx->rx_ctx;
+
+	// consume notifications first, not to lose a wakeup.
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+
+	tail = ctx->tail; // only the consumer writes tail.
+	for (;;) {
+		head = __atomic_load_n(&ctx->head, __ATOMIC_SEQ_CST);
+		if (head == tail)
+			break;
+		if (budget-- == 0) {
+			/*
+			 * let other events run. the producer doesn't notify
+			 * a busy consumer, so wake up ourselves to resume.
+			 */
+			rx_pipe_notify(ctx);
+			return;
+		}
+		used = head - tail;
+		wfb_stats.rx_pipe_occupancy[ctx->id] = used;
+		if (wfb_stats.rx_pipe_hiwat[ctx->id] < used)
+			wfb_stats.rx_pipe_hiwat[ctx->id] = used;
+
+		d = &ctx->ring[tail & (ctx->size - 1)];
+		rx_ctx->rx_adapter = d->adapter;
+		switch (d->type) {
+			case RX_PIPE_PCAP:
+				rx_frame_pcap(rx_ctx, d->ptr, d->len);
+				break;
+			case RX_PIPE_UDP:
+				memcpy(&rx_ctx->rx_src, &d->src,
+				    sizeof(rx_ctx->rx_src));
+				rx_frame_udp(rx_ctx, d->ptr, d->len);
+				break;
+			default:
+				break;
+		}
+		tail++;
+		__atomic_store_n(&ctx->tail, tail, __ATOMIC_SEQ_CST);
+		rx_pipe_release(ctx, tail);
+	}
+	wfb_stats.rx_pipe_occupancy[ctx->id] = 0;
+}
+
+int
+rx_pipe_initialize(struct rx_pipe *ctx,
+    struct netcore_context *net_ctx, struct rx_context *rx_ctx, int id)
+{
+	int i;
+
+	assert(ctx);
+	assert(net_ctx);
+	assert(rx_ctx);
+	assert(id >= 0 && id < RX_MAX_PIPE);
+
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->net_ctx = net_ctx;
+	ctx->rx_ctx = rx_ctx;
+	ctx->id = id;
+	ctx->notify[0] = ctx->notify[1] = -1;
+	ctx->release[0] = ctx->release[1] = -1;
+
+	ctx->size = RX_PIPE_SIZE;
+	ctx->ring = calloc(ctx->size, sizeof(*ctx->ring));
+	if (ctx->ring == NULL) {
+		p_err("cannot allocate memory.\n");
+		goto err;
+	}
+
+	if (pipe(ctx->notify) < 0 || pipe(ctx->release) < 0) {
+		p_err("pipe() failed: %s\n", strerror(errno));
+		goto err;
+	}
+	for (i = 0; i < 4; i++) {
+		int fd = (i < 2) ? ctx->notify[i] : ctx->release[i - 2];
+
+		if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0 ||
+		    fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) {
+			p_err("fcntl() failed: %s\n", strerror(errno));
+			goto err;
+		}
+	}
+
+	ctx->ev = netcore_rx_event_add(net_ctx, ctx->notify[0],
+	    rx_pipe_drain, ctx);
+	if (ctx->ev == NULL) {
+		p_err("Cannot register pipe event.\n");
+		goto err;
+	}
+
+	return 0;
+err:
+	rx_pipe_deinitialize(ctx);
+	return -1;
+}
+
+void
+rx_pipe_deinitialize(struct rx_pipe *ctx)
+{
+	int i;
+
+	assert(ctx);
+
+	if (ctx->ev) {
+		netcore_rx_event_del(ctx->net_ctx, ctx->ev);
+		ctx->ev = NULL;
+	}
+	for (i = 0; i < 2; i++) {
+		if (ctx->notify[i] >= 0) {
+			close(ctx->notify[i]);
+			ctx->notify[i] = -1;
+		}
+		if (ctx->release[i] >= 0) {
+			close(ctx->release[i]);
+			ctx->release[i] = -1;
+		}
+	}
+	if (ctx->ring) {
+		free(ctx->ring);
+		ctx->ring = NULL;
+	}
+}
@@ -0,0 +1,80 @@
+#ifndef __RX_PIPE_H__
+#define __RX_PIPE_H__
+#include <stdint.h>
+#include <stdbool.h>
+#include <netinet/in.h>
+#include <event2/event.h>
+
+#include "wfb_params.h"
+#include "net_core.h"
+#include "rx_core.h"
+#include "util_attribute.h"
+
+/*
+ * Single producer, single consumer ring between a capture thread and
+ * the processing thread. The producer copies a frame into the slot at
+ * the head, the consumer feeds the slot at the tail into rx_frame_*().
+ * Indexes are free running and masked by (size - 1).
+ *
+ * A producer owning its buffer(TPACKET_V3 block) pushes a reference
+ * instead, and keeps the buffer until the tail passes the position
+ * returned by rx_pipe_head(). rx_pipe_wait() makes the consumer write
+ * to release[1] when it does.
+ */
+#define RX_PIPE_PCAP	1
+#define RX_PIPE_UDP	2
+
+struct rx_pipe_desc {
+	uint8_t type;
+	int adapter;
+	struct sockaddr_in6 src;
+	uint8_t *ptr; // data[], or the producer's buffer
+	size_t len;
+	uint8_t data[PCAP_MTU];
+};
+
+struct rx_pipe {
+	struct netcore_context *net_ctx; // consumer
+	struct rx_context *rx_ctx;
+	int id;
+
+	struct rx_pipe_desc *ring;
+	uint32_t size;
+	uint32_t head __aligned(CACHE_LINE_SIZE); // written by producer
+	uint32_t tail __aligned(CACHE_LINE_SIZE); // written by consumer
+
+	int notify[2];
+	struct event *ev;
+
+	uint32_t wait_pos __aligned(CACHE_LINE_SIZE); // written by producer
+	bool waiting;
+	int release[2]; // consumer to producer
+};
+
+extern int rx_pipe_initialize(struct rx_pipe *ctx,
+    struct netcore_context *net_ctx, struct rx_context *rx_ctx, int id);
+extern void rx_pipe_deinitialize(struct rx_pipe *ctx);
+
+extern int rx_pipe_push(struct rx_pipe *ctx, uint8_t type, int adapter,
+    const struct sockaddr_in6 *src, const void *data, size_t len);
+extern int rx_pipe_push_ref(struct rx_pipe *ctx, uint8_t type, int adapter,
+    void *data, size_t len);
+extern bool rx_pipe_wait(struct rx_pipe *ctx, uint32_t pos);
+extern void rx_pipe_wait_done(struct rx_pipe *ctx);
+
+static inline uint32_t
+rx_pipe_head(struct rx_pipe *ctx)
+{
+	// only the producer writes head.
+	return ctx->head;
+}
+
+static inline bool
+rx_pipe_consumed(struct rx_pipe *ctx, uint32_t pos)
+{
+	uint32_t tail = __atomic_load_n(&ctx->tail, __ATOMIC_SEQ_CST);
+
+	return (int32_t)(tail - pos) >= 0;
+}
+
+#endif /* __RX_PIPE_H__ */
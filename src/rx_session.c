@@ -12,6 +12,7 @@
 #include "rx_core.h"
 #include "rx_session.h"
 #include "rx_log.h"
+#include "rx_worker.h"
 #include "frame_wfb.h"
 #include "util_msg.h"
 
@@ -26,7 +27,8 @@ rx_session_dump(struct rx_context *ctx)
 	p_info("fec_k: %u\n", ctx->fec_k);
 	p_info("fec_n: %u\n", ctx->fec_n);
 	p_info("session_key: 0x%s\n",
-	    s_binary(ctx->session_key, sizeof(ctx->session_key)));
+	    s_binary(ctx->crypto.session_key,
+	    sizeof(ctx->crypto.session_key)));
 }
 
 int
@@ -35,6 +37,8 @@ rx_session(struct rx_context *ctx)
 	struct wfb_session_hdr *hdr;
 	uint64_t epoch;
 	bool tx_reboot = false;
+	bool hitless = false;
+	size_t pktlen = 0;
 	int r;
 
 	assert(ctx);
@@ -45,6 +49,19 @@ rx_session(struct rx_context *ctx)
 		p_err("Frame too short\n");
 		return -1;
 	}
+	if (ctx->crypto.has_session_key &&
+	    ctx->wfb.pktlen == ctx->session_pktlen &&
+	    memcmp(ctx->session_pkt, ctx->wfb.hdr, ctx->wfb.pktlen) == 0) {
+		// Same as the last accepted one. No need to decrypt.
+		wfb_stats.session_skipped++;
+		return 0;
+	}
+	// the frame is decrypted in place. keep a copy until accepted.
+	ctx->session_pktlen = 0;
+	if (ctx->wfb.pktlen <= sizeof(ctx->session_pkt)) {
+		memcpy(ctx->session_pkt, ctx->wfb.hdr, ctx->wfb.pktlen);
+		pktlen = ctx->wfb.pktlen;
+	}
 
 	r = crypto_wfb_session_decrypt(ctx->wfb.cipher, ctx->wfb.cipher,
 	    ctx->wfb.cipherlen, ctx->wfb.nonce);
@@ -53,10 +70,12 @@ rx_session(struct rx_context *ctx)
 	hdr = (struct wfb_session_hdr *)ctx->wfb.cipher;
 	epoch = be64toh(hdr->epoch);
 
-	if (ctx->has_session_key &&
-	    memcmp(ctx->session_key, hdr->session_key, sizeof(ctx->session_key)) == 0 &&
+	if (ctx->crypto.has_session_key &&
+	    memcmp(ctx->crypto.session_key, hdr->session_key,
+	    sizeof(ctx->crypto.session_key)) == 0 &&
 	    epoch == ctx->epoch) {
 		// No rekeying required. drop the frame siliently.
+		ctx->session_pktlen = pktlen;
 		return 0;
 	}
 
@@ -64,8 +83,13 @@ rx_session(struct rx_context *ctx)
 		tx_reboot = true;
 	}
 
+	if (ctx->workers) {
+		// deliver frames of the current session before rekeying.
+		rx_worker_drain(ctx->workers);
+	}
+
 	// Start rekeying. We need strict error checking before accepting.
-	ctx->has_session_key = false;
+	ctx->crypto.has_session_key = false;
 	if (ctx->channel_id && ctx->channel_id != be32toh(hdr->channel_id)) {
 		p_err("Channel ID mismach\n");
 		return -1;
@@ -90,20 +114,51 @@ rx_session(struct rx_context *ctx)
 		p_err("Cannot Initialize FEC\n");
 		return -1;
 	}
-	if (ctx->rx_ring)
-		rbuf_free(ctx->rx_ring);
-	ctx->rx_ring = rbuf_alloc(RX_RING_SIZE, MAX_FEC_PAYLOAD, hdr->fec_n);
-	if (ctx->rx_ring == NULL) {
-		p_err("Cannot Initialize Rx Buffer\n");
-		return -1;
+	wfb_stats.session_rekey++;
+	ctx->rekey_check = false;
+	if (ctx->rx_ring && ctx->rx_ring->fragment_nof == hdr->fec_n) {
+		if (tx_reboot || ctx->fec_k != hdr->fec_k) {
+			// block index or layout is changed.
+			rbuf_reset(ctx->rx_ring);
+		}
+		else {
+			// blocks of the previous session are kept.
+			hitless = true;
+			wfb_stats.session_rekey_hitless++;
+			/*
+			 * the new session may restart the block index.
+			 * rx_data() rebases the ring if it does.
+			 */
+			ctx->rekey_check =
+			    (ctx->rx_ring->last_block != BLOCK_INVAL);
+			ctx->rekey_prev_block = ctx->rx_ring->last_block;
+			ctx->rekey_end_block = BLOCK_INVAL;
+		}
+	}
+	else {
+		if (ctx->rx_ring)
+			rbuf_free(ctx->rx_ring);
+		// parity fragments are stored sealed, see rx_data.c
+		ctx->rx_ring = rbuf_alloc(RX_RING_SIZE,
+		    MAX_FEC_PAYLOAD + crypto_aead_chacha20poly1305_ABYTES,
+		    hdr->fec_n, wfb_options.rx_hugepage);
+		if (ctx->rx_ring == NULL) {
+			p_err("Cannot Initialize Rx Buffer\n");
+			return -1;
+		}
+		// workers decrypt into slots of blocks not allocated yet.
+		ctx->rx_ring->pinned = (ctx->workers != NULL);
 	}
 	ctx->epoch = epoch;
 	ctx->fec_type = hdr->fec_type;
 	ctx->fec_k = hdr->fec_k;
 	ctx->fec_n = hdr->fec_n;
-	memcpy(ctx->session_key, hdr->session_key, sizeof(ctx->session_key));
-	crypto_wfb_session_key_set(hdr->session_key, sizeof(hdr->session_key));
-	ctx->has_session_key = true;
+	if (crypto_wfb_session_key_set(&ctx->crypto,
+	    hdr->session_key, sizeof(hdr->session_key), hitless) < 0)
+		return -1;
+	if (ctx->workers)
+		rx_worker_set_key(ctx->workers, &ctx->crypto);
+	ctx->session_pktlen = pktlen;
 
 	if (tx_reboot) {
 		/* rotate log file */
@@ -0,0 +1,580 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <assert.h>
+
+#include <pthread.h>
+#include <event2/event.h>
+
+#include "wfb_params.h"
+#include "frame_wfb.h"
+#include "crypto_wfb.h"
+#include "fec_wfb.h"
+#include "net_core.h"
+#include "rx_core.h"
+#include "rx_data.h"
+#include "rx_worker.h"
+#include "util_msg.h"
+
+// a block has one FEC job at most, and it's in the ring.
+#if RX_RING_SIZE > RX_WORKER_QUEUE
+#error "RX_WORKER_QUEUE must hold FEC jobs for all blocks in the ring."
+#endif
+
+static inline struct rx_worker_job *
+rx_worker_job(struct rx_worker_pool *pool, uint64_t seq)
+{
+	return &pool->jobs[seq % RX_WORKER_QUEUE];
+}
+
+static void
+rx_worker_notify(struct rx_worker_pool *pool)
+{
+	uint8_t c = 0;
+
+	// EAGAIN means the processing thread has pending notifications.
+	while (write(pool->notify[1], &c, sizeof(c)) < 0 && errno == EINTR)
+		;
+}
+
+static inline struct rx_worker_fec *
+rx_worker_fec(struct rx_worker_pool *pool, uint64_t seq)
+{
+	return &pool->fecs[seq % RX_WORKER_QUEUE];
+}
+
+static void
+rx_worker_decrypt(struct rx_worker_pool *pool, struct rx_worker_job *job)
+{
+	// the copy of the keys is not changed while jobs are in flight.
+	job->plain_len = job->dst_size;
+	job->result = crypto_wfb_data_decrypt(&pool->crypto,
+	    job->dst, &job->plain_len, job->pkt, job->hdrlen,
+	    job->pkt + job->hdrlen, job->pktlen - job->hdrlen,
+	    job->pkt + job->nonce_off);
+}
+
+/*
+ * decrypt the parities and recover the block. the block takes no more
+ * fragments until the job is applied.
+ */
+static void
+rx_worker_recover(struct rx_worker_pool *pool, struct rx_worker_fec *fec)
+{
+	struct rx_context *ctx = pool->rx_ctx;
+
+	fec->result = rx_data_unseal_parity(ctx, &pool->crypto, fec->blk);
+	if (fec->result < 0)
+		return;
+	fec->size = rx_data_fec_prepare(ctx, fec->blk,
+	    fec->in, fec->out, fec->index);
+	fec_wfb_apply(&ctx->fec, fec->in, fec->out, fec->index, fec->size);
+}
+
+/*
+ * FEC writes lost fragments of the block. a late fragment of the block
+ * may be decrypted into the same slot, wait for it.
+ */
+static bool
+rx_worker_fec_blocked_locked(struct rx_worker_pool *pool,
+    struct rx_worker_fec *fec)
+{
+	struct rx_worker_job *job;
+	uint64_t seq;
+
+	for (seq = pool->complete; seq != pool->submit; seq++) {
+		job = rx_worker_job(pool, seq);
+		if (job->direct && job->block_idx == fec->block_idx &&
+		    job->state != RX_JOB_DONE)
+			return true;
+	}
+
+	return false;
+}
+
+static void *
+rx_worker_main(void *arg)
+{
+	struct rx_worker_pool *pool = (struct rx_worker_pool *)arg;
+	struct rx_worker_job *job;
+	struct rx_worker_fec *fec;
+	bool head;
+
+	assert(pool);
+
+	pthread_mutex_lock(&pool->lock);
+	while (!pool->stop) {
+		fec = rx_worker_fec(pool, pool->fec_take);
+		if (pool->fec_take != pool->fec_submit &&
+		    !rx_worker_fec_blocked_locked(pool, fec)) {
+			pool->fec_take++;
+			fec->state = RX_JOB_RUNNING;
+			pthread_mutex_unlock(&pool->lock);
+
+			rx_worker_recover(pool, fec);
+
+			pthread_mutex_lock(&pool->lock);
+			fec->state = RX_JOB_DONE;
+			head = (fec == rx_worker_fec(pool, pool->fec_complete));
+			if (head)
+				rx_worker_notify(pool);
+			pthread_cond_broadcast(&pool->cv_done);
+			continue;
+		}
+		if (pool->take != pool->submit) {
+			job = rx_worker_job(pool, pool->take++);
+			if (job->state == RX_JOB_DONE)
+				continue; // sealed parity, nothing to do.
+			job->state = RX_JOB_RUNNING;
+			pthread_mutex_unlock(&pool->lock);
+
+			rx_worker_decrypt(pool, job);
+
+			pthread_mutex_lock(&pool->lock);
+			job->state = RX_JOB_DONE;
+			// later jobs wait for the head, no need to wake up.
+			head = (job == rx_worker_job(pool, pool->complete));
+			if (head)
+				rx_worker_notify(pool);
+			pthread_cond_broadcast(&pool->cv_done);
+			if (job->direct && pool->fec_take != pool->fec_submit)
+				pthread_cond_broadcast(&pool->cv_work);
+			continue;
+		}
+		pthread_cond_wait(&pool->cv_work, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+static bool
+rx_worker_fec_ready_locked(struct rx_worker_pool *pool)
+{
+	if (pool->fec_complete == pool->fec_submit)
+		return false;
+
+	return rx_worker_fec(pool, pool->fec_complete)->state == RX_JOB_DONE;
+}
+
+static bool
+rx_worker_ready_locked(struct rx_worker_pool *pool)
+{
+	if (rx_worker_fec_ready_locked(pool))
+		return true;
+	if (pool->complete == pool->submit)
+		return false;
+
+	return rx_worker_job(pool, pool->complete)->state == RX_JOB_DONE;
+}
+
+static bool
+rx_worker_idle_locked(struct rx_worker_pool *pool)
+{
+	return (pool->complete == pool->submit &&
+	    pool->fec_complete == pool->fec_submit);
+}
+
+/*
+ * apply the head FEC job if it's done. the ring may submit the next FEC
+ * job from rx_data_recovered(), so the slot is released first.
+ */
+static bool
+rx_worker_fec_complete_locked(struct rx_worker_pool *pool)
+{
+	struct rx_worker_fec *fec;
+	struct rbuf_block *blk;
+	int result;
+
+	if (!rx_worker_fec_ready_locked(pool))
+		return false;
+
+	fec = rx_worker_fec(pool, pool->fec_complete);
+	blk = fec->blk;
+	result = fec->result;
+	fec->blk = NULL;
+	fec->state = RX_JOB_FREE;
+	pool->fec_complete++;
+	pthread_mutex_unlock(&pool->lock);
+	if (result > 0)
+		wfb_stats.session_prev_key += result;
+	rx_data_recovered(pool->rx_ctx, blk, result >= 0);
+	pthread_mutex_lock(&pool->lock);
+
+	return true;
+}
+
+/*
+ * apply finished jobs in submission order. called by the processing
+ * thread only.
+ */
+static void
+rx_worker_complete(struct rx_worker_pool *pool)
+{
+	struct rx_context *ctx = pool->rx_ctx;
+	struct rx_worker_job *job;
+
+	pthread_mutex_lock(&pool->lock);
+	while (rx_worker_ready_locked(pool)) {
+		if (rx_worker_fec_complete_locked(pool))
+			continue;
+
+		job = rx_worker_job(pool, pool->complete);
+		pthread_mutex_unlock(&pool->lock);
+
+		if (job->result < 0) {
+			if (ctx->crypto.has_session_key) {
+				// invalidate session
+				ctx->crypto.has_session_key = false;
+				rx_context_dump(ctx);
+			}
+		}
+		else if (job->sealed) {
+			// may submit FEC job. no copy if dst is the slot.
+			rx_data_sealed(ctx, job->block_idx,
+			    job->fragment_idx, job->dbm, job->adapter,
+			    job->dst, job->plain_len);
+		}
+		else {
+			if (job->result > 0)
+				wfb_stats.session_prev_key++;
+			// may submit FEC job. no copy if dst is the slot.
+			rx_data_complete(ctx, job->block_idx,
+			    job->fragment_idx, job->dbm, job->adapter,
+			    job->dst, job->plain_len);
+		}
+
+		pthread_mutex_lock(&pool->lock);
+		job->state = RX_JOB_FREE;
+		job->direct = false;
+		pool->complete++;
+		// sealed jobs are applied without being taken.
+		if (pool->take < pool->complete)
+			pool->take = pool->complete;
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static void
+rx_worker_event(evutil_socket_t fd, short event, void *arg)
+{
+	struct rx_worker_pool *pool = (struct rx_worker_pool *)arg;
+	uint8_t buf[64];
+
+	assert(pool);
+
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+
+	rx_worker_complete(pool);
+}
+
+/*
+ * the ring slot can be the destination if no job in flight is for the
+ * same fragment, or for a block which takes the slot over. a direct
+ * job of an older block may still write the same slot.
+ */
+static bool
+rx_worker_direct_ok(struct rx_worker_pool *pool, uint64_t block_idx,
+    uint8_t fragment_idx, struct rbuf *rbuf)
+{
+	struct rx_worker_job *job;
+	uint64_t seq;
+
+	for (seq = pool->complete; seq != pool->submit; seq++) {
+		job = rx_worker_job(pool, seq);
+		if (job->block_idx >= block_idx + rbuf->ring_size)
+			return false;
+		if (job->block_idx == block_idx) {
+			if (job->fragment_idx == fragment_idx)
+				return false;
+		}
+		else if (job->direct && rbuf_slot(rbuf, job->block_idx) ==
+		    rbuf_slot(rbuf, block_idx))
+			return false;
+	}
+
+	return true;
+}
+
+int
+rx_worker_submit(struct rx_worker_pool *pool, struct rx_context *ctx)
+{
+	struct rx_worker_job *job;
+	uint8_t *slot = NULL;
+	bool sealed;
+
+	assert(pool);
+	assert(ctx);
+
+	if (ctx->wfb.pktlen > sizeof(job->pkt)) {
+		p_err("Frame too long\n");
+		return -1;
+	}
+	sealed = (ctx->wfb.fragment_idx >= ctx->fec_k);
+	if (sealed && !rx_worker_pending(pool)) {
+		// nothing to keep in order. store it as rx_data() does.
+		return rx_data_sealed(ctx, ctx->wfb.block_idx,
+		    ctx->wfb.fragment_idx, ctx->dbm, ctx->rx_adapter,
+		    ctx->wfb.cipher, ctx->wfb.cipherlen);
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->submit - pool->complete >= RX_WORKER_QUEUE)
+		wfb_stats.rx_worker_stall++;
+	while (pool->submit - pool->complete >= RX_WORKER_QUEUE) {
+		// queue is full. apply finished jobs here.
+		if (rx_worker_ready_locked(pool)) {
+			pthread_mutex_unlock(&pool->lock);
+			rx_worker_complete(pool);
+			pthread_mutex_lock(&pool->lock);
+			continue;
+		}
+		pthread_cond_wait(&pool->cv_done, &pool->lock);
+	}
+	job = rx_worker_job(pool, pool->submit);
+	pthread_mutex_unlock(&pool->lock);
+
+	// the slot is owned by us until submit is advanced.
+	job->block_idx = ctx->wfb.block_idx;
+	job->fragment_idx = ctx->wfb.fragment_idx;
+	job->dbm = ctx->dbm;
+	job->adapter = ctx->rx_adapter;
+	job->sealed = sealed;
+
+	// submit and complete are modified by this thread only.
+	slot = rx_data_slot(ctx, job->block_idx, job->fragment_idx);
+	if (slot && !rx_worker_direct_ok(pool, job->block_idx,
+	    job->fragment_idx, ctx->rx_ring))
+		slot = NULL;
+	if (sealed) {
+		/*
+		 * the parity is applied after the jobs before it. keep the
+		 * cipher text in the slot, or in the job if it's taken.
+		 */
+		if (ctx->wfb.cipherlen > ctx->rx_ring->fragment_size) {
+			p_err("Buffer exhausted.\n");
+			return -1;
+		}
+		job->direct = (slot != NULL);
+		job->dst = slot ? slot : job->pkt;
+		job->plain_len = ctx->wfb.cipherlen;
+		job->result = 0;
+		memcpy(job->dst, ctx->wfb.cipher, ctx->wfb.cipherlen);
+
+		pthread_mutex_lock(&pool->lock);
+		job->state = RX_JOB_DONE;
+		pool->submit++;
+		pthread_mutex_unlock(&pool->lock);
+		return 0;
+	}
+
+	job->pktlen = ctx->wfb.pktlen;
+	job->hdrlen = ctx->wfb.hdrlen;
+	job->nonce_off = ctx->wfb.nonce - (uint8_t *)ctx->wfb.hdr;
+	memcpy(job->pkt, ctx->wfb.hdr, ctx->wfb.pktlen);
+	if (slot) {
+		job->direct = true;
+		job->dst = slot;
+		job->dst_size = ctx->rx_ring->fragment_size;
+		wfb_stats.rx_worker_direct++;
+	}
+	else {
+		job->direct = false;
+		job->dst = job->plain;
+		job->dst_size = sizeof(job->plain);
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	job->state = RX_JOB_QUEUED;
+	pool->submit++;
+	wfb_stats.rx_worker_jobs++;
+	pthread_cond_signal(&pool->cv_work);
+	pthread_mutex_unlock(&pool->lock);
+
+	return 0;
+}
+
+int
+rx_worker_submit_fec(struct rx_worker_pool *pool, struct rbuf_block *blk)
+{
+	struct rx_worker_fec *fec;
+
+	assert(pool);
+	assert(blk);
+
+	assert(pool->fec_submit - pool->fec_complete < RX_WORKER_QUEUE);
+	fec = rx_worker_fec(pool, pool->fec_submit);
+	assert(fec->state == RX_JOB_FREE);
+	fec->blk = blk;
+	fec->block_idx = blk->index;
+	fec->result = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	fec->state = RX_JOB_QUEUED;
+	pool->fec_submit++;
+	wfb_stats.rx_worker_fec++;
+	pthread_cond_signal(&pool->cv_work);
+	pthread_mutex_unlock(&pool->lock);
+
+	return 0;
+}
+
+/*
+ * wait for all FEC jobs and apply them. decrypt jobs are left. the Rx
+ * ring can slide over the blocks after this.
+ */
+void
+rx_worker_fec_sync(struct rx_worker_pool *pool)
+{
+	assert(pool);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->fec_complete != pool->fec_submit) {
+		if (!rx_worker_fec_complete_locked(pool))
+			pthread_cond_wait(&pool->cv_done, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * wait for all jobs and apply them. the Rx ring and the session key
+ * can be modified after this.
+ */
+void
+rx_worker_drain(struct rx_worker_pool *pool)
+{
+	assert(pool);
+
+	pthread_mutex_lock(&pool->lock);
+	while (!rx_worker_idle_locked(pool)) {
+		if (!rx_worker_ready_locked(pool)) {
+			pthread_cond_wait(&pool->cv_done, &pool->lock);
+			continue;
+		}
+		pthread_mutex_unlock(&pool->lock);
+		rx_worker_complete(pool);
+		pthread_mutex_lock(&pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * take a copy of the session keys for the workers. called after the
+ * keys are changed. jobs in flight are finished with the old copy.
+ */
+void
+rx_worker_set_key(struct rx_worker_pool *pool,
+    const struct crypto_wfb_context *crypto)
+{
+	assert(pool);
+	assert(crypto);
+
+	rx_worker_drain(pool);
+	// the workers take the next job under the lock, and see this.
+	memcpy(&pool->crypto, crypto, sizeof(pool->crypto));
+}
+
+struct rx_worker_pool *
+rx_worker_create(struct netcore_context *net_ctx,
+    struct rx_context *rx_ctx, int n)
+{
+	struct rx_worker_pool *pool;
+	int i, err;
+
+	assert(net_ctx);
+	assert(rx_ctx);
+
+	if (n > RX_MAX_WORKER)
+		n = RX_MAX_WORKER;
+
+	pool = (struct rx_worker_pool *)calloc(1, sizeof(*pool));
+	if (pool == NULL) {
+		p_err("cannot allocate memory.\n");
+		return NULL;
+	}
+	pool->net_ctx = net_ctx;
+	pool->rx_ctx = rx_ctx;
+	memcpy(&pool->crypto, &rx_ctx->crypto, sizeof(pool->crypto));
+	pool->notify[0] = pool->notify[1] = -1;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cv_work, NULL);
+	pthread_cond_init(&pool->cv_done, NULL);
+
+	pool->jobs = calloc(RX_WORKER_QUEUE, sizeof(*pool->jobs));
+	pool->fecs = calloc(RX_WORKER_QUEUE, sizeof(*pool->fecs));
+	if (pool->jobs == NULL || pool->fecs == NULL) {
+		p_err("cannot allocate memory.\n");
+		goto err;
+	}
+
+	if (pipe(pool->notify) < 0) {
+		p_err("pipe() failed: %s\n", strerror(errno));
+		goto err;
+	}
+	for (i = 0; i < 2; i++) {
+		if (fcntl(pool->notify[i], F_SETFL, O_NONBLOCK) < 0 ||
+		    fcntl(pool->notify[i], F_SETFD, FD_CLOEXEC) < 0) {
+			p_err("fcntl() failed: %s\n", strerror(errno));
+			goto err;
+		}
+	}
+	pool->ev = netcore_rx_event_add(net_ctx, pool->notify[0],
+	    rx_worker_event, pool);
+	if (pool->ev == NULL) {
+		p_err("Cannot register worker event.\n");
+		goto err;
+	}
+
+	for (i = 0; i < n; i++) {
+		err = pthread_create(&pool->tid[i], NULL,
+		    rx_worker_main, pool);
+		if (err != 0) {
+			p_err("pthread_create() failed: %s\n", strerror(err));
+			goto err;
+		}
+		pool->n_worker++;
+	}
+
+	return pool;
+err:
+	rx_worker_destroy(pool);
+	return NULL;
+}
+
+void
+rx_worker_destroy(struct rx_worker_pool *pool)
+{
+	int i;
+
+	if (pool == NULL)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->cv_work);
+	pthread_mutex_unlock(&pool->lock);
+	for (i = 0; i < pool->n_worker; i++)
+		pthread_join(pool->tid[i], NULL);
+
+	if (pool->ev) {
+		netcore_rx_event_del(pool->net_ctx, pool->ev);
+		pool->ev = NULL;
+	}
+	for (i = 0; i < 2; i++) {
+		if (pool->notify[i] >= 0)
+			close(pool->notify[i]);
+	}
+	if (pool->jobs)
+		free(pool->jobs);
+	if (pool->fecs)
+		free(pool->fecs);
+	pthread_cond_destroy(&pool->cv_done);
+	pthread_cond_destroy(&pool->cv_work);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
@@ -0,0 +1,135 @@
+#ifndef __RX_WORKER_H__
+#define __RX_WORKER_H__
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <event2/event.h>
+
+#include "wfb_params.h"
+#include "frame_wfb.h"
+#include "crypto_wfb.h"
+#include "net_core.h"
+#include "util_rbuf.h"
+
+/*
+ * Decrypt/FEC worker pool.
+ *
+ * rx_data() copies each data frame into a job and the workers decrypt
+ * it in parallel. Finished jobs are applied to the Rx ring on the
+ * processing thread strictly in submission order, so decode handlers
+ * see the same sequence as the inline path. A data fragment is
+ * decrypted into its ring slot directly if no other block can take the
+ * slot until the job is applied, otherwise into the job. Parity
+ * fragments are not decrypted here. They are stored sealed at once if
+ * no job is in flight, otherwise queued as done without a worker.
+ *
+ * FEC recovery runs on the workers too, one job per block. A FEC job
+ * decrypts the parities it needs and recovers the block. FEC jobs are
+ * started and applied in submission order, and the ring delivers
+ * recovered blocks in block order. Decrypt jobs are applied meanwhile.
+ *
+ * Workers use a copy of the session keys taken by rx_worker_set_key()
+ * while the pool is idle, so the processing thread can invalidate the
+ * session of the Rx context at any time.
+ */
+struct rx_context;
+
+enum rx_job_state {
+	RX_JOB_FREE,
+	RX_JOB_QUEUED,
+	RX_JOB_RUNNING,
+	RX_JOB_DONE,
+};
+
+struct rx_worker_job {
+	enum rx_job_state state;
+
+	/* meta data */
+	uint64_t block_idx;
+	uint8_t fragment_idx;
+	int16_t dbm;
+	int adapter;
+
+	/* cipher text */
+	bool sealed; // parity, stored sealed without a worker
+	uint8_t pkt[MAX_DATA_PACKET_SIZE];
+	size_t pktlen;
+	size_t hdrlen;
+	size_t nonce_off;
+
+	/* result */
+	bool direct; // dst is the ring slot
+	uint8_t *dst; // ring slot, or plain
+	size_t dst_size;
+	uint8_t plain[MAX_FEC_PAYLOAD];
+	unsigned long long plain_len;
+	int result;
+};
+
+struct rx_worker_fec {
+	enum rx_job_state state;
+
+	struct rbuf_block *blk;
+	uint64_t block_idx;
+	const uint8_t *in[MAX_FEC_N];
+	uint8_t *out[MAX_FEC_N];
+	unsigned index[MAX_FEC_N];
+	size_t size;
+	int result; // parities decrypted by the previous key, or -1
+};
+
+struct rx_worker_pool {
+	struct netcore_context *net_ctx;
+	struct rx_context *rx_ctx;
+	struct crypto_wfb_context crypto; // written while the pool is idle
+
+	pthread_mutex_t lock;
+	pthread_cond_t cv_work; // to workers
+	pthread_cond_t cv_done; // to processing thread
+	bool stop;
+
+	pthread_t tid[RX_MAX_WORKER];
+	int n_worker;
+
+	struct rx_worker_job *jobs;
+	uint64_t submit;   // next job to be submitted
+	uint64_t take;     // next job to be taken by workers
+	uint64_t complete; // next job to be applied
+
+	struct rx_worker_fec *fecs;
+	uint64_t fec_submit;
+	uint64_t fec_take;
+	uint64_t fec_complete;
+
+	int notify[2];
+	struct event *ev;
+};
+
+extern struct rx_worker_pool *rx_worker_create(
+    struct netcore_context *net_ctx, struct rx_context *rx_ctx, int n);
+extern void rx_worker_destroy(struct rx_worker_pool *pool);
+
+extern int rx_worker_submit(struct rx_worker_pool *pool,
+    struct rx_context *ctx);
+extern int rx_worker_submit_fec(struct rx_worker_pool *pool,
+    struct rbuf_block *blk);
+extern void rx_worker_drain(struct rx_worker_pool *pool);
+extern void rx_worker_fec_sync(struct rx_worker_pool *pool);
+extern void rx_worker_set_key(struct rx_worker_pool *pool,
+    const struct crypto_wfb_context *crypto);
+
+/* submit and complete are modified by the processing thread. */
+static inline bool
+rx_worker_pending(struct rx_worker_pool *pool)
+{
+	return (pool->complete != pool->submit);
+}
+
+/* fec_submit and fec_complete are modified by the processing thread. */
+static inline bool
+rx_worker_fec_pending(struct rx_worker_pool *pool)
+{
+	return (pool->fec_complete != pool->fec_submit);
+}
+
+#endif /* __RX_WORKER_H__ */
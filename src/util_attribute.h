@@ -10,5 +10,10 @@
 #ifndef __unused
 #define __unused __attribute__((unused))
 #endif
+#ifndef __aligned
+#define __aligned(x) __attribute__((aligned(x)))
+#endif
+
+#define CACHE_LINE_SIZE 64
 
 #endif /* __UTIL_ATTRIBUTE_H__ */
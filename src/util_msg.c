@@ -1,14 +1,60 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sched.h>
+#include <time.h>
 #include <assert.h>
 
 #include "wfb_params.h"
 #include "util_msg.h"
 
+/*
+ * messages are formatted by the caller and written to stdout/stderr by
+ * a writer thread, once msg_async_start() is called. the queue is a
+ * bounded MPSC ring. a message is dropped if the queue is full, so the
+ * caller never blocks. one message, including the function name, is one
+ * entry so lines of threads never interleave. the hook is also invoked
+ * by the writer thread, with the formatted message.
+ *
+ * the writer thread wakes up every MSG_RATELIMIT_INTERVAL to report
+ * suppressed messages of call sites gone quiet.
+ */
+#define MSG_QUEUE_SIZE	256 // must be power of 2
+#define MSG_LEN		512
+
+struct msg_entry {
+	uint64_t seq;
+	enum msg_hook_type type;
+	char buf[MSG_LEN];
+};
+
+struct msg_queue {
+	uint64_t tail; // producers
+	uint64_t head; // writer thread
+	uint32_t producers; // callers between the running check and publish
+	bool running;
+	bool stop;
+	bool waiting;
+	int wakeup[2]; // pipe
+	pthread_t thread;
+	struct msg_entry entry[MSG_QUEUE_SIZE];
+};
+
 struct msg_hook_def {
 	int (*func)(void *arg, enum msg_hook_type, const char *, va_list);
 	void *arg;
 } msg_hook = { NULL, NULL };
+static pthread_mutex_t msg_hook_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct msg_queue msg_queue;
+static struct msg_ratelimit *msg_ratelimit_list;
+static uint64_t msg_suppressed;
+static uint64_t msg_dropped;
 
 static void
 invoke_hook(enum msg_hook_type type, const char *fmt, va_list ap)
@@ -19,6 +65,209 @@ invoke_hook(enum msg_hook_type type, const char *fmt, va_list ap)
 	msg_hook.func(msg_hook.arg, type, fmt, ap);
 }
 
+static FILE *
+msg_fp(enum msg_hook_type type)
+{
+	return (type == MSG_TYPE_INFO) ? stdout : stderr;
+}
+
+static void
+msg_enqueue(enum msg_hook_type type, const char *prefix,
+    const char *fmt, va_list ap)
+{
+	struct msg_queue *q = &msg_queue;
+	struct msg_entry *e;
+	uint64_t pos, seq;
+	int n = 0;
+
+	pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+	for (;;) {
+		e = &q->entry[pos & (MSG_QUEUE_SIZE - 1)];
+		seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+		if (seq == pos) {
+			if (__atomic_compare_exchange_n(&q->tail, &pos,
+			    pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if ((int64_t)(seq - pos) < 0) {
+			// full
+			__atomic_add_fetch(&msg_dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		else {
+			pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+		}
+	}
+
+	e->type = type;
+	if (prefix)
+		n = snprintf(e->buf, sizeof(e->buf), "%s", prefix);
+	if (n >= 0 && n < sizeof(e->buf)) // may truncate.
+		vsnprintf(e->buf + n, sizeof(e->buf) - n, fmt, ap);
+	__atomic_store_n(&e->seq, pos + 1, __ATOMIC_RELEASE);
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_exchange_n(&q->waiting, false, __ATOMIC_SEQ_CST))
+		(void)write(q->wakeup[1], "", 1);
+}
+
+static void
+invoke_hook_prefix(enum msg_hook_type type, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	invoke_hook(type, fmt, ap);
+	va_end(ap);
+}
+
+static bool
+msg_dequeue(struct msg_queue *q)
+{
+	struct msg_entry *e;
+
+	e = &q->entry[q->head & (MSG_QUEUE_SIZE - 1)];
+	if (__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) != q->head + 1)
+		return false;
+
+	fputs(e->buf, msg_fp(e->type));
+	pthread_mutex_lock(&msg_hook_lock);
+	invoke_hook_prefix(e->type, "%s", e->buf);
+	pthread_mutex_unlock(&msg_hook_lock);
+	__atomic_store_n(&e->seq, q->head + MSG_QUEUE_SIZE, __ATOMIC_RELEASE);
+	q->head++;
+
+	return true;
+}
+
+static void
+msg_ratelimit_expire(struct msg_ratelimit *rl, const char *func, uint64_t now)
+{
+	uint64_t window;
+	uint32_t suppressed;
+
+	window = __atomic_load_n(&rl->window, __ATOMIC_RELAXED);
+	if (now - window < MSG_RATELIMIT_INTERVAL ||
+	    !__atomic_compare_exchange_n(&rl->window, &window, now, false,
+	    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		return;
+
+	__atomic_store_n(&rl->count, 0, __ATOMIC_RELAXED);
+	suppressed = __atomic_exchange_n(&rl->suppressed, 0, __ATOMIC_RELAXED);
+	if (suppressed > 0)
+		__p_err("%s: %u messages suppressed.\n", func, suppressed);
+}
+
+static void
+msg_ratelimit_flush(void)
+{
+	struct msg_ratelimit *rl;
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		return;
+
+	rl = __atomic_load_n(&msg_ratelimit_list, __ATOMIC_ACQUIRE);
+	for (; rl; rl = rl->next)
+		msg_ratelimit_expire(rl, rl->func, ts.tv_sec);
+}
+
+static void *
+msg_writer(void *arg)
+{
+	struct msg_queue *q = arg;
+	struct pollfd pfd;
+	char c;
+
+	for (;;) {
+		while (msg_dequeue(q))
+			;
+		fflush(stdout);
+		fflush(stderr);
+		if (__atomic_load_n(&q->stop, __ATOMIC_ACQUIRE))
+			break;
+
+		__atomic_store_n(&q->waiting, true, __ATOMIC_SEQ_CST);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (msg_dequeue(q)) {
+			__atomic_store_n(&q->waiting, false, __ATOMIC_SEQ_CST);
+			continue;
+		}
+		if (__atomic_load_n(&q->stop, __ATOMIC_ACQUIRE))
+			continue;
+		pfd.fd = q->wakeup[0];
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, MSG_RATELIMIT_INTERVAL * 1000) > 0)
+			(void)read(q->wakeup[0], &c, sizeof(c));
+		else
+			__atomic_store_n(&q->waiting, false, __ATOMIC_SEQ_CST);
+		msg_ratelimit_flush();
+	}
+
+	return NULL;
+}
+
+/*
+ * msg_async_stop() waits for producers which have seen running == true,
+ * so their messages are published before the last drain.
+ */
+static bool
+msg_async_enter(struct msg_queue *q)
+{
+	__atomic_add_fetch(&q->producers, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&q->running, __ATOMIC_SEQ_CST))
+		return true;
+	__atomic_sub_fetch(&q->producers, 1, __ATOMIC_SEQ_CST);
+	return false;
+}
+
+static void
+msg_async_exit(struct msg_queue *q)
+{
+	__atomic_sub_fetch(&q->producers, 1, __ATOMIC_RELEASE);
+}
+
+static void
+msg_vprint(enum msg_hook_type type, const char *prefix, const char *fmt,
+    va_list ap)
+{
+	va_list ap_hook;
+	char buf[MSG_LEN];
+
+	if (msg_async_enter(&msg_queue)) {
+		// the writer thread invokes the hook.
+		msg_enqueue(type, prefix, fmt, ap);
+		msg_async_exit(&msg_queue);
+		return;
+	}
+
+	va_copy(ap_hook, ap);
+	flockfile(msg_fp(type));
+	if (prefix)
+		fputs(prefix, msg_fp(type));
+	vfprintf(msg_fp(type), fmt, ap);
+	funlockfile(msg_fp(type));
+	if (prefix && msg_hook.func) {
+		// the hook also takes a message at once.
+		vsnprintf(buf, sizeof(buf), fmt, ap_hook);
+		invoke_hook_prefix(type, "%s%s", prefix, buf);
+	}
+	else {
+		invoke_hook(type, fmt, ap_hook);
+	}
+	va_end(ap_hook);
+}
+
+static void
+msg_vprint_func(enum msg_hook_type type, const char *tag,
+    const char *func, const char *fmt, va_list ap)
+{
+	char prefix[128];
+
+	snprintf(prefix, sizeof(prefix), "%s%s: ", tag, func);
+	msg_vprint(type, prefix, fmt, ap);
+}
+
 __attribute__((format(printf, 1, 2)))
 void
 __p_info(const char *fmt, ...)
@@ -28,8 +277,7 @@ __p_info(const char *fmt, ...)
 	assert(fmt);
 
 	va_start(ap, fmt);
-	vfprintf(stdout, fmt, ap);
-	invoke_hook(MSG_TYPE_INFO, fmt, ap);
+	msg_vprint(MSG_TYPE_INFO, NULL, fmt, ap);
 	va_end(ap);
 }
 
@@ -42,8 +290,7 @@ __p_err(const char *fmt, ...)
 	assert(fmt);
 
 	va_start(ap, fmt);
-	vfprintf(stderr, fmt, ap);
-	invoke_hook(MSG_TYPE_ERR, fmt, ap);
+	msg_vprint(MSG_TYPE_ERR, NULL, fmt, ap);
 	va_end(ap);
 }
 
@@ -59,14 +306,149 @@ __p_debug(const char *fmt, ...)
 	assert(fmt);
 
 	va_start(ap, fmt);
-	vfprintf(stderr, fmt, ap);
-	invoke_hook(MSG_TYPE_DEBUG, fmt, ap);
+	msg_vprint(MSG_TYPE_DEBUG, NULL, fmt, ap);
+	va_end(ap);
+}
+
+__attribute__((format(printf, 2, 3)))
+void
+__p_err_func(const char *func, const char *fmt, ...)
+{
+	va_list ap;
+
+	assert(func);
+	assert(fmt);
+
+	va_start(ap, fmt);
+	msg_vprint_func(MSG_TYPE_ERR, "", func, fmt, ap);
+	va_end(ap);
+}
+
+__attribute__((format(printf, 2, 3)))
+void
+__p_debug_func(const char *func, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (!wfb_options.debug)
+		return;
+
+	assert(func);
+	assert(fmt);
+
+	va_start(ap, fmt);
+	msg_vprint_func(MSG_TYPE_DEBUG, "--Debug-- ", func, fmt, ap);
 	va_end(ap);
 }
 
 void
 msg_set_hook(int(*func)(void *, enum msg_hook_type, const char *, va_list), void *arg)
 {
+	// the writer thread doesn't use the old hook after we return.
+	pthread_mutex_lock(&msg_hook_lock);
 	msg_hook.func = func;
 	msg_hook.arg = arg;
+	pthread_mutex_unlock(&msg_hook_lock);
+}
+
+static void
+msg_ratelimit_register(struct msg_ratelimit *rl, const char *func)
+{
+	struct msg_ratelimit *head;
+
+	if (__atomic_exchange_n(&rl->listed, true, __ATOMIC_RELAXED))
+		return;
+
+	// call sites are static. never removed.
+	rl->func = func;
+	head = __atomic_load_n(&msg_ratelimit_list, __ATOMIC_RELAXED);
+	do {
+		rl->next = head;
+	} while (!__atomic_compare_exchange_n(&msg_ratelimit_list, &head, rl,
+	    true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+bool
+msg_ratelimit(struct msg_ratelimit *rl, const char *func)
+{
+	struct timespec ts;
+
+	assert(rl);
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		return true;
+	msg_ratelimit_expire(rl, func, ts.tv_sec);
+
+	if (__atomic_add_fetch(&rl->count, 1, __ATOMIC_RELAXED) <=
+	    MSG_RATELIMIT_BURST)
+		return true;
+
+	__atomic_add_fetch(&rl->suppressed, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&msg_suppressed, 1, __ATOMIC_RELAXED);
+	msg_ratelimit_register(rl, func);
+	return false;
+}
+
+int
+msg_async_start(void)
+{
+	struct msg_queue *q = &msg_queue;
+	static bool registered = false;
+	int i;
+
+	if (q->running)
+		return 0;
+
+	for (i = 0; i < MSG_QUEUE_SIZE; i++)
+		q->entry[i].seq = i;
+	q->head = q->tail = 0;
+	q->stop = false;
+	q->waiting = false;
+
+	if (pipe(q->wakeup) < 0)
+		return -1;
+	(void)fcntl(q->wakeup[1], F_SETFL,
+	    fcntl(q->wakeup[1], F_GETFL) | O_NONBLOCK);
+
+	if (pthread_create(&q->thread, NULL, msg_writer, q) != 0) {
+		close(q->wakeup[0]);
+		close(q->wakeup[1]);
+		return -1;
+	}
+	__atomic_store_n(&q->running, true, __ATOMIC_RELEASE);
+	if (!registered) {
+		atexit(msg_async_stop);
+		registered = true;
+	}
+
+	return 0;
+}
+
+void
+msg_async_stop(void)
+{
+	struct msg_queue *q = &msg_queue;
+
+	if (!q->running)
+		return;
+
+	// new messages are written directly from now.
+	__atomic_store_n(&q->running, false, __ATOMIC_SEQ_CST);
+	// wait for messages in flight. the writer drains them at last.
+	while (__atomic_load_n(&q->producers, __ATOMIC_SEQ_CST) > 0)
+		sched_yield();
+	__atomic_store_n(&q->stop, true, __ATOMIC_RELEASE);
+	(void)write(q->wakeup[1], "", 1);
+	pthread_join(q->thread, NULL);
+	close(q->wakeup[0]);
+	close(q->wakeup[1]);
+}
+
+void
+msg_get_stats(uint64_t *suppressed, uint64_t *dropped)
+{
+	if (suppressed)
+		*suppressed = __atomic_load_n(&msg_suppressed, __ATOMIC_RELAXED);
+	if (dropped)
+		*dropped = __atomic_load_n(&msg_dropped, __ATOMIC_RELAXED);
 }
@@ -8,6 +8,26 @@
 #include <netdb.h>
 #include "util_attribute.h"
 
+/*
+ * p_err() is limited to MSG_RATELIMIT_BURST messages per
+ * MSG_RATELIMIT_INTERVAL for each call site. the number of suppressed
+ * messages is reported when the interval expires, by the writer thread
+ * of msg_async_start(), or by the call site when it's allowed again.
+ */
+#define MSG_RATELIMIT_BURST	10
+#define MSG_RATELIMIT_INTERVAL	1 // [s]
+
+struct msg_ratelimit {
+	uint64_t window; // [s]
+	uint32_t count;
+	uint32_t suppressed;
+
+	/* list of call sites which have suppressed messages */
+	const char *func;
+	bool listed;
+	struct msg_ratelimit *next;
+};
+
 enum msg_hook_type {
 	MSG_TYPE_NONE,
 	MSG_TYPE_INFO,
@@ -18,9 +38,15 @@ enum msg_hook_type {
 extern void __p_info(const char *fmt, ...) __printf;
 extern void __p_err(const char *fmt, ...) __printf;
 extern void __p_debug(const char *fmt, ...) __printf;
+extern void __p_err_func(const char *func, const char *fmt, ...) __fprintf;
+extern void __p_debug_func(const char *func, const char *fmt, ...) __fprintf;
 extern void msg_set_hook(
     int(*func)(void *, enum msg_hook_type, const char *, va_list),
     void *arg);
+extern bool msg_ratelimit(struct msg_ratelimit *rl, const char *func);
+extern int msg_async_start(void);
+extern void msg_async_stop(void);
+extern void msg_get_stats(uint64_t *suppressed, uint64_t *dropped);
 extern int debug;
 
 #define p_info(fmt, ...) do { \
@@ -28,13 +54,14 @@ extern int debug;
 } while (0)
 
 #define p_err(fmt, ...) do { \
-	__p_err("%s: ", __func__); \
-	__p_err(fmt, ##__VA_ARGS__); \
+	static struct msg_ratelimit __rl; \
+	if (!msg_ratelimit(&__rl, __func__)) \
+		break; \
+	__p_err_func(__func__, fmt, ##__VA_ARGS__); \
 } while (0)
 
 #define p_debug(fmt, ...) do { \
-	__p_debug("--Debug-- %s: ", __func__); \
-	__p_debug(fmt, ##__VA_ARGS__); \
+	__p_debug_func(__func__, fmt, ##__VA_ARGS__); \
 } while (0)
 
 static inline const char *
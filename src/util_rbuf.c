@@ -1,63 +1,146 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
+#include <errno.h>
 #include <assert.h>
 
+#include <sys/mman.h>
+
 #include "util_rbuf.h"
 #include "util_msg.h"
 
+#define ROUNDUP(x, a) ((((x) + (a) - 1) / (a)) * (a))
+#define HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+static void *
+rbuf_slab_alloc(size_t size, bool *hugepage)
+{
+	void *slab;
+	int err;
+
+#ifdef MAP_HUGETLB
+	if (*hugepage) {
+		slab = mmap(NULL, ROUNDUP(size, HUGEPAGE_SIZE),
+		    PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (slab != MAP_FAILED)
+			return slab; // zero filled.
+		p_info("Cannot allocate hugepages: %s\n", strerror(errno));
+	}
+#endif
+	*hugepage = false;
+
+	err = posix_memalign(&slab, CACHE_LINE_SIZE, size);
+	if (err != 0)
+		return NULL;
+	memset(slab, 0, size);
+
+	return slab;
+}
+
+static void
+rbuf_slab_free(void *slab, size_t size, bool hugepage)
+{
+	if (slab == NULL)
+		return;
+#ifdef MAP_HUGETLB
+	if (hugepage) {
+		munmap(slab, ROUNDUP(size, HUGEPAGE_SIZE));
+		return;
+	}
+#endif
+	free(slab);
+}
+
+static void
+rbuf_block_reset(struct rbuf_block *blk, uint64_t block_idx)
+{
+	struct rbuf *rbuf = blk->rbuf;
+
+	blk->index = block_idx;
+	blk->fragment_used = 0;
+	blk->fragment_to_send = 0;
+	blk->deadline = 0;
+	blk->flags = 0;
+	// fragment_flags are set when a fragment is stored.
+	memset(blk->fragment_len, 0, sizeof(size_t) * rbuf->fragment_nof);
+	memset(blk->rssi, INT8_MIN, sizeof(int8_t) * rbuf->fragment_nof);
+}
+
+static void
+rbuf_update_front(struct rbuf *rbuf)
+{
+	// skip completed blocks. stops at last_block + 1 if empty.
+	while (rbuf->front_block <= rbuf->last_block &&
+	    rbuf_slot(rbuf, rbuf->front_block)->index != rbuf->front_block)
+		rbuf->front_block++;
+}
+
 struct rbuf *
-rbuf_alloc(size_t ring_size, size_t frag_size, size_t nfrag)
+rbuf_alloc(size_t ring_size, size_t frag_size, size_t nfrag, bool hugepage)
 {
 	struct rbuf *rbuf;
+	size_t off_blocks, off_frags, off_lens, off_rssi, off_flags, off_data;
+	size_t frag_stride, size;
+	uint8_t *slab;
 	int i;
 
-	rbuf = (struct rbuf *)malloc(sizeof(*rbuf));
-	if (rbuf == NULL)
+	assert(ring_size > 0);
+	assert((ring_size & (ring_size - 1)) == 0);
+	assert(nfrag > 0);
+
+	// layout: rbuf, blocks, fragment[], fragment_len[], rssi[], flags[],
+	// data
+	frag_stride = ROUNDUP(frag_size, CACHE_LINE_SIZE);
+	off_blocks = ROUNDUP(sizeof(*rbuf), CACHE_LINE_SIZE);
+	off_frags = off_blocks + sizeof(struct rbuf_block) * ring_size;
+	off_lens = ROUNDUP(off_frags +
+	    sizeof(uint8_t *) * nfrag * ring_size, CACHE_LINE_SIZE);
+	off_rssi = ROUNDUP(off_lens +
+	    sizeof(size_t) * nfrag * ring_size, CACHE_LINE_SIZE);
+	off_flags = off_rssi + sizeof(int8_t) * nfrag * ring_size;
+	off_data = ROUNDUP(off_flags +
+	    sizeof(uint8_t) * nfrag * ring_size, CACHE_LINE_SIZE);
+	size = off_data + frag_stride * nfrag * ring_size;
+
+	slab = rbuf_slab_alloc(size, &hugepage);
+	if (slab == NULL)
 		return NULL;
-	rbuf->ring_size = ring_size;
-	rbuf->ring_front = 0;
-	rbuf->ring_alloc = 0;
 
+	rbuf = (struct rbuf *)slab;
+	rbuf->ring_size = ring_size;
+	rbuf->ring_mask = ring_size - 1;
 	rbuf->fragment_nof = nfrag;
 	rbuf->fragment_size = frag_size;
+	rbuf->front_block = BLOCK_INVAL;
 	rbuf->last_block = BLOCK_INVAL;
+	rbuf->last_seq = 0;
+	rbuf->blocks = (struct rbuf_block *)(slab + off_blocks);
+	rbuf->slab = slab;
+	rbuf->slab_size = size;
+	rbuf->hugepage = hugepage;
 
-	rbuf->blocks =
-	    (struct rbuf_block *)calloc(ring_size, sizeof(struct rbuf_block));
-	if (rbuf->blocks == NULL) {
-		goto err;
-	}
 	for (i = 0; i < ring_size; i++) {
 		struct rbuf_block *blk = &rbuf->blocks[i];
+		size_t base = (size_t)i * nfrag;
 		int j;
 
+		blk->rbuf = rbuf;
 		blk->index = BLOCK_INVAL;
-		blk->fragment =
-		    (uint8_t **)calloc(nfrag, sizeof(uint8_t *));
-		if (blk->fragment == NULL)
-			goto err;
+		blk->fragment = (uint8_t **)(slab + off_frags) + base;
+		blk->fragment_len = (size_t *)(slab + off_lens) + base;
+		blk->rssi = (int8_t *)(slab + off_rssi) + base;
+		blk->fragment_flags = (uint8_t *)(slab + off_flags) + base;
 		for (j = 0; j < nfrag; j++) {
-			blk->fragment[j] = (uint8_t *)malloc(frag_size);
-			if (blk->fragment[j] == NULL)
-				goto err;
+			blk->fragment[j] =
+			    slab + off_data + (base + j) * frag_stride;
 		}
-		blk->fragment_len = (size_t *)calloc(nfrag, sizeof(size_t));
-		if (blk->fragment_len == NULL)
-			goto err;
-		blk->rssi = (int8_t *)malloc(nfrag);
-		if (blk->rssi == NULL)
-			goto err;
 		memset(blk->rssi, INT8_MIN, sizeof(int8_t) * nfrag);
-		blk->rbuf = rbuf;
 	}
 
 	return rbuf;
-err:
-	rbuf_free(rbuf);
-	return NULL;
-
 }
 
 void
@@ -66,87 +149,70 @@ rbuf_free(struct rbuf *rbuf)
 	if (rbuf == NULL)
 		return;
 
-	if (rbuf->blocks) {
-		int i;
-
-		for (i = 0; i < rbuf->ring_size; i++) {
-			struct rbuf_block *blk = &rbuf->blocks[i];
-
-			if (blk->fragment) {
-				int j;
-
-				for (j = 0; j < rbuf->fragment_nof; j++) {
-					if (blk->fragment[j])
-						free(blk->fragment[j]);
-				}
-				free(blk->fragment);
-			}
-			if (blk->fragment_len)
-				free(blk->fragment_len);
-			if (blk->rssi)
-				free(blk->rssi);
-		}
-		free(rbuf->blocks);
-	}
+	rbuf_slab_free(rbuf->slab, rbuf->slab_size, rbuf->hugepage);
+}
 
-	free(rbuf);
+void
+rbuf_reset(struct rbuf *rbuf)
+{
+	int i;
+
+	assert(rbuf);
+
+	for (i = 0; i < rbuf->ring_size; i++)
+		rbuf->blocks[i].index = BLOCK_INVAL;
+	rbuf->front_block = BLOCK_INVAL;
+	rbuf->last_block = BLOCK_INVAL;
+	rbuf->last_seq = 0;
 }
 
 struct rbuf_block *
 rbuf_get_block(struct rbuf *rbuf, uint64_t block_idx)
 {
-	int new_blocks;
-	uint64_t allocate_start;
-	size_t idx = 0;
-	int i;
+	struct rbuf_block *blk;
+	uint64_t allocate_start, i;
 
 	assert(rbuf);
 
-	for (i = 0; i < rbuf->ring_alloc; i++) {
-		idx = (rbuf->ring_front + i) % rbuf->ring_size;
-
-		if (rbuf->blocks[idx].index == block_idx)
-			return &rbuf->blocks[idx];
-	}
 	if (rbuf->last_block != BLOCK_INVAL && block_idx <= rbuf->last_block) {
-		// out of the sliding window.
+		blk = rbuf_slot(rbuf, block_idx);
+		if (blk->index == block_idx)
+			return blk;
+
+		// completed, or out of the sliding window.
 		return NULL;
 	}
 
 	// should be new block(s)
-	new_blocks = (rbuf->last_block == BLOCK_INVAL) ?
-	    1 : block_idx - rbuf->last_block;
-	if (new_blocks > rbuf->ring_size)
-		new_blocks = rbuf->ring_size;
-	allocate_start = block_idx - new_blocks + 1;
+	if (rbuf->last_block == BLOCK_INVAL) {
+		allocate_start = block_idx;
+		rbuf->front_block = block_idx;
+	}
+	else if (rbuf->front_block > rbuf->last_block && !rbuf->pinned) {
+		// all slots are free. take over the slot of the last block.
+		rbuf->ring_shift += rbuf->last_block - block_idx;
+		if (block_idx - rbuf->last_block > rbuf->ring_size)
+			allocate_start = block_idx - rbuf->ring_size + 1;
+		else
+			allocate_start = rbuf->last_block + 1;
+		rbuf->front_block = allocate_start;
+	}
+	else if (block_idx - rbuf->last_block > rbuf->ring_size)
+		allocate_start = block_idx - rbuf->ring_size + 1;
+	else
+		allocate_start = rbuf->last_block + 1;
 
 	// force allocate blocks. existing blocks are dropped silently..
-	for (i = 0; i < new_blocks; i++)
-	{
-		struct rbuf_block *blk;
-
-		idx = (rbuf->ring_front + rbuf->ring_alloc + i) %
-		    rbuf->ring_size;
-		blk = &rbuf->blocks[idx];
-
-		// drop
-		if (blk->index != BLOCK_INVAL)
-			rbuf_free_block(blk);
-
-		// new
-		blk->index = (allocate_start + i);
-		blk->fragment_used = 0;
-		blk->fragment_to_send = 0;
-		memset(blk->fragment_len, 0,
-		    sizeof(size_t) * rbuf->fragment_nof);
-		memset(blk->rssi,
-		    INT8_MIN, sizeof(int8_t) * rbuf->fragment_nof);
-		rbuf->ring_alloc++;
-	}
+	for (i = allocate_start; i <= block_idx; i++)
+		rbuf_block_reset(rbuf_slot(rbuf, i), i);
 
-	// idx is point to block_idx here.
 	rbuf->last_block = block_idx;
-	return &rbuf->blocks[idx];
+	if (rbuf->front_block < allocate_start &&
+	    block_idx - rbuf->front_block >= rbuf->ring_size)
+		rbuf->front_block = block_idx - rbuf->ring_size + 1;
+	rbuf_update_front(rbuf);
+
+	return rbuf_slot(rbuf, block_idx);
 }
 
 void
@@ -156,18 +222,18 @@ rbuf_free_block(struct rbuf_block *block)
 
 	if (block == NULL)
 		return;
-       	rbuf = block->rbuf;
+	rbuf = block->rbuf;
 	if (rbuf == NULL) {
 		p_err("broken data structure\n");
-		return; 
+		return;
 	}
 
-	block->index = BLOCK_INVAL;
-
-	while (rbuf->blocks[rbuf->ring_front].index == BLOCK_INVAL) {
-		rbuf->ring_alloc--;
-		if (rbuf->ring_alloc == 0)
-			break;
-		rbuf->ring_front = (rbuf->ring_front + 1) % rbuf->ring_size;
+	// the front moves only if the front block is released.
+	if (block->index != rbuf->front_block) {
+		block->index = BLOCK_INVAL;
+		return;
 	}
+	block->index = BLOCK_INVAL;
+	rbuf->front_block++;
+	rbuf_update_front(rbuf);
 }
@@ -1,46 +1,83 @@
 #ifndef __UTIL_RINGBUF_H__
 #define __UTIL_RINGBUF_H__
 #include <stdint.h>
+#include <stdbool.h>
+
+#include "util_attribute.h"
 
 struct rbuf;
 
 struct rbuf_block {
-	uint64_t index;
+	uint64_t index; // acts as generation of the slot
 	size_t fragment_used;
 	size_t fragment_to_send;
 	uint8_t **fragment;
 	int8_t *rssi;
 	size_t *fragment_len;
+	uint8_t *fragment_flags;
+	uint64_t deadline; // [us] release time in reorder mode, 0 if unset
+	uint8_t flags; // RBUF_B_*
 
 	struct rbuf *rbuf;
-};
+} __aligned(CACHE_LINE_SIZE);
 
+/*
+ * Block N is stored in the slot ((N + ring_shift) & ring_mask).
+ * ring_size is a power of two. Blocks, metadata and fragments are
+ * carved from one cache line aligned slab.
+ *
+ * When all blocks are released, the next block takes the slot of the
+ * last one, so in-order blocks reuse fragments in the cache. A user
+ * holding slots of blocks not allocated yet sets pinned to keep them.
+ */
 struct rbuf {
 	size_t ring_size;
-	size_t ring_front;
-	size_t ring_alloc;
+	uint64_t ring_mask; // ring_size - 1
+	uint64_t ring_shift;
+	bool pinned; // slots of blocks never move
 
 	size_t fragment_nof;
 	size_t fragment_size;
 
+	uint64_t front_block; // oldest block in the window
 	uint64_t last_block; // last allocated block
 	uint64_t last_seq; // last received seq.#
 
 	struct rbuf_block *blocks;
+
+	void *slab;
+	size_t slab_size;
+	bool hugepage;
 };
 
 #define BLOCK_INVAL ((uint64_t)-1)
 
+#define RBUF_F_SEALED	0x01 // fragment is not decrypted yet. valid if
+			     // fragment_len is not 0.
+
+#define RBUF_B_RECOVERING	0x01 // FEC is running on a worker
+#define RBUF_B_RECOVERED	0x02 // FEC is done, not delivered yet
+#define RBUF_B_STALE		0x04 // purged behind a block under FEC
+#define RBUF_B_CUT		0x08 // cut through when the FEC before it is done
+// the block takes no more fragments.
+#define RBUF_B_DONE	(RBUF_B_RECOVERING | RBUF_B_RECOVERED | RBUF_B_STALE)
+
 extern struct rbuf *rbuf_alloc(size_t ring_size,
-    size_t frag_size, size_t nfrag);
+    size_t frag_size, size_t nfrag, bool hugepage);
 extern void rbuf_free(struct rbuf *rbuf);
+extern void rbuf_reset(struct rbuf *rbuf);
 
 extern struct rbuf_block *rbuf_get_block(struct rbuf *rbuf,
     uint64_t block_idx);
 extern void rbuf_free_block(struct rbuf_block *block);
 
+static inline struct rbuf_block *rbuf_slot(struct rbuf *rbuf,
+    uint64_t block_idx) {
+	return &rbuf->blocks[(block_idx + rbuf->ring_shift) & rbuf->ring_mask];
+}
+
 static inline struct rbuf_block *rbuf_get_front(struct rbuf *rbuf) {
-	return &rbuf->blocks[rbuf->ring_front];
+	return rbuf_slot(rbuf, rbuf->front_block);
 }
 
 static inline int rbuf_block_is_front(struct rbuf_block *block) {
@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "util_wbuf.h"
+#include "util_msg.h"
+
+static void
+wbuf_swap(struct wbuf *wbuf)
+{
+	// must be locked, and the other buffer must be free.
+	assert(!wbuf->busy);
+
+	wbuf->active = !wbuf->active;
+	wbuf->busy = true;
+	pthread_cond_signal(&wbuf->cond);
+}
+
+static void
+wbuf_deadline(struct wbuf *wbuf, struct timespec *ts)
+{
+	uint64_t nsec;
+
+	clock_gettime(CLOCK_REALTIME, ts);
+	nsec = ts->tv_nsec + wbuf->flush_us * 1000;
+	ts->tv_sec += nsec / 1000000000;
+	ts->tv_nsec = nsec % 1000000000;
+}
+
+int
+wbuf_write_fd(int fd, struct iovec *iov, int iovcnt)
+{
+	ssize_t n;
+
+	// iov is consumed.
+	while (iovcnt > 0) {
+		n = writev(fd, iov, iovcnt);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		while (iovcnt > 0 && n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (uint8_t *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+
+	return 0;
+}
+
+static int
+wbuf_flush_buffer(struct wbuf *wbuf, int idx)
+{
+	struct iovec iov;
+
+	if (wbuf->ops && wbuf->ops->write)
+		return wbuf->ops->write(wbuf->ops_arg, wbuf->fd,
+		    wbuf->buf[idx], wbuf->len[idx]);
+
+	iov.iov_base = wbuf->buf[idx];
+	iov.iov_len = wbuf->len[idx];
+	return wbuf_write_fd(wbuf->fd, &iov, 1);
+}
+
+static void *
+wbuf_writer(void *arg)
+{
+	struct wbuf *wbuf = arg;
+	struct timespec deadline;
+	int idx, rc;
+
+	pthread_mutex_lock(&wbuf->lock);
+	wbuf_deadline(wbuf, &deadline);
+	for (;;) {
+		while (!wbuf->busy && !wbuf->stop) {
+			if (pthread_cond_timedwait(&wbuf->cond, &wbuf->lock,
+			    &deadline) != ETIMEDOUT)
+				continue;
+			wbuf_deadline(wbuf, &deadline);
+			if (wbuf->len[wbuf->active] > 0)
+				wbuf_swap(wbuf);
+		}
+		if (!wbuf->busy) {
+			// stopped. write the rest.
+			if (wbuf->len[wbuf->active] == 0)
+				break;
+			wbuf_swap(wbuf);
+		}
+
+		idx = !wbuf->active;
+		pthread_mutex_unlock(&wbuf->lock);
+
+		rc = wbuf_flush_buffer(wbuf, idx);
+		if (rc < 0) {
+			wbuf->error = errno;
+			p_err("write() failed: %s\n", strerror(errno));
+		}
+
+		pthread_mutex_lock(&wbuf->lock);
+		if (rc == 0)
+			wbuf->written += wbuf->len[idx];
+		wbuf->len[idx] = 0;
+		wbuf->busy = false;
+	}
+	pthread_mutex_unlock(&wbuf->lock);
+
+	if (wbuf->ops && wbuf->ops->close)
+		wbuf->ops->close(wbuf->ops_arg, wbuf->fd);
+
+	return NULL;
+}
+
+struct wbuf *
+wbuf_open(int fd, size_t size, int flush_ms,
+    const struct wbuf_ops *ops, void *ops_arg)
+{
+	struct wbuf *wbuf;
+
+	assert(fd >= 0 || (ops && ops->write)); // ops may own the file.
+	assert(size > 0);
+
+	wbuf = (struct wbuf *)malloc(sizeof(*wbuf));
+	if (wbuf == NULL)
+		return NULL;
+	memset(wbuf, 0, sizeof(*wbuf));
+	wbuf->fd = fd;
+	wbuf->size = size;
+	wbuf->flush_us = (uint64_t)flush_ms * 1000;
+	wbuf->ops = ops;
+	wbuf->ops_arg = ops_arg;
+
+	wbuf->buf[0] = (uint8_t *)malloc(size);
+	wbuf->buf[1] = (uint8_t *)malloc(size);
+	if (wbuf->buf[0] == NULL || wbuf->buf[1] == NULL)
+		goto err;
+
+	pthread_mutex_init(&wbuf->lock, NULL);
+	pthread_cond_init(&wbuf->cond, NULL);
+	if (pthread_create(&wbuf->thread, NULL, wbuf_writer, wbuf) != 0) {
+		p_err("Cannot create writer thread.\n");
+		pthread_cond_destroy(&wbuf->cond);
+		pthread_mutex_destroy(&wbuf->lock);
+		goto err;
+	}
+
+	return wbuf;
+err:
+	free(wbuf->buf[0]);
+	free(wbuf->buf[1]);
+	free(wbuf);
+	return NULL;
+}
+
+void
+wbuf_close(struct wbuf *wbuf)
+{
+	if (wbuf == NULL)
+		return;
+
+	pthread_mutex_lock(&wbuf->lock);
+	wbuf->stop = true;
+	pthread_cond_signal(&wbuf->cond);
+	pthread_mutex_unlock(&wbuf->lock);
+	pthread_join(wbuf->thread, NULL);
+
+	if (wbuf->fd >= 0)
+		close(wbuf->fd);
+	pthread_cond_destroy(&wbuf->cond);
+	pthread_mutex_destroy(&wbuf->lock);
+	free(wbuf->buf[0]);
+	free(wbuf->buf[1]);
+	free(wbuf);
+}
+
+int
+wbuf_writev(struct wbuf *wbuf, const struct iovec *iov, int iovcnt)
+{
+	size_t total = 0;
+	uint8_t *p;
+	int i;
+
+	assert(wbuf);
+
+	for (i = 0; i < iovcnt; i++)
+		total += iov[i].iov_len;
+
+	pthread_mutex_lock(&wbuf->lock);
+	if (total > wbuf->size || wbuf->stop)
+		goto drop;
+	if (wbuf->len[wbuf->active] + total > wbuf->size) {
+		if (wbuf->busy)
+			goto drop; // the disk cannot keep up.
+		wbuf_swap(wbuf);
+	}
+
+	p = wbuf->buf[wbuf->active] + wbuf->len[wbuf->active];
+	for (i = 0; i < iovcnt; i++) {
+		memcpy(p, iov[i].iov_base, iov[i].iov_len);
+		p += iov[i].iov_len;
+	}
+	wbuf->len[wbuf->active] += total;
+	pthread_mutex_unlock(&wbuf->lock);
+
+	return 0;
+drop:
+	wbuf->dropped++;
+	pthread_mutex_unlock(&wbuf->lock);
+	return -1;
+}
+
+int
+wbuf_write(struct wbuf *wbuf, const void *data, size_t size)
+{
+	struct iovec iov;
+
+	iov.iov_base = (void *)data;
+	iov.iov_len = size;
+
+	return wbuf_writev(wbuf, &iov, 1);
+}
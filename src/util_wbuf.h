@@ -0,0 +1,55 @@
+#ifndef __UTIL_WBUF_H__
+#define __UTIL_WBUF_H__
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+/*
+ * Double buffered asynchronous file writer.
+ *
+ * Producers append records to the active buffer. A full buffer is
+ * handed to the writer thread, which writes it by a single write()
+ * while producers fill the other one. If both buffers are in use, the
+ * record is dropped; producers never wait for the disk. The active
+ * buffer is also handed over after the flush interval, so records reach
+ * the file while the traffic is low.
+ *
+ * ops can replace the write of a buffer, e.g. to compress it. buffers
+ * are always handed over at record boundaries. ops->close is called by
+ * the writer thread after the last buffer is written.
+ */
+struct wbuf_ops {
+	int (*write)(void *arg, int fd, const uint8_t *data, size_t size);
+	void (*close)(void *arg, int fd);
+};
+
+struct wbuf {
+	int fd;
+	size_t size;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+	bool stop;
+
+	uint8_t *buf[2];
+	size_t len[2];
+	int active; // buffer filled by producers
+	bool busy; // the other buffer is owned by the writer
+	uint64_t flush_us;
+	const struct wbuf_ops *ops;
+	void *ops_arg;
+
+	uint64_t dropped; // records
+	uint64_t written; // bytes
+	int error; // last errno of write()
+};
+
+extern struct wbuf *wbuf_open(int fd, size_t size, int flush_ms,
+    const struct wbuf_ops *ops, void *ops_arg);
+extern void wbuf_close(struct wbuf *wbuf);
+extern int wbuf_writev(struct wbuf *wbuf, const struct iovec *iov, int iovcnt);
+extern int wbuf_write(struct wbuf *wbuf, const void *data, size_t size);
+extern int wbuf_write_fd(int fd, struct iovec *iov, int iovcnt);
+#endif /* __UTIL_WBUF_H__ */
@@ -841,7 +841,7 @@ wfb_gst_add_dbm(struct wfb_gst_context *ctx, int8_t dbm)
 
 void
 wfb_gst_write(struct wfb_gst_context *ctx,
-    struct timespec *ts, uint8_t *data, size_t size)
+    struct timespec *ts, const uint8_t *data, size_t size)
 {
 	GstBuffer *buf;
 
@@ -69,7 +69,7 @@ extern int wfb_gst_thread_join(struct wfb_gst_context *ctx);
 /* opaque argument 'void *arg' must be wfb_gst_context */
 extern void wfb_gst_add_dbm(struct wfb_gst_context *ctx, int8_t dbm);
 extern void wfb_gst_write(struct wfb_gst_context *ctx,
-    struct timespec *ts, uint8_t *data, size_t size);
+    struct timespec *ts, const uint8_t *data, size_t size);
 extern void wfb_gst_eos(struct wfb_gst_context *ctx);
 
 extern void wfb_gst_handler(int8_t rssi, uint8_t *data, size_t size, void *arg);
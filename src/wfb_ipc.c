@@ -22,6 +22,8 @@ static const char *last_path = NULL;
 static int
 ipc_dump_stat(struct wfb_statistics *st)
 {
+	int i;
+
 	assert(st);
 
 	p_info("Statistics:\n");
@@ -37,6 +39,34 @@ ipc_dump_stat(struct wfb_statistics *st)
 	    st->pcap_wfb_frame_error);
 	p_info("pcap received packets: %" PRIu64 "\n",
 	    st->pcap_accept);
+	p_info("pcap relayed packets: %" PRIu64 "\n",
+	    st->pcap_relayed);
+	p_info("pcap radiotap layout cache hit: %" PRIu64 "\n",
+	    st->pcap_radiotap_cache_hit);
+	p_info("pcap radiotap layout cache miss: %" PRIu64 "\n",
+	    st->pcap_radiotap_cache_miss);
+	p_info("pcap 802.11 header predicted: %" PRIu64 "\n",
+	    st->pcap_80211_predict_hit);
+	for (i = 0; i < RX_MAX_WIRELESS; i++) {
+		if (st->pcap_adapter_accept[i] == 0)
+			continue;
+		p_info("pcap adapter#%d received packets: %" PRIu64 "\n",
+		    i, st->pcap_adapter_accept[i]);
+		p_info("pcap adapter#%d duplicated fragments: %" PRIu64 "\n",
+		    i, st->pcap_adapter_duplicate[i]);
+		p_info("pcap adapter#%d unique fragments: %" PRIu64 "\n",
+		    i, st->pcap_adapter_unique[i]);
+	}
+	p_info("TPACKET blocks: %" PRIu64 "\n",
+	    st->tpacket_blocks);
+	p_info("TPACKET frames: %" PRIu64 "\n",
+	    st->tpacket_frames);
+	p_info("TPACKET kernel drops: %" PRIu64 "\n",
+	    st->tpacket_drops);
+	p_info("TPACKET queue freeze: %" PRIu64 "\n",
+	    st->tpacket_freeze);
+	p_info("TPACKET truncated frames: %" PRIu64 "\n",
+	    st->tpacket_truncated);
 	p_info("Mulitcast UDP header errors: %" PRIu64 "\n",
 	    st->mc_udp_frame_error);
 	p_info("Mulitcast UDP for corrupted frames: %" PRIu64 "\n",
@@ -45,7 +75,76 @@ ipc_dump_stat(struct wfb_statistics *st)
 	    st->mc_udp_wfb_frame_error);
 	p_info("Multicast UDP received packets: %" PRIu64 "\n",
 	    st->mc_accept);
+	for (i = 0; i < NETINET_RX_BATCH_HIST - 1; i++) {
+		p_info("Multicast UDP Rx batch %d-%d: %" PRIu64 "\n",
+		    1 << i, (1 << (i + 1)) - 1, st->mc_rx_batch[i]);
+	}
+	// the last bucket also catches anything above the cap.
+	p_info("Multicast UDP Rx batch >= %d: %" PRIu64 "\n",
+	    1 << i, st->mc_rx_batch[i]);
+	p_info("Multicast UDP Tx syscalls: %" PRIu64 "\n",
+	    st->mc_tx_syscalls);
+	p_info("Multicast UDP Tx syscalls saved: %" PRIu64 "\n",
+	    st->mc_tx_syscalls_saved);
+	p_info("Multicast UDP Tx GSO: %" PRIu64 "\n",
+	    st->mc_tx_gso);
+
+	p_info("Worker decrypt jobs: %" PRIu64 "\n",
+	    st->rx_worker_jobs);
+	p_info("Worker decrypt into ring: %" PRIu64 "\n",
+	    st->rx_worker_direct);
+	p_info("Worker FEC jobs: %" PRIu64 "\n",
+	    st->rx_worker_fec);
+	p_info("Worker queue full: %" PRIu64 "\n",
+	    st->rx_worker_stall);
+	p_info("Session repeats skipped: %" PRIu64 "\n",
+	    st->session_skipped);
+	p_info("Session rekey: %" PRIu64 "\n",
+	    st->session_rekey);
+	p_info("Session rekey without ring reset: %" PRIu64 "\n",
+	    st->session_rekey_hitless);
+	p_info("Session previous key decrypts: %" PRIu64 "\n",
+	    st->session_prev_key);
+	p_info("Session ring rebased: %" PRIu64 "\n",
+	    st->session_rebase);
+	p_info("Session previous key late frames: %" PRIu64 "\n",
+	    st->session_prev_late);
+	p_info("Parity decrypts avoided: %" PRIu64 "\n",
+	    st->rx_decrypt_avoided);
+	p_info("FEC codec cache hit: %" PRIu64 "\n",
+	    st->fec_cache_hit);
+	p_info("FEC codec cache miss: %" PRIu64 "\n",
+	    st->fec_cache_miss);
+	p_info("FEC decode matrix cache hit: %" PRIu64 "\n",
+	    st->fec_decode_cache_hit);
+	p_info("FEC decode matrix cache miss: %" PRIu64 "\n",
+	    st->fec_decode_cache_miss);
+	if (st->fec_decode_cache_hit + st->fec_decode_cache_miss > 0) {
+		p_info("FEC decode matrix cache hit rate: %" PRIu64 "%%\n",
+		    st->fec_decode_cache_hit * 100 /
+		    (st->fec_decode_cache_hit + st->fec_decode_cache_miss));
+	}
+	p_info("Reorder window recovered blocks: %" PRIu64 "\n",
+	    st->rx_reorder_recovered);
+	p_info("Reorder window expired blocks: %" PRIu64 "\n",
+	    st->rx_reorder_expired);
+	for (i = 0; i < RX_MAX_PIPE; i++) {
+		if (st->rx_pipe_hiwat[i] == 0 && st->rx_pipe_overflow[i] == 0)
+			continue;
+		p_info("Capture pipe#%d occupancy: %" PRIu64 "/%d\n",
+		    i, st->rx_pipe_occupancy[i], RX_PIPE_SIZE);
+		p_info("Capture pipe#%d high water mark: %" PRIu64 "\n",
+		    i, st->rx_pipe_hiwat[i]);
+		p_info("Capture pipe#%d overflow: %" PRIu64 "\n",
+		    i, st->rx_pipe_overflow[i]);
+	}
 
+	p_info("Log records dropped: %" PRIu64 "\n",
+	    st->rx_log_dropped);
+	p_info("Messages suppressed: %" PRIu64 "\n",
+	    st->msg_suppressed);
+	p_info("Messages dropped: %" PRIu64 "\n",
+	    st->msg_dropped);
 	p_info("IPC success: %" PRIu64 "\n",
 	    st->ipc_success);
 	p_info("IPC error: %" PRIu64 "\n",
@@ -53,6 +152,8 @@ ipc_dump_stat(struct wfb_statistics *st)
 
 	p_info("Frames mirrored: %" PRIu64 "\n",
 	    st->mirrored_frames);
+	p_info("Duplicated frames not mirrored: %" PRIu64 "\n",
+	    st->mirror_duplicate);
 	p_info("Frames decoded: %" PRIu64 "\n",
 	    st->decoded_frames);
 
@@ -381,6 +482,8 @@ ipc_rx(evutil_socket_t fd, short event, void *arg)
 			break;
 		case WFB_IPC_STAT:
 			p_info("Execute IPC STAT.\n");
+			msg_get_stats(&wfb_stats.msg_suppressed,
+			    &wfb_stats.msg_dropped);
 			msg.u.stat = wfb_stats;
 			ipc_rx_reply(s, &msg, true);
 			break;
@@ -4,10 +4,12 @@
 #include <stdbool.h>
 
 // Ring buffer
-#define RX_RING_SIZE	40
+#define RX_RING_SIZE	64 // power of two
 
 // Handlers
 #define RX_MAX_MIRROR	3
+#define RX_MIRROR_SEEN	1024 // data fragments remembered to drop duplicates
+#define RX_MAX_WIRELESS	4
 #define RX_MAX_DECODE	3
 
 // Radiotap
@@ -18,6 +20,38 @@
 #define PCAP_MTU	(WIFI_MTU + RTAP_SIZ)
 #define INET6_MTU	PCAP_MTU
 
+// Batched multicast Rx
+#define NETINET_RX_BATCH_MAX	64
+#define NETINET_RX_BATCH_HIST	7 // log2 buckets: 1, 2-3, ..., 64
+
+// Batched multicast Tx
+#define NETINET_TX_QUEUE	16
+#define NETINET_TX_GSO_MAX	65000 // must fit in a IPv6 payload.
+#define NETINET_TX_HOLD_MAX	100000 // [us]
+
+// Decrypt/FEC worker pool
+#define RX_MAX_WORKER	16
+#define RX_WORKER_QUEUE	64
+#define MAX_FEC_N	256
+
+// Rx reorder window
+#define RX_REORDER_MAX	1000 // [ms]
+
+// Binary traffic log
+#define RX_LOG_BUFFER_SIZE	(1 << 20) // x2
+#define RX_LOG_FLUSH_INTERVAL	100 // [ms]
+
+// Capture thread to processing thread pipe
+#define RX_PIPE_SIZE	256 // must be power of 2
+#define RX_PIPE_BUDGET	64 // descriptors per wakeup
+#define RX_MAX_PIPE	(RX_MAX_WIRELESS + 1)
+
+// TPACKET_V3 ring (Linux)
+#define TPACKET_BLOCK_SIZE	(1 << 18)
+#define TPACKET_BLOCK_NR	32
+#define TPACKET_FRAME_SIZE	(1 << 13)
+#define TPACKET_RETIRE_TOV	1 // [ms]
+
 // WFB Protocol
 #define WFB_SIG		0x5742
 #define WFB_ADDR6	"ff02::5742"
@@ -29,27 +63,49 @@
 #define DEF_PID_FILE "/var/run/wfb_listener.pid"
 #define DEF_CTRL_FILE "/var/run/wfb_listener.socket"
 
+enum wfb_rx_backend {
+	WFB_RX_PCAP,
+	WFB_RX_TPACKET,
+};
+
 struct wfb_opt {
-	const char *rx_wireless;
+	const char *rx_wireless[RX_MAX_WIRELESS];
+	int n_rx_wireless;
 	const char *rx_wired;
 	const char *tx_wired;
 	const char *key_file;
 	const char *mc_addr;
 	const char *log_file;
+	int log_version;
+	uint64_t log_rotate_size; // [bytes] 0 if disabled
+	int log_rotate_time; // [s] 0 if disabled
+	int log_retain; // segments, 0 if unlimited
 	const char *pid_file;
 	const char *ctrl_file;
 	const char *query_param;
 	const char *mc_port;
+	enum wfb_rx_backend rx_backend;
+	int rx_batch;
+	int tx_hold;
+	bool pipeline;
+	bool rx_hugepage;
+	int workers;
+	int rx_reorder;
 	bool local_play;
 	bool rssi_overlay;
 	bool use_monitor;
 	bool no_fec;
+	bool relay;
 	bool debug;
 	bool daemon;
 	bool kill_daemon;
 	bool use_dns;
 };
 
+/*
+ * each counter has one writer thread, except ones marked atomic. they
+ * are shared by threads and updated by __atomic builtins.
+ */
 struct wfb_statistics {
 	/* pcap */
 	uint64_t pcap_libpcap_frame_error;
@@ -59,12 +115,65 @@ struct wfb_statistics {
 	uint64_t pcap_invalid_channel_id;
 	uint64_t pcap_wfb_frame_error;
 	uint64_t pcap_accept;
+	uint64_t pcap_relayed;
+	uint64_t pcap_radiotap_cache_hit;
+	uint64_t pcap_radiotap_cache_miss;
+	uint64_t pcap_80211_predict_hit;
+	uint64_t pcap_adapter_accept[RX_MAX_WIRELESS];
+	uint64_t pcap_adapter_duplicate[RX_MAX_WIRELESS];
+	uint64_t pcap_adapter_unique[RX_MAX_WIRELESS];
+
+	/* TPACKET_V3 */
+	uint64_t tpacket_blocks; // atomic
+	uint64_t tpacket_frames; // atomic
+	uint64_t tpacket_drops; // atomic
+	uint64_t tpacket_freeze; // atomic
+	uint64_t tpacket_truncated; // atomic
 
 	/* UDP MC */
 	uint64_t mc_udp_frame_error;
 	uint64_t mc_udp_corrupted_frames;
 	uint64_t mc_udp_wfb_frame_error;
 	uint64_t mc_accept;
+	uint64_t mc_rx_batch[NETINET_RX_BATCH_HIST];
+	uint64_t mc_tx_syscalls;
+	uint64_t mc_tx_syscalls_saved;
+	uint64_t mc_tx_gso;
+
+	/* Worker pool */
+	uint64_t rx_worker_jobs;
+	uint64_t rx_worker_direct;
+	uint64_t rx_worker_fec;
+	uint64_t rx_worker_stall;
+
+	/* Session */
+	uint64_t session_skipped;
+	uint64_t session_rekey;
+	uint64_t session_rekey_hitless;
+	uint64_t session_prev_key;
+	uint64_t session_rebase;
+	uint64_t session_prev_late;
+	uint64_t rx_decrypt_avoided;
+	uint64_t fec_cache_hit; // atomic
+	uint64_t fec_cache_miss; // atomic
+	uint64_t fec_decode_cache_hit; // atomic
+	uint64_t fec_decode_cache_miss; // atomic
+
+	/* Reorder window */
+	uint64_t rx_reorder_recovered;
+	uint64_t rx_reorder_expired;
+
+	/* Capture pipe */
+	uint64_t rx_pipe_occupancy[RX_MAX_PIPE];
+	uint64_t rx_pipe_hiwat[RX_MAX_PIPE];
+	uint64_t rx_pipe_overflow[RX_MAX_PIPE];
+
+	/* Traffic log */
+	uint64_t rx_log_dropped; // atomic
+
+	/* Messages */
+	uint64_t msg_suppressed;
+	uint64_t msg_dropped;
 
 	/* IPC */
 	uint64_t ipc_success;
@@ -72,8 +181,9 @@ struct wfb_statistics {
 
 	/* handlers */
 	uint64_t mirrored_frames;
+	uint64_t mirror_duplicate;
 	uint64_t decoded_frames;
-	uint64_t reload;
+	uint64_t reload; // atomic
 
 	/* signals */
 	uint64_t sighup;
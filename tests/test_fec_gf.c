@@ -0,0 +1,292 @@
+/*
+ * GF(2^8) kernels and the decode matrix against zfec.
+ *
+ * Each kernel is forced in turn. fec_gf_addmul() must match fec_gf_mul()
+ * for every coefficient, and for all 1 <= k < n <= 32, the inverted decode
+ * matrix and the recovered blocks must be bit-for-bit identical to
+ * fec_decode() of zfec.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <fec.h>
+
+#include "wfb_params.h"
+#include "frame_wfb.h"
+#include "fec_wfb.h"
+#include "fec_gf.h"
+
+struct wfb_opt wfb_options;
+struct wfb_statistics wfb_stats;
+
+#define TEST_FEC_MAX	32
+#define TEST_BLOCK_SIZE	1027	// not a multiple of the vector width.
+#define TEST_PATTERNS	8	// loss patterns per (k, n).
+
+static const char *kernels[] = { "scalar", "ssse3", "avx2" };
+static const size_t addmul_sizes[] = {
+	0, 1, 15, 16, 17, 31, 32, 33, 47, 63, 64, 65, 95, 127, 128, 129,
+	TEST_BLOCK_SIZE
+};
+
+static uint8_t data[TEST_FEC_MAX][TEST_BLOCK_SIZE];
+static uint8_t parity[TEST_FEC_MAX][TEST_BLOCK_SIZE];
+static uint8_t out_zfec[TEST_FEC_MAX][TEST_BLOCK_SIZE];
+static uint8_t out_gf[TEST_FEC_MAX][TEST_BLOCK_SIZE];
+static uint8_t out_wfb[TEST_FEC_MAX][TEST_BLOCK_SIZE];
+
+static int failed;
+
+static void
+fill_random(uint8_t *p, size_t size, unsigned *seed)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		p[i] = rand_r(seed);
+}
+
+static void
+shuffle(int *v, int n, unsigned *seed)
+{
+	int i, j, t;
+
+	for (i = n - 1; i > 0; i--) {
+		j = rand_r(seed) % (i + 1);
+		t = v[i];
+		v[i] = v[j];
+		v[j] = t;
+	}
+}
+
+/*
+ * every coefficient, sizes around the vector width and unaligned
+ * buffers, against the multiplication table.
+ */
+static int
+test_addmul(unsigned *seed)
+{
+	uint8_t src[TEST_BLOCK_SIZE + 64], dst[TEST_BLOCK_SIZE + 64];
+	uint8_t ref[TEST_BLOCK_SIZE + 64];
+	size_t s, i, size;
+	int c, off;
+
+	for (c = 0; c < 256; c++) {
+		for (s = 0; s < sizeof(addmul_sizes) / sizeof(addmul_sizes[0]);
+		    s++) {
+			size = addmul_sizes[s];
+			off = rand_r(seed) % 32;
+			fill_random(src, sizeof(src), seed);
+			fill_random(dst, sizeof(dst), seed);
+			memcpy(ref, dst, sizeof(ref));
+			for (i = 0; i < size; i++)
+				ref[off + i] ^= fec_gf_mul(c, src[off + 1 + i]);
+
+			fec_gf_addmul(&dst[off], &src[off + 1], c, size);
+			if (memcmp(dst, ref, sizeof(ref)) != 0) {
+				printf("addmul: mismatch c=%d size=%zu "
+				    "offset=%d\n", c, size, off);
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * the decode matrix of zfec. rows of the primary blocks are the unit
+ * vectors, and rows of the parities are taken from the encode matrix.
+ */
+static void
+decode_matrix(const fec_t *code, const unsigned *index, uint8_t *m)
+{
+	int i, k = code->k;
+
+	for (i = 0; i < k; i++) {
+		if (index[i] < k) {
+			memset(&m[i * k], 0, k);
+			m[i * k + i] = 1;
+		}
+		else {
+			memcpy(&m[i * k], &code->enc_matrix[index[i] * k], k);
+		}
+	}
+}
+
+static int
+check_identity(const uint8_t *m, const uint8_t *inv, int k)
+{
+	int row, col, i;
+	uint8_t v;
+
+	for (row = 0; row < k; row++) {
+		for (col = 0; col < k; col++) {
+			v = 0;
+			for (i = 0; i < k; i++)
+				v ^= fec_gf_mul(m[row * k + i], inv[i * k + col]);
+			if (v != (row == col))
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int
+test_decode(int k, int n, unsigned *seed)
+{
+	struct fec_context ctx;
+	fec_t *code;
+	const uint8_t *src[TEST_FEC_MAX], *in[TEST_FEC_MAX];
+	uint8_t *fecs[TEST_FEC_MAX];
+	uint8_t *o_zfec[TEST_FEC_MAX], *o_gf[TEST_FEC_MAX];
+	uint8_t *o_wfb[TEST_FEC_MAX];
+	unsigned block_nums[TEST_FEC_MAX], index[TEST_FEC_MAX];
+	uint8_t m[TEST_FEC_MAX * TEST_FEC_MAX];
+	uint8_t work[TEST_FEC_MAX * TEST_FEC_MAX];
+	uint8_t inv[TEST_FEC_MAX * TEST_FEC_MAX];
+	int lost[TEST_FEC_MAX], used[TEST_FEC_MAX];
+	int p, i, row, col, outix, nlost, max_lost;
+
+	code = fec_new(k, n);
+	if (code == NULL) {
+		printf("fec_new(%d, %d) failed\n", k, n);
+		return -1;
+	}
+	if (fec_wfb_new(&ctx, WFB_FEC_VDM_RS, k, n) < 0) {
+		printf("fec_wfb_new(%d, %d) failed\n", k, n);
+		goto err;
+	}
+
+	for (i = 0; i < k; i++) {
+		fill_random(data[i], TEST_BLOCK_SIZE, seed);
+		src[i] = data[i];
+	}
+	for (i = 0; i < n - k; i++) {
+		fecs[i] = parity[i];
+		block_nums[i] = k + i;
+	}
+	fec_encode(code, src, fecs, block_nums, n - k, TEST_BLOCK_SIZE);
+
+	max_lost = (n - k < k) ? n - k : k;
+	for (p = 0; p < TEST_PATTERNS; p++) {
+		// lose some primary blocks, and fill their positions by
+		// parities. the first pattern loses as many as possible.
+		nlost = (p == 0) ? max_lost : 1 + rand_r(seed) % max_lost;
+		for (i = 0; i < k; i++)
+			lost[i] = i;
+		shuffle(lost, k, seed);
+		for (i = 0; i < n - k; i++)
+			used[i] = k + i;
+		shuffle(used, n - k, seed);
+
+		for (i = 0; i < k; i++) {
+			in[i] = data[i];
+			index[i] = i;
+		}
+		for (i = 0; i < nlost; i++) {
+			in[lost[i]] = parity[used[i] - k];
+			index[lost[i]] = used[i];
+		}
+		for (i = 0; i < nlost; i++) {
+			o_zfec[i] = out_zfec[i];
+			o_gf[i] = out_gf[i];
+			o_wfb[i] = out_wfb[i];
+		}
+
+		fec_decode(code, in, o_zfec, index, TEST_BLOCK_SIZE);
+
+		// the inversion destroys the matrix.
+		decode_matrix(code, index, m);
+		memcpy(work, m, k * k);
+		if (fec_gf_invert_matrix(work, inv, k) < 0) {
+			printf("k=%d n=%d: singular decode matrix\n", k, n);
+			goto err;
+		}
+		if (check_identity(m, inv, k) < 0) {
+			printf("k=%d n=%d: bad inverse\n", k, n);
+			goto err;
+		}
+		for (row = 0, outix = 0; row < k; row++) {
+			if (index[row] < k)
+				continue;
+			memset(o_gf[outix], 0, TEST_BLOCK_SIZE);
+			for (col = 0; col < k; col++) {
+				fec_gf_addmul(o_gf[outix], in[col],
+				    inv[row * k + col], TEST_BLOCK_SIZE);
+			}
+			outix++;
+		}
+
+		if (fec_wfb_apply(&ctx, in, o_wfb, index,
+		    TEST_BLOCK_SIZE) < 0) {
+			printf("k=%d n=%d: fec_wfb_apply() failed\n", k, n);
+			goto err;
+		}
+
+		// zfec emits the lost blocks in the order of the position.
+		for (row = 0, outix = 0; row < k; row++) {
+			if (index[row] < k)
+				continue;
+			if (memcmp(o_zfec[outix], data[row],
+			    TEST_BLOCK_SIZE) != 0) {
+				printf("k=%d n=%d: zfec didn't recover "
+				    "block %d\n", k, n, row);
+				goto err;
+			}
+			if (memcmp(o_gf[outix], o_zfec[outix],
+			    TEST_BLOCK_SIZE) != 0) {
+				printf("k=%d n=%d: block %d differs from "
+				    "zfec\n", k, n, row);
+				goto err;
+			}
+			if (memcmp(o_wfb[outix], o_zfec[outix],
+			    TEST_BLOCK_SIZE) != 0) {
+				printf("k=%d n=%d: block %d of "
+				    "fec_wfb_apply() differs from zfec\n",
+				    k, n, row);
+				goto err;
+			}
+			outix++;
+		}
+	}
+
+	fec_free(code);
+	return 0;
+err:
+	fec_free(code);
+	return -1;
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned seed = 5742;
+	size_t i;
+	int k, n, r;
+
+	fec_wfb_init();
+
+	for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+		if (fec_gf_set_kernel(kernels[i]) < 0) {
+			printf("%s: not supported by the CPU. skipped.\n",
+			    kernels[i]);
+			continue;
+		}
+
+		r = test_addmul(&seed);
+		for (n = 2; r == 0 && n <= TEST_FEC_MAX; n++) {
+			for (k = 1; r == 0 && k < n; k++)
+				r = test_decode(k, n, &seed);
+		}
+
+		printf("%s: %s\n", fec_gf_kernel(), r == 0 ? "OK" : "FAILED");
+		if (r < 0)
+			failed++;
+	}
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}